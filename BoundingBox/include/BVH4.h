@@ -0,0 +1,784 @@
+#ifndef BVH4_H_
+#define BVH4_H_
+
+#include <ngl/Vec3.h>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "RayPacket.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BVH4_USE_SSE 1
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BVH4.h
+/// @brief a four wide bounding volume hierarchy for ray queries. The tree is built as a binary tree using binned
+/// SAH and then collapsed so that each node holds the boxes of up to four children. The child boxes are stored
+/// in SoA form so all four can be tested against a ray with one SIMD slab test, hit children are then visited
+/// nearest first.
+/// The hierarchy only knows about boxes, the primitives themselves are tested by a leaf function passed to
+/// traverse() which makes the same tree usable for triangles, spheres or anything else with a bounding box.
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief simple axis aligned bounding box used to build the tree
+//----------------------------------------------------------------------------------------------------------------------
+struct AABB
+{
+  ngl::Vec3 m_min = ngl::Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+  ngl::Vec3 m_max = ngl::Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  void extend(const ngl::Vec3 &_p);
+  void extend(const AABB &_b);
+  ngl::Vec3 center() const { return (m_min + m_max) * 0.5f; }
+  float surfaceArea() const;
+  bool isEmpty() const { return m_min.m_x > m_max.m_x; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief slab test of a ray against the box with the three axes done at once in SIMD lanes
+  /// @param _tMax the furthest distance along the ray to consider
+  /// @param o_tNear o_tFar where the ray enters and leaves the box clipped to 0 and _tMax
+  /// @returns true if the ray passes through the box between 0 and _tMax
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersect(const Ray &_ray, float _tMax, float &o_tNear, float &o_tFar) const;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief a node of the tree, 128 bytes so it fits exactly in two cache lines. For each of the four slots
+/// m_count is 0 for an inner node (m_child is then the node index) or the number of primitives in a leaf
+/// (m_child is then the first entry in the primitive index array). Unused slots have an inverted box so they
+/// can never pass the slab test.
+//----------------------------------------------------------------------------------------------------------------------
+struct alignas(64) BVH4Node
+{
+  float m_minX[4];
+  float m_minY[4];
+  float m_minZ[4];
+  float m_maxX[4];
+  float m_maxY[4];
+  float m_maxZ[4];
+  uint32_t m_child[4];
+  uint32_t m_count[4];
+};
+static_assert(sizeof(BVH4Node) == 128, "BVH4Node should be two cache lines");
+
+class BVH4
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief index used for empty child slots
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr uint32_t s_emptySlot = 0xffffffff;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief maximum depth of the binary build, deeper ranges are forced into leaves, so no node of a built tree
+  /// is deeper than this and the traversal stacks are sized for it
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr int s_maxDepth = 64;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the tree from the bounds of each primitive, the index of a primitive is its position in _bounds
+  /// @param _bounds the bounding box of each primitive
+  /// @param _maxLeafSize the most primitives a leaf may hold
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<AABB> &_bounds, uint32_t _maxLeafSize = 4);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief recompute every box bottom up from new primitive bounds keeping the shape of the tree, for primitives
+  /// that move but are never added or removed. The subtrees below the top few levels are refit on a pool of
+  /// threads and the top is finished from their boxes. An attached tree is copied into the tree first.
+  /// @param _bounds the new bounds of each primitive, the same number as the tree was built with
+  /// @param _numThreads threads to use, 0 for one per hardware thread
+  //----------------------------------------------------------------------------------------------------------------------
+  void refit(const std::vector<AABB> &_bounds, unsigned int _numThreads = 0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief refit the tree then rebuild it only if the refit has made it much worse than when it was built
+  /// @param _maxCostRatio rebuild when sahCost() is more than this times the cost after the last build
+  /// @returns true if the tree was rebuilt
+  //----------------------------------------------------------------------------------------------------------------------
+  bool update(const std::vector<AABB> &_bounds, float _maxCostRatio = 1.5f, unsigned int _numThreads = 0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the surface area heuristic cost of the tree, one for every node plus the primitives in every leaf
+  /// each weighted by the chance of a ray through the root hitting its box. Uses the same costs as the build.
+  //----------------------------------------------------------------------------------------------------------------------
+  float sahCost() const;
+  float builtCost() const { return m_builtCost; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief spend up to _budget microseconds improving a refit tree, called every tick after refit() with the same
+  /// bounds it keeps the tree close to a fresh build without ever paying for a full rebuild in one go.
+  /// Subtrees are rebuilt in place, ranked by their SAH cost per primitive which is roughly the improvement a rebuild
+  /// buys for the time it takes, and the worst that can be rebuilt in the time left are picked. Big trees are ranked
+  /// a few subtrees per call so the ranking stays within the budget too.
+  /// Subtree rebuilds can't move primitives that have drifted across the whole scene between the top level
+  /// subtrees, so when the top levels of a tree too big to rebuild in one call get much worse than when built a full
+  /// build is started on a copy of the bounds and carried on with half the budget of each call. When it is done it
+  /// is refit to the current bounds and replaces the tree.
+  /// @param _fullRebuild false to never start the sliced full build, when something else rebuilds the whole tree
+  /// @returns the number of subtrees rebuilt, counting a finished full build as one
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t optimise(const std::vector<AABB> &_bounds, double _budget, bool _fullRebuild = true);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief trace a ray through the tree visiting children nearest first
+  /// @param _ray the ray to trace
+  /// @param _tMax the furthest distance along the ray to consider
+  /// @param _leaf called for each leaf the ray reaches as bool _leaf(uint32_t _first,uint32_t _count,float &io_tMax)
+  /// the primitives in the leaf are primIndex(_first) to primIndex(_first+_count-1). The function may shorten
+  /// io_tMax (for a closest hit) to cull the rest of the traversal and returns true to stop the traversal.
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename LeafFunc>
+  void traverse(const Ray &_ray, float _tMax, LeafFunc &&_leaf) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief trace a packet of rays through the tree together. Boxes are culled for the whole packet with the
+  /// interval test and each child remembers the first ray that hits it, so rays that have already left the
+  /// packet's path are not tested again further down. Packets that are not coherent fall back to tracing each
+  /// ray on its own with the single ray traverse().
+  /// @param io_packet the rays to trace, the leaf function may shorten their m_tMax
+  /// @param _leaf called for each leaf reached by at least one ray as bool _leaf(uint32_t _first,uint32_t _count,
+  /// uint64_t _rayMask) where bit i of _rayMask is set if ray i of the packet hits the leaf box. It returns true to
+  /// stop tracing the packet.
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename LeafFunc>
+  void traverse(RayPacket &io_packet, LeafFunc &&_leaf) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief visit every leaf whose box overlaps _box, for broad phase collision tests
+  /// @param _leaf called as bool _leaf(uint32_t _first,uint32_t _count) for each leaf, returns true to stop
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename LeafFunc>
+  void overlap(const AABB &_box, LeafFunc &&_leaf) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief visit every leaf whose box is within _radius of _centre, for sphere against primitive tests
+  /// @param _leaf called as bool _leaf(uint32_t _first,uint32_t _count) for each leaf, returns true to stop
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename LeafFunc>
+  void overlap(const ngl::Vec3 &_centre, float _radius, LeafFunc &&_leaf) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief access to the tree
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t primIndex(uint32_t _i) const { return primIndexData()[_i]; }
+  const BVH4Node *nodeData() const { return m_externalNodes != nullptr ? m_externalNodes : m_nodes.data(); }
+  const uint32_t *primIndexData() const { return m_externalPrims != nullptr ? m_externalPrims : m_primIndices.data(); }
+  uint32_t numNodes() const { return m_numNodes; }
+  uint32_t numPrims() const { return m_numPrims; }
+  uint32_t maxLeafSize() const { return m_maxLeafSize; }
+  const AABB &bounds() const { return m_bounds; }
+  bool empty() const { return m_numNodes == 0; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief use nodes and primitive indices stored somewhere else, such as a memory mapped file, instead of building
+  /// the tree. Nothing is copied so the arrays must stay valid until the next build() or attach().
+  /// @param _nodes the nodes with the root first, child indices are relative to this array
+  /// @param _primIndices the primitive index array the leaves point into
+  //----------------------------------------------------------------------------------------------------------------------
+  void attach(const BVH4Node *_nodes, uint32_t _numNodes, const uint32_t *_primIndices, uint32_t _numPrims,
+              const AABB &_bounds, uint32_t _maxLeafSize);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the memory used by the nodes and index array in bytes
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t memoryUsage() const;
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief node of the temporary binary tree created during the build
+  //----------------------------------------------------------------------------------------------------------------------
+  struct BuildNode
+  {
+    AABB m_bounds;
+    uint32_t m_left = 0;
+    uint32_t m_right = 0;
+    uint32_t m_first = 0;
+    uint32_t m_count = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a range of primitives the sliced build still has to split, the node made from it is linked to m_parent
+  //----------------------------------------------------------------------------------------------------------------------
+  struct BuildTask
+  {
+    uint32_t m_parent;
+    bool m_right;
+    uint32_t m_first;
+    uint32_t m_count;
+    int m_depth;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief state of a full build carried on across optimise() calls, it has its own primitive index array so the
+  /// tree in use is left alone until the build is finished
+  //----------------------------------------------------------------------------------------------------------------------
+  struct SlicedBuild
+  {
+    std::vector<AABB> m_bounds;
+    std::vector<ngl::Vec3> m_centroids;
+    std::vector<uint32_t> m_primIndices;
+    std::vector<BuildNode> m_tree;
+    std::vector<BuildTask> m_tasks;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the sliced build splits ranges bigger than this one at a time and builds smaller ones in one go
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr uint32_t s_slicedChunk = 1024;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief start the sliced build when topLevelCost() is this many times its cost when built
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr float s_slicedRebuildRatio = 1.5f;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief an inner node the optimiser might rebuild, m_depth is how far below the root it is
+  //----------------------------------------------------------------------------------------------------------------------
+  struct OptimiseCandidate
+  {
+    float m_badness;
+    uint32_t m_node;
+    uint32_t m_numPrims;
+    int m_depth;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief optimise() only sorts this many of the worst nodes, it rarely gets through more in one call
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr size_t s_maxOptimiseCandidates = 64;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief per ray values used by the slab test
+  //----------------------------------------------------------------------------------------------------------------------
+  struct RayBoxData
+  {
+    explicit RayBoxData(const Ray &_ray);
+    float m_org[3];
+    float m_invDir[3];
+    bool m_negative[3];
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief entry on the traversal stack, leaves are pushed with their count so they can be culled by distance too
+  //----------------------------------------------------------------------------------------------------------------------
+  struct StackEntry
+  {
+    uint32_t m_child;
+    uint32_t m_count;
+    float m_tNear;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief entry on the packet traversal stack, m_firstRay is the first ray known to hit the box and for leaves
+  /// m_rayMask holds every ray that hits it
+  //----------------------------------------------------------------------------------------------------------------------
+  struct PacketStackEntry
+  {
+    uint32_t m_child;
+    uint32_t m_count;
+    uint32_t m_firstRay;
+    float m_tNear;
+    uint64_t m_rayMask;
+  };
+  static constexpr int s_stackSize = 3 * s_maxDepth + 4;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief slab test the ray against the four child boxes of a node
+  /// @param o_tNear the entry distance for each child
+  /// @returns a bit mask of the children hit
+  //----------------------------------------------------------------------------------------------------------------------
+  static int intersectChildren(const BVH4Node &_node, const RayBoxData &_ray, float _tMax, float *o_tNear);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief interval arithmetic test of a whole packet against the four child boxes, a child is only rejected
+  /// when every ray in the packet misses it
+  /// @param o_tNear the lower bound of the entry distance over all the rays for each child
+  /// @returns a bit mask of the children that may be hit
+  //----------------------------------------------------------------------------------------------------------------------
+  static int intersectChildren(const BVH4Node &_node, const RayPacket &_packet, float _tMax, float *o_tNear);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @returns a bit mask of the children whose boxes overlap _box
+  //----------------------------------------------------------------------------------------------------------------------
+  static int overlapChildren(const BVH4Node &_node, const AABB &_box);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @returns a bit mask of the children whose boxes are within sqrt(_radius2) of _centre
+  //----------------------------------------------------------------------------------------------------------------------
+  static int overlapChildren(const BVH4Node &_node, const ngl::Vec3 &_centre, float _radius2);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the traversal shared by the overlap queries
+  /// @param _children called as int _children(const BVH4Node &_node) giving the mask of children to visit
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename ChildFunc, typename LeafFunc>
+  void overlapNodes(ChildFunc &&_children, LeafFunc &&_leaf) const;
+  uint32_t buildBinary(std::vector<BuildNode> &_tree, uint32_t *io_primIndices, const std::vector<AABB> &_bounds,
+                       const std::vector<ngl::Vec3> &_centroids, uint32_t _first, uint32_t _count, int _depth) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief binned SAH split of the primitives io_primIndices[_first] to io_primIndices[_first+_count-1], they are
+  /// partitioned in place with the left side first
+  /// @param o_bounds the box around all of them
+  /// @returns how many went to the left, 0 if they should stay together in a leaf
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t split(uint32_t *io_primIndices, const std::vector<AABB> &_bounds, const std::vector<ngl::Vec3> &_centroids,
+                 uint32_t _first, uint32_t _count, int _depth, AABB &o_bounds) const;
+  uint32_t collapse(const std::vector<BuildNode> &_tree, uint32_t _node);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief collapse the binary tree into m_nodes, a root that is a leaf still gets an inner node
+  //----------------------------------------------------------------------------------------------------------------------
+  void collapseRoot(const std::vector<BuildNode> &_tree, uint32_t _root);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the refit is split into the subtrees this many levels below the root
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr int s_refitDepth = 3;
+  static void setSlot(BVH4Node &io_node, int _slot, const AABB &_bounds);
+  static void clearNode(BVH4Node &o_node);
+  static bool isUnused(const BVH4Node &_node);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy an attached tree into m_nodes and m_primIndices so it can be changed
+  //----------------------------------------------------------------------------------------------------------------------
+  void ownNodes();
+  AABB leafBounds(uint32_t _first, uint32_t _count, const std::vector<AABB> &_bounds) const;
+  AABB refitNode(uint32_t _node, const std::vector<AABB> &_bounds);
+  void collectSubtrees(uint32_t _node, int _depth, std::vector<uint32_t> &o_subtrees) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief refit the levels above s_refitDepth taking the subtree boxes in the order collectSubtrees found them
+  //----------------------------------------------------------------------------------------------------------------------
+  AABB refitTop(uint32_t _node, int _depth, const std::vector<AABB> &_bounds, const std::vector<AABB> &_subtreeBounds, size_t &io_next);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add _node and every inner node below it to o_candidates
+  /// @param o_cost the SAH cost of the subtree without dividing by the root area
+  /// @returns the number of primitives under _node
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t rankNodes(uint32_t _node, int _depth, std::vector<OptimiseCandidate> &o_candidates, float &o_cost) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the part of sahCost() from the nodes above s_refitDepth, the levels subtree rebuilds can't reach
+  //----------------------------------------------------------------------------------------------------------------------
+  float topLevelCost() const;
+  float topLevelCost(uint32_t _node, int _depth) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the sliced build starts from a copy of _bounds
+  //----------------------------------------------------------------------------------------------------------------------
+  void startSlicedBuild(const std::vector<AABB> &_bounds);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief carry the sliced build on until _budget microseconds after _start
+  /// @returns true if it finished and replaced the tree
+  //----------------------------------------------------------------------------------------------------------------------
+  bool continueSlicedBuild(const std::vector<AABB> &_bounds, std::chrono::steady_clock::time_point _start, double _budget);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the last node and the primitive range of the subtree under _node, the nodes of a subtree and its
+  /// primitives are always contiguous
+  //----------------------------------------------------------------------------------------------------------------------
+  void subtreeExtent(uint32_t _node, uint32_t &io_end, uint32_t &io_firstPrim, uint32_t &io_numPrims) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuild the subtree under _node over the same primitives and write it back over the old nodes, the
+  /// scratch vectors are kept by optimise() between calls
+  /// @returns the end of the node range rewritten or 0 if the new subtree needed more nodes than the old one and
+  /// isn't at the end of the array where it could grow
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t rebuildSubtree(uint32_t _node, int _depth, const std::vector<AABB> &_bounds, std::vector<ngl::Vec3> &io_centroids,
+                          std::vector<BuildNode> &io_tree, std::vector<BVH4Node> &io_nodes, std::vector<uint32_t> &io_saved);
+  std::vector<BVH4Node> m_nodes;
+  std::vector<uint32_t> m_primIndices;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set by attach() when the tree lives outside the vectors above
+  //----------------------------------------------------------------------------------------------------------------------
+  const BVH4Node *m_externalNodes = nullptr;
+  const uint32_t *m_externalPrims = nullptr;
+  uint32_t m_numNodes = 0;
+  uint32_t m_numPrims = 0;
+  AABB m_bounds;
+  uint32_t m_maxLeafSize = 4;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief sahCost() just after the last build, 0 if it hasn't been worked out yet
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_builtCost = 0.0f;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief running estimate of the microseconds optimise() takes to rebuild a subtree per primitive
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_rebuildCost = 0.2f;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief topLevelCost() just after the last build and the full build optimise() is working on
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_builtTopCost = 0.0f;
+  SlicedBuild m_sliced;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the subtree optimise() ranks next when the tree is too big to rank all at once
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t m_optimiseCursor = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool AABB::intersect(const Ray &_ray, float _tMax, float &o_tNear, float &o_tFar) const
+{
+  float dir[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    // avoid 0*inf giving a NaN in the slab test when the ray lies in a slab plane
+    dir[i] = std::fabs(_ray.m_dir[i]) < 1e-20f ? std::copysign(1e-20f, _ray.m_dir[i]) : _ray.m_dir[i];
+  }
+#ifdef BVH4_USE_SSE
+  // the fourth lane is a slab from 0 to _tMax so the interval is clipped to the ray along with the three axes
+  const __m128 origin = _mm_setr_ps(_ray.m_origin.m_x, _ray.m_origin.m_y, _ray.m_origin.m_z, 0.0f);
+  const __m128 invDir = _mm_div_ps(_mm_set1_ps(1.0f), _mm_setr_ps(dir[0], dir[1], dir[2], 1.0f));
+  const __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(m_min.m_x, m_min.m_y, m_min.m_z, 0.0f), origin), invDir);
+  const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_setr_ps(m_max.m_x, m_max.m_y, m_max.m_z, _tMax), origin), invDir);
+  __m128 tNear = _mm_min_ps(t0, t1);
+  __m128 tFar = _mm_max_ps(t0, t1);
+  // largest entry and smallest exit across the lanes
+  tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+  tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+  tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+  tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+  o_tNear = _mm_cvtss_f32(tNear);
+  o_tFar = _mm_cvtss_f32(tFar);
+#else
+  o_tNear = 0.0f;
+  o_tFar = _tMax;
+  for (int i = 0; i < 3; ++i)
+  {
+    float t0 = (m_min[i] - _ray.m_origin[i]) / dir[i];
+    float t1 = (m_max[i] - _ray.m_origin[i]) / dir[i];
+    o_tNear = std::fmax(o_tNear, std::fmin(t0, t1));
+    o_tFar = std::fmin(o_tFar, std::fmax(t0, t1));
+  }
+#endif
+  return o_tNear <= o_tFar;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline BVH4::RayBoxData::RayBoxData(const Ray &_ray)
+{
+  for (int i = 0; i < 3; ++i)
+  {
+    float d = _ray.m_dir[i];
+    // avoid 0*inf giving a NaN in the slab test when the ray lies in a slab plane
+    if (std::fabs(d) < 1e-20f)
+    {
+      d = std::copysign(1e-20f, d);
+    }
+    m_org[i] = _ray.m_origin[i];
+    m_invDir[i] = 1.0f / d;
+    m_negative[i] = m_invDir[i] < 0.0f;
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline int BVH4::intersectChildren(const BVH4Node &_node, const RayBoxData &_ray, float _tMax, float *o_tNear)
+{
+  // pick the near and far planes once per node from the sign of the direction
+  const float *nearX = _ray.m_negative[0] ? _node.m_maxX : _node.m_minX;
+  const float *farX = _ray.m_negative[0] ? _node.m_minX : _node.m_maxX;
+  const float *nearY = _ray.m_negative[1] ? _node.m_maxY : _node.m_minY;
+  const float *farY = _ray.m_negative[1] ? _node.m_minY : _node.m_maxY;
+  const float *nearZ = _ray.m_negative[2] ? _node.m_maxZ : _node.m_minZ;
+  const float *farZ = _ray.m_negative[2] ? _node.m_minZ : _node.m_maxZ;
+#ifdef BVH4_USE_SSE
+  const __m128 ox = _mm_set1_ps(_ray.m_org[0]);
+  const __m128 oy = _mm_set1_ps(_ray.m_org[1]);
+  const __m128 oz = _mm_set1_ps(_ray.m_org[2]);
+  const __m128 ix = _mm_set1_ps(_ray.m_invDir[0]);
+  const __m128 iy = _mm_set1_ps(_ray.m_invDir[1]);
+  const __m128 iz = _mm_set1_ps(_ray.m_invDir[2]);
+  const __m128 tNearX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearX), ox), ix);
+  const __m128 tNearY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearY), oy), iy);
+  const __m128 tNearZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearZ), oz), iz);
+  const __m128 tFarX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farX), ox), ix);
+  const __m128 tFarY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farY), oy), iy);
+  const __m128 tFarZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farZ), oz), iz);
+  const __m128 tNear = _mm_max_ps(_mm_max_ps(tNearX, tNearY), _mm_max_ps(tNearZ, _mm_setzero_ps()));
+  const __m128 tFar = _mm_min_ps(_mm_min_ps(tFarX, tFarY), _mm_min_ps(tFarZ, _mm_set1_ps(_tMax)));
+  _mm_storeu_ps(o_tNear, tNear);
+  return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+#else
+  int mask = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    float tNear = std::fmax(std::fmax((nearX[i] - _ray.m_org[0]) * _ray.m_invDir[0],
+                                      (nearY[i] - _ray.m_org[1]) * _ray.m_invDir[1]),
+                            std::fmax((nearZ[i] - _ray.m_org[2]) * _ray.m_invDir[2], 0.0f));
+    float tFar = std::fmin(std::fmin((farX[i] - _ray.m_org[0]) * _ray.m_invDir[0],
+                                     (farY[i] - _ray.m_org[1]) * _ray.m_invDir[1]),
+                           std::fmin((farZ[i] - _ray.m_org[2]) * _ray.m_invDir[2], _tMax));
+    o_tNear[i] = tNear;
+    mask |= (tNear <= tFar) << i;
+  }
+  return mask;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename LeafFunc>
+void BVH4::traverse(const Ray &_ray, float _tMax, LeafFunc &&_leaf) const
+{
+  if (empty())
+  {
+    return;
+  }
+  const BVH4Node *nodes = nodeData();
+  const RayBoxData ray(_ray);
+  StackEntry stack[s_stackSize];
+  int stackPtr = 0;
+  // the root is always an inner node, even a single primitive gets a node with one leaf slot
+  stack[stackPtr++] = {0, 0, 0.0f};
+  while (stackPtr > 0)
+  {
+    const StackEntry entry = stack[--stackPtr];
+    // a closer hit may have been found since this entry was pushed
+    if (entry.m_tNear > _tMax)
+    {
+      continue;
+    }
+    if (entry.m_count != 0)
+    {
+      if (_leaf(entry.m_child, entry.m_count, _tMax))
+      {
+        return;
+      }
+      continue;
+    }
+    const BVH4Node &node = nodes[entry.m_child];
+    float tNear[4];
+    int mask = intersectChildren(node, ray, _tMax, tNear);
+    // gather the hit children and insertion sort them furthest first, so the nearest is pushed last
+    StackEntry hits[4];
+    int numHits = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      if (!(mask & (1 << i)))
+      {
+        continue;
+      }
+      StackEntry e = {node.m_child[i], node.m_count[i], tNear[i]};
+      int j = numHits++;
+      while (j > 0 && hits[j - 1].m_tNear < e.m_tNear)
+      {
+        hits[j] = hits[j - 1];
+        --j;
+      }
+      hits[j] = e;
+    }
+    for (int i = 0; i < numHits; ++i)
+    {
+      stack[stackPtr++] = hits[i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline int BVH4::intersectChildren(const BVH4Node &_node, const RayPacket &_packet, float _tMax, float *o_tNear)
+{
+  const float *nearPlane[3] = {_packet.m_negative[0] ? _node.m_maxX : _node.m_minX,
+                               _packet.m_negative[1] ? _node.m_maxY : _node.m_minY,
+                               _packet.m_negative[2] ? _node.m_maxZ : _node.m_minZ};
+  const float *farPlane[3] = {_packet.m_negative[0] ? _node.m_minX : _node.m_maxX,
+                              _packet.m_negative[1] ? _node.m_minY : _node.m_maxY,
+                              _packet.m_negative[2] ? _node.m_minZ : _node.m_maxZ};
+  int mask = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    float tNear = 0.0f;
+    float tFar = _tMax;
+    for (int a = 0; a < 3; ++a)
+    {
+      // (plane - origin) * invDir over the intervals of origin and invDir, the smallest product bounds the
+      // entry distance of every ray from below and the largest bounds the exit distance from above
+      const float n0 = (nearPlane[a][i] - _packet.m_orgMax[a]) * _packet.m_invDirMin[a];
+      const float n1 = (nearPlane[a][i] - _packet.m_orgMax[a]) * _packet.m_invDirMax[a];
+      const float n2 = (nearPlane[a][i] - _packet.m_orgMin[a]) * _packet.m_invDirMin[a];
+      const float n3 = (nearPlane[a][i] - _packet.m_orgMin[a]) * _packet.m_invDirMax[a];
+      const float f0 = (farPlane[a][i] - _packet.m_orgMax[a]) * _packet.m_invDirMin[a];
+      const float f1 = (farPlane[a][i] - _packet.m_orgMax[a]) * _packet.m_invDirMax[a];
+      const float f2 = (farPlane[a][i] - _packet.m_orgMin[a]) * _packet.m_invDirMin[a];
+      const float f3 = (farPlane[a][i] - _packet.m_orgMin[a]) * _packet.m_invDirMax[a];
+      tNear = std::fmax(tNear, std::fmin(std::fmin(n0, n1), std::fmin(n2, n3)));
+      tFar = std::fmin(tFar, std::fmax(std::fmax(f0, f1), std::fmax(f2, f3)));
+    }
+    o_tNear[i] = tNear;
+    mask |= (tNear <= tFar) << i;
+  }
+  return mask;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename LeafFunc>
+void BVH4::traverse(RayPacket &io_packet, LeafFunc &&_leaf) const
+{
+  if (empty() || io_packet.m_count == 0)
+  {
+    return;
+  }
+  const BVH4Node *nodes = nodeData();
+  if (!io_packet.m_coherent)
+  {
+    // the interval test would hardly cull anything so trace the rays one at a time
+    bool stop = false;
+    for (uint32_t r = 0; r < io_packet.m_count && !stop; ++r)
+    {
+      traverse(io_packet.m_rays[r], io_packet.m_tMax[r], [&](uint32_t _first, uint32_t _count, float &io_tMax)
+               {
+                 stop = _leaf(_first, _count, uint64_t(1) << r);
+                 io_tMax = io_packet.m_tMax[r];
+                 return stop; });
+    }
+    return;
+  }
+  PacketStackEntry stack[s_stackSize];
+  int stackPtr = 0;
+  stack[stackPtr++] = {0, 0, 0, 0.0f, 0};
+  float packetTMax = io_packet.maxTMax();
+  while (stackPtr > 0)
+  {
+    const PacketStackEntry entry = stack[--stackPtr];
+    if (entry.m_tNear > packetTMax)
+    {
+      continue;
+    }
+    if (entry.m_count != 0)
+    {
+      if (_leaf(entry.m_child, entry.m_count, entry.m_rayMask))
+      {
+        return;
+      }
+      packetTMax = io_packet.maxTMax();
+      continue;
+    }
+    const BVH4Node &node = nodes[entry.m_child];
+    float tNear[4];
+    int mask = intersectChildren(node, io_packet, packetTMax, tNear);
+    PacketStackEntry hits[4];
+    int numHits = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      if (!(mask & (1 << i)))
+      {
+        continue;
+      }
+      // the interval test is conservative so look for a ray that really hits the box, rays before the
+      // parent's first ray missed the parent and can't hit the child either
+      const float box[6] = {node.m_minX[i], node.m_minY[i], node.m_minZ[i], node.m_maxX[i], node.m_maxY[i], node.m_maxZ[i]};
+      PacketStackEntry e = {node.m_child[i], node.m_count[i], io_packet.m_count, tNear[i], 0};
+      float rayNear;
+      for (uint32_t r = entry.m_firstRay; r < io_packet.m_count; ++r)
+      {
+        if (io_packet.intersectBox(r, box, rayNear))
+        {
+          if (e.m_firstRay == io_packet.m_count)
+          {
+            e.m_firstRay = r;
+          }
+          e.m_rayMask |= uint64_t(1) << r;
+          // inner nodes only need the first ray, leaves want every ray
+          if (e.m_count == 0)
+          {
+            break;
+          }
+        }
+      }
+      if (e.m_firstRay == io_packet.m_count)
+      {
+        continue;
+      }
+      int j = numHits++;
+      while (j > 0 && hits[j - 1].m_tNear < e.m_tNear)
+      {
+        hits[j] = hits[j - 1];
+        --j;
+      }
+      hits[j] = e;
+    }
+    for (int i = 0; i < numHits; ++i)
+    {
+      stack[stackPtr++] = hits[i];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline int BVH4::overlapChildren(const BVH4Node &_node, const AABB &_box)
+{
+#ifdef BVH4_USE_SSE
+  // empty slots have min > max so they fail one of the tests against any box
+  __m128 inside = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(_node.m_minX), _mm_set1_ps(_box.m_max.m_x)),
+                             _mm_cmpge_ps(_mm_load_ps(_node.m_maxX), _mm_set1_ps(_box.m_min.m_x)));
+  inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(_mm_load_ps(_node.m_minY), _mm_set1_ps(_box.m_max.m_y)),
+                                         _mm_cmpge_ps(_mm_load_ps(_node.m_maxY), _mm_set1_ps(_box.m_min.m_y))));
+  inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmple_ps(_mm_load_ps(_node.m_minZ), _mm_set1_ps(_box.m_max.m_z)),
+                                         _mm_cmpge_ps(_mm_load_ps(_node.m_maxZ), _mm_set1_ps(_box.m_min.m_z))));
+  return _mm_movemask_ps(inside);
+#else
+  int mask = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    bool inside = _node.m_minX[i] <= _box.m_max.m_x && _node.m_maxX[i] >= _box.m_min.m_x &&
+                  _node.m_minY[i] <= _box.m_max.m_y && _node.m_maxY[i] >= _box.m_min.m_y &&
+                  _node.m_minZ[i] <= _box.m_max.m_z && _node.m_maxZ[i] >= _box.m_min.m_z;
+    mask |= inside << i;
+  }
+  return mask;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline int BVH4::overlapChildren(const BVH4Node &_node, const ngl::Vec3 &_centre, float _radius2)
+{
+  // the distance from the centre to each box is how far it is outside the slab on each axis, empty slots have
+  // min > max so they come out as a huge distance
+#ifdef BVH4_USE_SSE
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 cx = _mm_set1_ps(_centre.m_x);
+  const __m128 cy = _mm_set1_ps(_centre.m_y);
+  const __m128 cz = _mm_set1_ps(_centre.m_z);
+  const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(_node.m_minX), cx), _mm_sub_ps(cx, _mm_load_ps(_node.m_maxX))), zero);
+  const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(_node.m_minY), cy), _mm_sub_ps(cy, _mm_load_ps(_node.m_maxY))), zero);
+  const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(_node.m_minZ), cz), _mm_sub_ps(cz, _mm_load_ps(_node.m_maxZ))), zero);
+  const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+  return _mm_movemask_ps(_mm_cmple_ps(d2, _mm_set1_ps(_radius2)));
+#else
+  int mask = 0;
+  for (int i = 0; i < 4; ++i)
+  {
+    float dx = std::fmax(std::fmax(_node.m_minX[i] - _centre.m_x, _centre.m_x - _node.m_maxX[i]), 0.0f);
+    float dy = std::fmax(std::fmax(_node.m_minY[i] - _centre.m_y, _centre.m_y - _node.m_maxY[i]), 0.0f);
+    float dz = std::fmax(std::fmax(_node.m_minZ[i] - _centre.m_z, _centre.m_z - _node.m_maxZ[i]), 0.0f);
+    mask |= (dx * dx + dy * dy + dz * dz <= _radius2) << i;
+  }
+  return mask;
+#endif
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename LeafFunc>
+void BVH4::overlap(const AABB &_box, LeafFunc &&_leaf) const
+{
+  overlapNodes([&_box](const BVH4Node &_node)
+               { return overlapChildren(_node, _box); },
+               _leaf);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename LeafFunc>
+void BVH4::overlap(const ngl::Vec3 &_centre, float _radius, LeafFunc &&_leaf) const
+{
+  const float radius2 = _radius * _radius;
+  overlapNodes([&_centre, radius2](const BVH4Node &_node)
+               { return overlapChildren(_node, _centre, radius2); },
+               _leaf);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename ChildFunc, typename LeafFunc>
+void BVH4::overlapNodes(ChildFunc &&_children, LeafFunc &&_leaf) const
+{
+  if (empty())
+  {
+    return;
+  }
+  const BVH4Node *nodes = nodeData();
+  // there is no order to visit children in so only inner nodes go on the stack and leaves are visited straight away
+  uint32_t stack[s_stackSize];
+  int stackPtr = 0;
+  stack[stackPtr++] = 0;
+  while (stackPtr > 0)
+  {
+    const BVH4Node &node = nodes[stack[--stackPtr]];
+    int mask = _children(node);
+    for (int i = 0; i < 4; ++i)
+    {
+      if (!(mask & (1 << i)))
+      {
+        continue;
+      }
+      if (node.m_count[i] == 0)
+      {
+        stack[stackPtr++] = node.m_child[i];
+      }
+      else if (_leaf(node.m_child[i], node.m_count[i]))
+      {
+        return;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef HALFSPACESET_H_
+#define HALFSPACESET_H_
+
+#include <ngl/Vec3.h>
+#include <cstdint>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file HalfSpaceSet.h
+/// @brief a convex container made of up to 32 planes, the inside is where n.p <= d for every plane. Boxes at any
+/// angle, hoppers and funnels are all sets of planes. The planes are stored as separate arrays of normal x, y, z
+/// and offset, the collide kernel takes the spheres the same way and tests four spheres against a plane at a time.
+//----------------------------------------------------------------------------------------------------------------------
+class HalfSpaceSet
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the most planes a set can have, one bit each in a hit mask
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr size_t s_maxPlanes = 32;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add the half space _normal.p <= _offset
+  /// @param _normal the outward normal, it is normalized and _offset scaled to match
+  /// @returns false if the set is full
+  //----------------------------------------------------------------------------------------------------------------------
+  bool addPlane(const ngl::Vec3 &_normal, float _offset);
+  void clear();
+  size_t numPlanes() const { return m_offset.size(); }
+  ngl::Vec3 normal(size_t _plane) const { return ngl::Vec3(m_normalX[_plane], m_normalY[_plane], m_normalZ[_plane]); }
+  float offset(size_t _plane) const { return m_offset[_plane]; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief find the walls a batch of spheres touch
+  /// @param o_hitPlanes for each sphere bit k is set if the sphere reaches plane k
+  //----------------------------------------------------------------------------------------------------------------------
+  void collide(const float *_x, const float *_y, const float *_z, const float *_radius, size_t _count, uint32_t *o_hitPlanes) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the edges of the container as pairs of points for drawing as lines, edges that run off to infinity
+  /// of an open set are left out
+  //----------------------------------------------------------------------------------------------------------------------
+  void edges(std::vector<ngl::Vec3> &o_lines) const;
+
+private:
+  std::vector<float> m_normalX;
+  std::vector<float> m_normalY;
+  std::vector<float> m_normalZ;
+  std::vector<float> m_offset;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef MESHCOLLIDER_H_
+#define MESHCOLLIDER_H_
+
+#include <ngl/Vec3.h>
+#include <cstdint>
+#include <vector>
+#include "BVH4.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MeshCollider.h
+/// @brief a triangle mesh for spheres to bounce off. The triangles are kept in a BVH4 and a sphere only looks at
+/// the leaves whose boxes are within its radius of its centre, for each triangle there the closest point to the
+/// centre is found and the deepest contact is kept for the response.
+//----------------------------------------------------------------------------------------------------------------------
+class MeshCollider
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief where a sphere touches the mesh
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Contact
+  {
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the closest point of the mesh to the sphere centre
+    //----------------------------------------------------------------------------------------------------------------------
+    ngl::Vec3 m_point;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief unit normal from the mesh towards the sphere centre
+    //----------------------------------------------------------------------------------------------------------------------
+    ngl::Vec3 m_normal;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief how far the sphere has gone into the mesh along m_normal, more than the radius when the centre has
+    /// crossed behind a face
+    //----------------------------------------------------------------------------------------------------------------------
+    float m_depth;
+    uint32_t m_triangle;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief take the mesh and build the tree over its triangles
+  /// @param _indices three vertex indices per triangle
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(std::vector<ngl::Vec3> _vertices, std::vector<uint32_t> _indices);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the deepest contact of a sphere with the mesh
+  /// @returns false if the sphere doesn't touch the mesh, o_contact is only written on a contact
+  //----------------------------------------------------------------------------------------------------------------------
+  bool collide(const ngl::Vec3 &_centre, float _radius, Contact &o_contact) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the same query testing every triangle, for checking collide()
+  //----------------------------------------------------------------------------------------------------------------------
+  bool collideAll(const ngl::Vec3 &_centre, float _radius, Contact &o_contact) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the point of triangle _a _b _c closest to _p, found from which of the seven Voronoi regions of the
+  /// triangle (three corners, three edges, the face) _p is in
+  //----------------------------------------------------------------------------------------------------------------------
+  static ngl::Vec3 closestPointOnTriangle(const ngl::Vec3 &_p, const ngl::Vec3 &_a, const ngl::Vec3 &_b, const ngl::Vec3 &_c);
+  size_t numTriangles() const { return m_indices.size() / 3; }
+  const std::vector<ngl::Vec3> &vertices() const { return m_vertices; }
+  const std::vector<uint32_t> &indices() const { return m_indices; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief per vertex normals for drawing, the sum of the face normals around each vertex weighted by face area
+  //----------------------------------------------------------------------------------------------------------------------
+  void vertexNormals(std::vector<ngl::Vec3> &o_normals) const;
+  const BVH4 &bvh() const { return m_bvh; }
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief does a point project onto the face of a triangle rather than past one of its edges
+  /// @param _ab _ac the triangle's edges from corner a, _ap the point relative to a
+  //----------------------------------------------------------------------------------------------------------------------
+  static bool insideFace(const ngl::Vec3 &_ab, const ngl::Vec3 &_ac, const ngl::Vec3 &_ap);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief test one triangle and keep the contact if it is deeper than io_contact
+  //----------------------------------------------------------------------------------------------------------------------
+  void testTriangle(uint32_t _tri, const ngl::Vec3 &_centre, float _radius, bool &io_found, Contact &io_contact) const;
+  std::vector<ngl::Vec3> m_vertices;
+  std::vector<uint32_t> m_indices;
+  BVH4 m_bvh;
+};
+
+#endif
@@ -4,6 +4,11 @@
 #include <ngl/Text.h>
 #include "WindowParams.h"
 #include "Sphere.h"
+#include "BVH4.h"
+#include "MeshCollider.h"
+#include "HalfSpaceSet.h"
+#include "SlotMap.h"
+#include <ngl/AbstractVAO.h>
 #include <QOpenGLWindow>
 #include <memory>
 //----------------------------------------------------------------------------------------------------------------------
@@ -65,9 +70,10 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     ngl::Vec3 m_modelPos;
     //----------------------------------------------------------------------------------------------------------------------
-    /// @brief a dynamic array to contain our spheres
+    /// @brief the spheres, packed together for the per tick loops and referred to from outside by handles that
+    /// stay good as other spheres are added and removed
     //----------------------------------------------------------------------------------------------------------------------
-    std::vector <Sphere> m_sphereArray;
+    SlotMap<Sphere> m_spheres;
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief the bounding box to contain the spheres
     //----------------------------------------------------------------------------------------------------------------------
@@ -89,6 +95,53 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     bool m_animate;
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief BVH over the spheres used as the broad phase of the sphere sphere test, refit every tick and then
+    /// improved a little at a time by rebuilding its worst subtrees
+    //----------------------------------------------------------------------------------------------------------------------
+    BVH4 m_bvh;
+    std::vector<AABB> m_sphereBounds;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief set when spheres are added or removed, the tree refers to spheres by their place in the dense array
+    /// which removing changes so it is built again rather than refit
+    //----------------------------------------------------------------------------------------------------------------------
+    bool m_treeDirty = true;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief microseconds a tick may spend optimising the tree, [ and ] halve and double it
+    //----------------------------------------------------------------------------------------------------------------------
+    double m_optimiseBudget = 500.0;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the sphere under the mouse, a dead handle for none, and whether the mouse ray passes through the
+    /// bounding box
+    //----------------------------------------------------------------------------------------------------------------------
+    SlotHandle m_pickedSphere;
+    bool m_pickedBox = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the last mouse position in window coordinates, picking is redone each tick as the spheres move under it
+    //----------------------------------------------------------------------------------------------------------------------
+    float m_pickX = 0.0f;
+    float m_pickY = 0.0f;
+    bool m_picking = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the wavy floor the spheres bounce off, off at start so the demo opens as the plain box, M turns it on
+    //----------------------------------------------------------------------------------------------------------------------
+    MeshCollider m_mesh;
+    std::unique_ptr<ngl::AbstractVAO> m_meshVAO;
+    bool m_checkMesh = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the walls the spheres bounce off, the six sides of m_bbox or with H a hopper that narrows to the floor
+    //----------------------------------------------------------------------------------------------------------------------
+    HalfSpaceSet m_container;
+    std::unique_ptr<ngl::AbstractVAO> m_containerVAO;
+    bool m_hopper = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the sphere positions and radii as separate arrays for HalfSpaceSet::collide() and the walls each reached
+    //----------------------------------------------------------------------------------------------------------------------
+    std::vector<float> m_sphereX;
+    std::vector<float> m_sphereY;
+    std::vector<float> m_sphereZ;
+    std::vector<float> m_sphereRadius;
+    std::vector<uint32_t> m_hitPlanes;
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief this method is called once per frame to update the sphere positions
     /// and do the collision detection
     //----------------------------------------------------------------------------------------------------------------------
@@ -151,10 +204,68 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void BBoxCollision();
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief build m_container from the sides of m_bbox, adding four sloping planes for the hopper
+    //----------------------------------------------------------------------------------------------------------------------
+    void setContainer(bool _hopper);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time the walls test on 10^6 spheres as a loop over six planes per sphere against HalfSpaceSet::collide()
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkContainer();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief bounce the spheres off m_mesh
+    //----------------------------------------------------------------------------------------------------------------------
+    void meshCollision();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief mirror a direction in a surface, the response used for the box walls and the mesh
+    /// @param _normal unit normal of the surface
+    //----------------------------------------------------------------------------------------------------------------------
+    static ngl::Vec3 reflect(const ngl::Vec3 &_dir, const ngl::Vec3 &_normal);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief a square grid of _divisions by _divisions quads across the floor of the box, two triangles each, with
+    /// the height rippled by a sin and cos
+    //----------------------------------------------------------------------------------------------------------------------
+    static void makeSurface(int _divisions, std::vector<ngl::Vec3> &o_vertices, std::vector<uint32_t> &o_indices);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief upload m_mesh to m_meshVAO
+    //----------------------------------------------------------------------------------------------------------------------
+    void createMeshVAO();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time 10^4 spheres against a surface of about 10^6 triangles and check a sample against every triangle
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkMesh();
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief check the sphere collisions
     //----------------------------------------------------------------------------------------------------------------------
     void checkSphereCollisions();
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief refit the sphere tree to where the spheres are now, or build it if spheres were added or removed
+    //----------------------------------------------------------------------------------------------------------------------
+    void updateTree();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the ray under a point of the window in the model space of the spheres, it runs from the near clip
+    /// plane at t=0 to the far clip plane at t=1
+    /// @param _x _y window coordinates with 0,0 at the top left
+    //----------------------------------------------------------------------------------------------------------------------
+    Ray pickRay(float _x, float _y) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the closest sphere on a ray found through the BVH, only the part of the ray inside m_bbox is searched
+    /// @param o_hitBox set if the ray passes through m_bbox
+    /// @returns the handle of the sphere, a default handle for no hit
+    //----------------------------------------------------------------------------------------------------------------------
+    SlotHandle pick(const Ray &_ray, bool &o_hitBox) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief m_bbox as an AABB for the ray tests
+    //----------------------------------------------------------------------------------------------------------------------
+    AABB bboxBounds() const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief pick again at the last mouse position
+    //----------------------------------------------------------------------------------------------------------------------
+    void updatePick();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time picking at random points of the window against testing every sphere
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkPicking();
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief reset the sphere array
     //----------------------------------------------------------------------------------------------------------------------
     void resetSpheres();
@@ -163,7 +274,7 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void addSphere();
     //----------------------------------------------------------------------------------------------------------------------
-    /// @brief remove the last sphere added
+    /// @brief remove the sphere under the mouse, or the last in the array if the mouse isn't over one
     //----------------------------------------------------------------------------------------------------------------------
     void removeSphere();
 
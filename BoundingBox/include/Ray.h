@@ -0,0 +1,41 @@
+#ifndef RAY_H_
+#define RAY_H_
+
+#include <ngl/Vec3.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file Ray.h
+/// @brief a simple ray made of an origin and a direction, the direction does not need to be normalized
+/// and any t values returned by the queries are in units of the direction length
+//----------------------------------------------------------------------------------------------------------------------
+struct Ray
+{
+  Ray() = default;
+  Ray(const ngl::Vec3 &_origin, const ngl::Vec3 &_dir) : m_origin(_origin), m_dir(_dir) {}
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the point along the ray at parameter _t
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 at(float _t) const { return m_origin + m_dir * _t; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the start of the ray
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_origin;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the direction of the ray
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_dir;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief a line segment for occlusion queries, as a ray it runs from m_start at t=0 to m_end at t=1
+//----------------------------------------------------------------------------------------------------------------------
+struct Segment
+{
+  Segment() = default;
+  Segment(const ngl::Vec3 &_start, const ngl::Vec3 &_end) : m_start(_start), m_end(_end) {}
+  Ray ray() const { return Ray(m_start, m_end - m_start); }
+  ngl::Vec3 m_start;
+  ngl::Vec3 m_end;
+};
+
+#endif
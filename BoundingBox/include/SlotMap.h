@@ -0,0 +1,161 @@
+#ifndef SLOTMAP_H_
+#define SLOTMAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SlotMap.h
+/// @brief values kept packed together in a dense array for iterating, with a table of slots giving each value's
+/// place in it. A handle names a slot rather than a place so it stays good as other values come and go. Removing
+/// moves the last value into the hole (swap and pop) and updates its slot, so add and remove are both O(1) and the
+/// dense array never has gaps. A slot's generation is odd while it holds a value and even while it is free.
+//----------------------------------------------------------------------------------------------------------------------
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief a reference to a value in a SlotMap, the slot it was put in and the generation of that slot at the time.
+/// Removing the value bumps the generation so the handle no longer matches, even once the slot is reused. A default
+/// handle refers to nothing.
+//----------------------------------------------------------------------------------------------------------------------
+struct SlotHandle
+{
+  uint32_t m_index = 0;
+  uint32_t m_generation = 0;
+  bool operator==(const SlotHandle &_h) const { return m_index == _h.m_index && m_generation == _h.m_generation; }
+  bool operator!=(const SlotHandle &_h) const { return !(*this == _h); }
+};
+
+template <typename T>
+class SlotMap
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add a value, reusing the slot freed last if there is one
+  //----------------------------------------------------------------------------------------------------------------------
+  SlotHandle insert(T _value);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief remove the value a handle refers to
+  /// @returns false if the handle was already dead
+  //----------------------------------------------------------------------------------------------------------------------
+  bool remove(SlotHandle _handle);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief remove every value, every handle given out so far goes dead
+  //----------------------------------------------------------------------------------------------------------------------
+  void clear();
+  void reserve(size_t _count);
+  bool contains(SlotHandle _handle) const
+  {
+    return _handle.m_index < m_slots.size() && m_slots[_handle.m_index].m_generation == _handle.m_generation &&
+           (_handle.m_generation & 1u);
+  }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the value a handle refers to or nullptr if it has been removed
+  //----------------------------------------------------------------------------------------------------------------------
+  T *get(SlotHandle _handle) { return contains(_handle) ? &m_values[m_slots[_handle.m_index].m_dense] : nullptr; }
+  const T *get(SlotHandle _handle) const { return contains(_handle) ? &m_values[m_slots[_handle.m_index].m_dense] : nullptr; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the dense array, the position of a value in it changes when a value before the end is removed
+  //----------------------------------------------------------------------------------------------------------------------
+  T &operator[](size_t _dense) { return m_values[_dense]; }
+  const T &operator[](size_t _dense) const { return m_values[_dense]; }
+  typename std::vector<T>::iterator begin() { return m_values.begin(); }
+  typename std::vector<T>::iterator end() { return m_values.end(); }
+  typename std::vector<T>::const_iterator begin() const { return m_values.begin(); }
+  typename std::vector<T>::const_iterator end() const { return m_values.end(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the handle of the value at a place in the dense array
+  //----------------------------------------------------------------------------------------------------------------------
+  SlotHandle handle(size_t _dense) const
+  {
+    uint32_t slot = m_denseToSlot[_dense];
+    return SlotHandle{slot, m_slots[slot].m_generation};
+  }
+  size_t size() const { return m_values.size(); }
+  bool empty() const { return m_values.empty(); }
+
+private:
+  struct Slot
+  {
+    uint32_t m_dense = 0;
+    uint32_t m_generation = 0;
+  };
+  std::vector<T> m_values;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the slot of each value in m_values, so removing can find the slot of the value it moves
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_denseToSlot;
+  std::vector<Slot> m_slots;
+  std::vector<uint32_t> m_free;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+SlotHandle SlotMap<T>::insert(T _value)
+{
+  uint32_t slot;
+  if (m_free.empty())
+  {
+    slot = static_cast<uint32_t>(m_slots.size());
+    m_slots.push_back(Slot());
+  }
+  else
+  {
+    slot = m_free.back();
+    m_free.pop_back();
+  }
+  Slot &s = m_slots[slot];
+  ++s.m_generation;
+  s.m_dense = static_cast<uint32_t>(m_values.size());
+  m_values.push_back(std::move(_value));
+  m_denseToSlot.push_back(slot);
+  return SlotHandle{slot, s.m_generation};
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+bool SlotMap<T>::remove(SlotHandle _handle)
+{
+  if (!contains(_handle))
+  {
+    return false;
+  }
+  Slot &s = m_slots[_handle.m_index];
+  const uint32_t last = static_cast<uint32_t>(m_values.size() - 1);
+  if (s.m_dense != last)
+  {
+    m_values[s.m_dense] = std::move(m_values[last]);
+    m_denseToSlot[s.m_dense] = m_denseToSlot[last];
+    m_slots[m_denseToSlot[last]].m_dense = s.m_dense;
+  }
+  m_values.pop_back();
+  m_denseToSlot.pop_back();
+  ++s.m_generation;
+  m_free.push_back(_handle.m_index);
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+void SlotMap<T>::clear()
+{
+  for (uint32_t slot : m_denseToSlot)
+  {
+    ++m_slots[slot].m_generation;
+    m_free.push_back(slot);
+  }
+  m_values.clear();
+  m_denseToSlot.clear();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+void SlotMap<T>::reserve(size_t _count)
+{
+  m_values.reserve(_count);
+  m_denseToSlot.reserve(_count);
+  m_slots.reserve(_count);
+  m_free.reserve(_count);
+}
+
+#endif
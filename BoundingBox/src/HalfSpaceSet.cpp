@@ -0,0 +1,127 @@
+#include "HalfSpaceSet.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HALFSPACESET_USE_SSE 1
+#endif
+
+bool HalfSpaceSet::addPlane(const ngl::Vec3 &_normal, float _offset)
+{
+  if (numPlanes() == s_maxPlanes)
+  {
+    return false;
+  }
+  float length = _normal.length();
+  m_normalX.push_back(_normal.m_x / length);
+  m_normalY.push_back(_normal.m_y / length);
+  m_normalZ.push_back(_normal.m_z / length);
+  m_offset.push_back(_offset / length);
+  return true;
+}
+
+void HalfSpaceSet::clear()
+{
+  m_normalX.clear();
+  m_normalY.clear();
+  m_normalZ.clear();
+  m_offset.clear();
+}
+
+void HalfSpaceSet::collide(const float *_x, const float *_y, const float *_z, const float *_radius, size_t _count, uint32_t *o_hitPlanes) const
+{
+  const size_t numPlanes = m_offset.size();
+  size_t i = 0;
+#ifdef HALFSPACESET_USE_SSE
+  for (; i + 4 <= _count; i += 4)
+  {
+    const __m128 x = _mm_loadu_ps(&_x[i]);
+    const __m128 y = _mm_loadu_ps(&_y[i]);
+    const __m128 z = _mm_loadu_ps(&_z[i]);
+    const __m128 radius = _mm_loadu_ps(&_radius[i]);
+    __m128i hits = _mm_setzero_si128();
+    for (size_t k = 0; k < numPlanes; ++k)
+    {
+      // n.p + r >= d when the sphere reaches the plane, the compare is all ones in those lanes so and'ing it with
+      // the plane's bit sets the bit for just those spheres
+      __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m_normalX[k]), x), _mm_mul_ps(_mm_set1_ps(m_normalY[k]), y));
+      distance = _mm_add_ps(_mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(m_normalZ[k]), z)), radius);
+      const __m128i reached = _mm_castps_si128(_mm_cmpge_ps(distance, _mm_set1_ps(m_offset[k])));
+      hits = _mm_or_si128(hits, _mm_and_si128(reached, _mm_set1_epi32(static_cast<int>(1u << k))));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&o_hitPlanes[i]), hits);
+  }
+#endif
+  for (; i < _count; ++i)
+  {
+    uint32_t hits = 0;
+    for (size_t k = 0; k < numPlanes; ++k)
+    {
+      float distance = m_normalX[k] * _x[i] + m_normalY[k] * _y[i] + m_normalZ[k] * _z[i] + _radius[i];
+      if (distance >= m_offset[k])
+      {
+        hits |= 1u << k;
+      }
+    }
+    o_hitPlanes[i] = hits;
+  }
+}
+
+void HalfSpaceSet::edges(std::vector<ngl::Vec3> &o_lines) const
+{
+  o_lines.clear();
+  const size_t numPlanes = m_offset.size();
+  for (size_t i = 0; i < numPlanes; ++i)
+  {
+    for (size_t j = i + 1; j < numPlanes; ++j)
+    {
+      // the line where planes i and j meet, skipped if they are parallel
+      ngl::Vec3 ni = normal(i);
+      ngl::Vec3 nj = normal(j);
+      ngl::Vec3 dir = ni.cross(nj);
+      float length2 = dir.lengthSquared();
+      if (length2 < 1e-8f)
+      {
+        continue;
+      }
+      ngl::Vec3 point = (nj.cross(dir) * m_offset[i] + dir.cross(ni) * m_offset[j]) / length2;
+      // clip it by every other plane, what is left is the edge
+      float tMin = -std::numeric_limits<float>::max();
+      float tMax = std::numeric_limits<float>::max();
+      for (size_t k = 0; k < numPlanes && tMin < tMax; ++k)
+      {
+        if (k == i || k == j)
+        {
+          continue;
+        }
+        ngl::Vec3 nk = normal(k);
+        float along = nk.dot(dir);
+        float gap = m_offset[k] - nk.dot(point);
+        if (std::abs(along) < 1e-8f)
+        {
+          // parallel to plane k, wholly in or out of it
+          if (gap < 0.0f)
+          {
+            tMax = tMin;
+          }
+        }
+        else if (along > 0.0f)
+        {
+          tMax = std::min(tMax, gap / along);
+        }
+        else
+        {
+          tMin = std::max(tMin, gap / along);
+        }
+      }
+      const float unbounded = std::numeric_limits<float>::max();
+      if (tMax - tMin > 1e-5f && tMin > -unbounded && tMax < unbounded)
+      {
+        o_lines.push_back(point + dir * tMin);
+        o_lines.push_back(point + dir * tMax);
+      }
+    }
+  }
+}
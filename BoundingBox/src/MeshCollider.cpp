@@ -0,0 +1,179 @@
+#include "MeshCollider.h"
+#include <cmath>
+
+void MeshCollider::build(std::vector<ngl::Vec3> _vertices, std::vector<uint32_t> _indices)
+{
+  m_vertices = std::move(_vertices);
+  m_indices = std::move(_indices);
+  std::vector<AABB> bounds(numTriangles());
+  for (size_t i = 0; i < bounds.size(); ++i)
+  {
+    for (int c = 0; c < 3; ++c)
+    {
+      bounds[i].extend(m_vertices[m_indices[i * 3 + c]]);
+    }
+  }
+  m_bvh.build(bounds);
+}
+
+ngl::Vec3 MeshCollider::closestPointOnTriangle(const ngl::Vec3 &_p, const ngl::Vec3 &_a, const ngl::Vec3 &_b, const ngl::Vec3 &_c)
+{
+  const ngl::Vec3 ab = _b - _a;
+  const ngl::Vec3 ac = _c - _a;
+  const ngl::Vec3 ap = _p - _a;
+  // corner a
+  const float d1 = ab.dot(ap);
+  const float d2 = ac.dot(ap);
+  if (d1 <= 0.0f && d2 <= 0.0f)
+  {
+    return _a;
+  }
+  // corner b
+  const ngl::Vec3 bp = _p - _b;
+  const float d3 = ab.dot(bp);
+  const float d4 = ac.dot(bp);
+  if (d3 >= 0.0f && d4 <= d3)
+  {
+    return _b;
+  }
+  // edge ab
+  const float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+  {
+    return _a + ab * (d1 / (d1 - d3));
+  }
+  // corner c
+  const ngl::Vec3 cp = _p - _c;
+  const float d5 = ab.dot(cp);
+  const float d6 = ac.dot(cp);
+  if (d6 >= 0.0f && d5 <= d6)
+  {
+    return _c;
+  }
+  // edge ac
+  const float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+  {
+    return _a + ac * (d2 / (d2 - d6));
+  }
+  // edge bc
+  const float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+  {
+    return _b + (_c - _b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  // inside the face, barycentric coordinates from the three region values
+  const float denom = 1.0f / (va + vb + vc);
+  return _a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+bool MeshCollider::insideFace(const ngl::Vec3 &_ab, const ngl::Vec3 &_ac, const ngl::Vec3 &_ap)
+{
+  // barycentric coordinates of the point projected onto the triangle's plane
+  const float d00 = _ab.dot(_ab);
+  const float d01 = _ab.dot(_ac);
+  const float d11 = _ac.dot(_ac);
+  const float d20 = _ap.dot(_ab);
+  const float d21 = _ap.dot(_ac);
+  const float denom = d00 * d11 - d01 * d01;
+  const float v = (d11 * d20 - d01 * d21) / denom;
+  const float w = (d00 * d21 - d01 * d20) / denom;
+  return v >= 0.0f && w >= 0.0f && v + w <= 1.0f;
+}
+
+void MeshCollider::testTriangle(uint32_t _tri, const ngl::Vec3 &_centre, float _radius, bool &io_found, Contact &io_contact) const
+{
+  const uint32_t *index = &m_indices[static_cast<size_t>(_tri) * 3];
+  const ngl::Vec3 &a = m_vertices[index[0]];
+  const ngl::Vec3 &b = m_vertices[index[1]];
+  const ngl::Vec3 &c = m_vertices[index[2]];
+  ngl::Vec3 point = closestPointOnTriangle(_centre, a, b, c);
+  ngl::Vec3 toCentre = _centre - point;
+  float distance2 = toCentre.lengthSquared();
+  if (distance2 >= _radius * _radius)
+  {
+    return;
+  }
+  const ngl::Vec3 ab = b - a;
+  const ngl::Vec3 ac = c - a;
+  const ngl::Vec3 ap = _centre - a;
+  ngl::Vec3 faceNormal = ab.cross(ac);
+  float depth;
+  if (faceNormal.dot(ap) < 0.0f && insideFace(ab, ac, ap))
+  {
+    // a centre that has crossed the face in one tick is behind it, the direction from the closest point would
+    // push it further through so it goes back out along the face normal by the signed distance
+    faceNormal.normalize();
+    toCentre = faceNormal;
+    depth = _radius - faceNormal.dot(ap);
+  }
+  else
+  {
+    float distance = std::sqrt(distance2);
+    depth = _radius - distance;
+    if (distance > 0.0f)
+    {
+      toCentre /= distance;
+    }
+    else
+    {
+      // the centre is on the triangle so push out along the face normal
+      faceNormal.normalize();
+      toCentre = faceNormal;
+    }
+  }
+  if (io_found && depth <= io_contact.m_depth)
+  {
+    return;
+  }
+  io_found = true;
+  io_contact.m_point = point;
+  io_contact.m_normal = toCentre;
+  io_contact.m_depth = depth;
+  io_contact.m_triangle = _tri;
+}
+
+bool MeshCollider::collide(const ngl::Vec3 &_centre, float _radius, Contact &o_contact) const
+{
+  bool found = false;
+  m_bvh.overlap(_centre, _radius, [&](uint32_t _first, uint32_t _count)
+                {
+                  for (uint32_t i = _first; i < _first + _count; ++i)
+                  {
+                    testTriangle(m_bvh.primIndex(i), _centre, _radius, found, o_contact);
+                  }
+                  return false; });
+  return found;
+}
+
+bool MeshCollider::collideAll(const ngl::Vec3 &_centre, float _radius, Contact &o_contact) const
+{
+  bool found = false;
+  for (uint32_t i = 0; i < numTriangles(); ++i)
+  {
+    testTriangle(i, _centre, _radius, found, o_contact);
+  }
+  return found;
+}
+
+void MeshCollider::vertexNormals(std::vector<ngl::Vec3> &o_normals) const
+{
+  o_normals.assign(m_vertices.size(), ngl::Vec3(0.0f, 0.0f, 0.0f));
+  for (size_t i = 0; i < m_indices.size(); i += 3)
+  {
+    // the unnormalized cross product is twice the area so larger faces count for more
+    const ngl::Vec3 &a = m_vertices[m_indices[i]];
+    ngl::Vec3 n = (m_vertices[m_indices[i + 1]] - a).cross(m_vertices[m_indices[i + 2]] - a);
+    for (int c = 0; c < 3; ++c)
+    {
+      o_normals[m_indices[i + c]] += n;
+    }
+  }
+  for (auto &n : o_normals)
+  {
+    if (n.lengthSquared() > 0.0f)
+    {
+      n.normalize();
+    }
+  }
+}
@@ -7,12 +7,23 @@
 #include <ngl/ShaderLib.h>
 #include <ngl/NGLInit.h>
 #include <ngl/VAOPrimitives.h>
+#include <ngl/VAOFactory.h>
+#include <ngl/SimpleVAO.h>
+#include "MultiBufferIndexVAO.h"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 //----------------------------------------------------------------------------------------------------------------------
 /// @brief extents of the bbox
 //----------------------------------------------------------------------------------------------------------------------
 const static int s_extents = 20;
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the wavy floor, its mean height, how far it rises and falls and how many quads along each side
+//----------------------------------------------------------------------------------------------------------------------
+const static float s_surfaceHeight = -30.0f;
+const static float s_surfaceAmplitude = 4.0f;
+const static int s_surfaceDivisions = 64;
 
 NGLScene::NGLScene(int _numSpheres)
 {
@@ -22,16 +33,23 @@ NGLScene::NGLScene(int _numSpheres)
   // create vectors for the position and direction
   m_numSpheres = _numSpheres;
   resetSpheres();
+  std::vector<ngl::Vec3> vertices;
+  std::vector<uint32_t> indices;
+  makeSurface(s_surfaceDivisions, vertices, indices);
+  m_mesh.build(std::move(vertices), std::move(indices));
 }
 
 void NGLScene::resetSpheres()
 {
-  m_sphereArray.resize(m_numSpheres);
-
-  std::generate(std::begin(m_sphereArray), std::end(m_sphereArray), [this]()
-                { return Sphere(ngl::Random::getRandomPoint(s_extents, s_extents, s_extents),
-                                ngl::Random::getRandomVec3(),
-                                ngl::Random::randomPositiveNumber(2) + 0.5f); });
+  m_spheres.clear();
+  m_spheres.reserve(m_numSpheres);
+  for (int i = 0; i < m_numSpheres; ++i)
+  {
+    m_spheres.insert(Sphere(ngl::Random::getRandomPoint(s_extents, s_extents, s_extents),
+                            ngl::Random::getRandomVec3(),
+                            ngl::Random::randomPositiveNumber(2) + 0.5f));
+  }
+  m_treeDirty = true;
 }
 NGLScene::~NGLScene()
 {
@@ -83,9 +101,57 @@ void NGLScene::initializeGL()
   // create our Bounding Box, needs to be done once we have a gl context as we create VAO for drawing
   m_bbox = std::make_unique<ngl::BBox>(ngl::Vec3(0.0f, 0.0f, 0.0f), 80.0f, 80.0f, 80.0f);
   m_bbox->setDrawMode(GL_LINE);
+  setContainer(m_hopper);
+  ngl::VAOFactory::registerVAOCreator("multiBufferIndexVAO", MultiBufferIndexVAO::create);
+  createMeshVAO();
   m_sphereUpdateTimer = startTimer(40);
 }
 
+void NGLScene::makeSurface(int _divisions, std::vector<ngl::Vec3> &o_vertices, std::vector<uint32_t> &o_indices)
+{
+  // the box is 4 * s_extents across
+  const float size = 4.0f * s_extents;
+  const float step = size / _divisions;
+  const uint32_t rowLength = static_cast<uint32_t>(_divisions) + 1;
+  o_vertices.clear();
+  o_vertices.reserve(rowLength * rowLength);
+  for (int z = 0; z <= _divisions; ++z)
+  {
+    for (int x = 0; x <= _divisions; ++x)
+    {
+      float px = -0.5f * size + x * step;
+      float pz = -0.5f * size + z * step;
+      o_vertices.push_back(ngl::Vec3(px, s_surfaceHeight + s_surfaceAmplitude * std::sin(px * 0.15f) * std::cos(pz * 0.15f), pz));
+    }
+  }
+  o_indices.clear();
+  o_indices.reserve(static_cast<size_t>(_divisions) * _divisions * 6);
+  for (uint32_t z = 0; z < rowLength - 1; ++z)
+  {
+    for (uint32_t x = 0; x < rowLength - 1; ++x)
+    {
+      // wound so the faces point up
+      uint32_t i = z * rowLength + x;
+      o_indices.insert(o_indices.end(), {i, i + rowLength, i + 1, i + 1, i + rowLength, i + rowLength + 1});
+    }
+  }
+}
+
+void NGLScene::createMeshVAO()
+{
+  std::vector<ngl::Vec3> normals;
+  m_mesh.vertexNormals(normals);
+  m_meshVAO = ngl::VAOFactory::createVAO("multiBufferIndexVAO", GL_TRIANGLES);
+  m_meshVAO->bind();
+  m_meshVAO->setData(MultiBufferIndexVAO::VertexData(m_mesh.vertices().size() * sizeof(ngl::Vec3), m_mesh.vertices()[0].m_x));
+  m_meshVAO->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(ngl::Vec3), 0);
+  m_meshVAO->setData(MultiBufferIndexVAO::VertexData(normals.size() * sizeof(ngl::Vec3), normals[0].m_x));
+  m_meshVAO->setVertexAttributePointer(1, 3, GL_FLOAT, sizeof(ngl::Vec3), 0);
+  dynamic_cast<MultiBufferIndexVAO *>(m_meshVAO.get())->setIndices(static_cast<unsigned int>(m_mesh.indices().size()), m_mesh.indices().data(), GL_UNSIGNED_INT);
+  m_meshVAO->setNumIndices(m_mesh.indices().size());
+  m_meshVAO->unbind();
+}
+
 void NGLScene::loadMatricesToShader()
 {
   ngl::ShaderLib::use("nglDiffuseShader");
@@ -126,24 +192,214 @@ void NGLScene::paintGL()
 
   ngl::ShaderLib::use("nglColourShader");
   loadMatricesToColourShader();
-  m_bbox->draw();
+  // the box is drawn red when the mouse is over it but not over a sphere
+  bool boxPicked = m_pickedBox && !m_spheres.contains(m_pickedSphere);
+  if (boxPicked)
+  {
+    ngl::ShaderLib::setUniform("Colour", 1.0f, 0.0f, 0.0f, 1.0f);
+  }
+  if (m_hopper)
+  {
+    m_containerVAO->bind();
+    m_containerVAO->draw();
+    m_containerVAO->unbind();
+  }
+  else
+  {
+    m_bbox->draw();
+  }
+  if (boxPicked)
+  {
+    ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 1.0f, 1.0f);
+  }
 
   ngl::ShaderLib::use("nglDiffuseShader");
+  if (m_checkMesh)
+  {
+    loadMatricesToShader();
+    ngl::ShaderLib::setUniform("Colour", 0.3f, 0.6f, 0.9f, 1.0f);
+    m_meshVAO->bind();
+    m_meshVAO->draw();
+    m_meshVAO->unbind();
+    ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 0.0f, 1.0f);
+  }
 
-  for (Sphere s : m_sphereArray)
+  for (size_t i = 0; i < m_spheres.size(); ++i)
   {
-    s.draw("nglDiffuseShader", m_mouseGlobalTX, m_view, m_project);
+    // the closest sphere under the mouse is drawn red
+    bool picked = m_spheres.handle(i) == m_pickedSphere;
+    if (picked)
+    {
+      ngl::ShaderLib::setUniform("Colour", 1.0f, 0.0f, 0.0f, 1.0f);
+    }
+    m_spheres[i].draw("nglDiffuseShader", m_mouseGlobalTX, m_view, m_project);
+    if (picked)
+    {
+      ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 0.0f, 1.0f);
+    }
   }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
 void NGLScene::updateScene()
 {
-  for (Sphere &s : m_sphereArray)
+  for (Sphere &s : m_spheres)
   {
     s.move();
   }
+  updateTree();
   checkCollisions();
+  // the spheres have moved under the mouse
+  updatePick();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::updateTree()
+{
+  m_sphereBounds.resize(m_spheres.size());
+  for (size_t i = 0; i < m_spheres.size(); ++i)
+  {
+    ngl::Vec3 r(m_spheres[i].getRadius(), m_spheres[i].getRadius(), m_spheres[i].getRadius());
+    m_sphereBounds[i] = AABB();
+    m_sphereBounds[i].extend(m_spheres[i].getPos() - r);
+    m_sphereBounds[i].extend(m_spheres[i].getPos() + r);
+  }
+  if (m_treeDirty)
+  {
+    m_bvh.build(m_sphereBounds);
+    m_treeDirty = false;
+    return;
+  }
+  // the spheres bounce around the whole box so a refit tree slowly gets worse, the optimiser spends a fixed
+  // amount of time each tick rebuilding the worst parts rather than rebuilding everything now and then
+  m_bvh.refit(m_sphereBounds, 1);
+  m_bvh.optimise(m_sphereBounds, m_optimiseBudget);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+AABB NGLScene::bboxBounds() const
+{
+  AABB box;
+  box.m_min.set(m_bbox->minX(), m_bbox->minY(), m_bbox->minZ());
+  box.m_max.set(m_bbox->maxX(), m_bbox->maxY(), m_bbox->maxZ());
+  return box;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+Ray NGLScene::pickRay(float _x, float _y) const
+{
+  // window to normalised device coordinates, y is flipped as window rows go down the screen
+  float ndcX = _x / std::max(1, width()) * 2.0f - 1.0f;
+  float ndcY = 1.0f - _y / std::max(1, height()) * 2.0f;
+  // back through the projection, the camera and the mouse transform into the space the spheres and box are in
+  ngl::Mat4 inverse = m_project * m_view * m_mouseGlobalTX;
+  inverse = inverse.inverse();
+  auto unproject = [&inverse](float _ndcX, float _ndcY, float _ndcZ)
+  {
+    ngl::Vec4 p = inverse * ngl::Vec4(_ndcX, _ndcY, _ndcZ, 1.0f);
+    return ngl::Vec3(p.m_x / p.m_w, p.m_y / p.m_w, p.m_z / p.m_w);
+  };
+  ngl::Vec3 nearPoint = unproject(ndcX, ndcY, -1.0f);
+  ngl::Vec3 farPoint = unproject(ndcX, ndcY, 1.0f);
+  return Ray(nearPoint, farPoint - nearPoint);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+SlotHandle NGLScene::pick(const Ray &_ray, bool &o_hitBox) const
+{
+  float tNear;
+  float tFar;
+  o_hitBox = bboxBounds().intersect(_ray, 1.0f, tNear, tFar);
+  if (!o_hitBox)
+  {
+    return SlotHandle();
+  }
+  SlotHandle closest;
+  m_bvh.traverse(_ray, tFar, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                 {
+                   for (uint32_t i = _first; i < _first + _count; ++i)
+                   {
+                     float t0;
+                     float t1;
+                     const Sphere &s = m_spheres[m_bvh.primIndex(i)];
+                     // a sphere poking through a wall is hit where the ray enters the box
+                     if (s.intersect(_ray, t0, t1) && t1 >= tNear && std::max(t0, tNear) < io_tMax)
+                     {
+                       io_tMax = std::max(t0, tNear);
+                       closest = m_spheres.handle(m_bvh.primIndex(i));
+                     }
+                   }
+                   return false; });
+  return closest;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::updatePick()
+{
+  if (!m_picking || m_bbox == nullptr)
+  {
+    return;
+  }
+  if (m_treeDirty)
+  {
+    updateTree();
+  }
+  m_pickedSphere = pick(pickRay(m_pickX, m_pickY), m_pickedBox);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkPicking()
+{
+  constexpr int numPicks = 1000;
+  if (m_treeDirty)
+  {
+    updateTree();
+  }
+  std::vector<Ray> rays(numPicks);
+  for (auto &r : rays)
+  {
+    r = pickRay(ngl::Random::randomPositiveNumber(width()), ngl::Random::randomPositiveNumber(height()));
+  }
+  std::vector<SlotHandle> picked(numPicks);
+  double slowest = 0.0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numPicks; ++i)
+  {
+    auto pickStart = std::chrono::high_resolution_clock::now();
+    bool hitBox;
+    picked[i] = pick(rays[i], hitBox);
+    slowest = std::max(slowest, std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - pickStart).count());
+  }
+  double bvhTime = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+  // the same query testing every sphere
+  const AABB box = bboxBounds();
+  size_t differ = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numPicks; ++i)
+  {
+    float tNear;
+    float tFar;
+    SlotHandle closest;
+    if (box.intersect(rays[i], 1.0f, tNear, tFar))
+    {
+      for (size_t s = 0; s < m_spheres.size(); ++s)
+      {
+        float t0;
+        float t1;
+        if (m_spheres[s].intersect(rays[i], t0, t1) && t1 >= tNear && std::max(t0, tNear) < tFar)
+        {
+          tFar = std::max(t0, tNear);
+          closest = m_spheres.handle(s);
+        }
+      }
+    }
+    differ += closest != picked[i];
+  }
+  double bruteTime = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "Picking " << numPicks << " rays against " << m_spheres.size() << " spheres\n"
+            << "BVH4 mean " << bvhTime / numPicks << " us slowest " << slowest << " us\n"
+            << "brute force mean " << bruteTime / numPicks << " us, " << differ << " picks differ\n";
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -178,6 +434,15 @@ void NGLScene::mouseMoveEvent(QMouseEvent *_event)
     m_modelPos.m_y -= INCREMENT * diffY;
     update();
   }
+  // with no buttons down highlight whatever is under the mouse
+  else if (_event->buttons() == Qt::NoButton)
+  {
+    m_pickX = position.x();
+    m_pickY = position.y();
+    m_picking = true;
+    updatePick();
+    update();
+  }
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -271,6 +536,30 @@ void NGLScene::keyPressEvent(QKeyEvent *_event)
   case Qt::Key_Plus:
     addSphere();
     break;
+  case Qt::Key_P:
+    benchmarkPicking();
+    break;
+  case Qt::Key_M:
+    m_checkMesh ^= true;
+    break;
+  case Qt::Key_B:
+    benchmarkMesh();
+    break;
+  case Qt::Key_H:
+    m_hopper ^= true;
+    setContainer(m_hopper);
+    break;
+  case Qt::Key_W:
+    benchmarkContainer();
+    break;
+  case Qt::Key_BracketLeft:
+    m_optimiseBudget *= 0.5;
+    std::cout << "BVH optimise budget " << m_optimiseBudget << " us\n";
+    break;
+  case Qt::Key_BracketRight:
+    m_optimiseBudget = std::max(m_optimiseBudget * 2.0, 1.0);
+    std::cout << "BVH optimise budget " << m_optimiseBudget << " us\n";
+    break;
 
   default:
     break;
@@ -318,76 +607,275 @@ bool NGLScene::sphereSphereCollision(ngl::Vec3 _pos1, GLfloat _radius1, ngl::Vec
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void NGLScene::BBoxCollision()
+void NGLScene::setContainer(bool _hopper)
 {
   // create an array of the extents of the bounding box
   float ext[6];
   ext[0] = ext[1] = (m_bbox->height() / 2.0f);
   ext[2] = ext[3] = (m_bbox->width() / 2.0f);
   ext[4] = ext[5] = (m_bbox->depth() / 2.0f);
-  // Dot product needs a Vector so we convert The Point Temp into a Vector so we can
-  // do a dot product on it
-  ngl::Vec3 p;
-  // D is the distance of the Agent from the Plane. If it is less than ext[i] then there is
-  // no collision
-  GLfloat D;
-  // Loop for each sphere in the vector list
-  for (Sphere &s : m_sphereArray)
-  {
-    p = s.getPos();
-    // Now we need to check the Sphere agains all 6 planes of the BBOx
-    // If a collision is found we change the dir of the Sphere then Break
-    for (int i = 0; i < 6; ++i)
+  m_container.clear();
+  // each side of the box is the plane a distance ext[i] out along its normal
+  for (int i = 0; i < 6; ++i)
+  {
+    m_container.addPlane(m_bbox->getNormalArray()[i], m_bbox->getNormalArray()[i].dot(m_bbox->center()) + ext[i]);
+  }
+  if (_hopper)
+  {
+    // four sides sloping in at 45 degrees from a quarter of the way up the walls to a floor half as wide
+    float halfWidth = m_bbox->width() / 2.0f;
+    float halfDepth = m_bbox->depth() / 2.0f;
+    float drop = m_bbox->height() / 2.0f;
+    m_container.addPlane(ngl::Vec3(1.0f, -1.0f, 0.0f), 0.5f * halfWidth + drop);
+    m_container.addPlane(ngl::Vec3(-1.0f, -1.0f, 0.0f), 0.5f * halfWidth + drop);
+    m_container.addPlane(ngl::Vec3(0.0f, -1.0f, 1.0f), 0.5f * halfDepth + drop);
+    m_container.addPlane(ngl::Vec3(0.0f, -1.0f, -1.0f), 0.5f * halfDepth + drop);
+  }
+  std::vector<ngl::Vec3> lines;
+  m_container.edges(lines);
+  m_containerVAO = ngl::VAOFactory::createVAO("simpleVAO", GL_LINES);
+  m_containerVAO->bind();
+  m_containerVAO->setData(ngl::SimpleVAO::VertexData(lines.size() * sizeof(ngl::Vec3), lines[0].m_x));
+  m_containerVAO->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(ngl::Vec3), 0);
+  m_containerVAO->setNumIndices(lines.size());
+  m_containerVAO->unbind();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::BBoxCollision()
+{
+  // the walls test four spheres at a time so it wants the positions and radii as separate arrays
+  const size_t numSpheres = m_spheres.size();
+  m_sphereX.resize(numSpheres);
+  m_sphereY.resize(numSpheres);
+  m_sphereZ.resize(numSpheres);
+  m_sphereRadius.resize(numSpheres);
+  m_hitPlanes.resize(numSpheres);
+  for (size_t i = 0; i < numSpheres; ++i)
+  {
+    ngl::Vec3 p = m_spheres[i].getPos();
+    m_sphereX[i] = p.m_x;
+    m_sphereY[i] = p.m_y;
+    m_sphereZ[i] = p.m_z;
+    m_sphereRadius[i] = m_spheres[i].getRadius();
+  }
+  m_container.collide(m_sphereX.data(), m_sphereY.data(), m_sphereZ.data(), m_sphereRadius.data(), numSpheres, m_hitPlanes.data());
+  for (size_t i = 0; i < numSpheres; ++i)
+  {
+    if (m_hitPlanes[i] == 0)
+    {
+      continue;
+    }
+    Sphere &s = m_spheres[i];
+    // a sphere in a corner reaches more than one wall and bounces off each in turn, only off walls it is heading
+    // into so one left outside a wall (by switching to the hopper) comes back in rather than turning every tick
+    for (size_t k = 0; k < m_container.numPlanes(); ++k)
     {
-      // to calculate the distance we take the dotporduct of the Plane Normal
-      // with the new point P
-      D = m_bbox->getNormalArray()[i].dot(p);
-      // Now Add the Radius of the sphere to the offsett
-      D += s.getRadius();
-      // If this is greater or equal to the BBox extent /2 then there is a collision
-      // So we calculate the Spheres new direction
-      if (D >= ext[i])
+      if ((m_hitPlanes[i] & (1u << k)) && s.getDirection().dot(m_container.normal(k)) > 0.0f)
       {
         // We use the same calculation as in raytracing to determine the
         //  the new direction
-        GLfloat x = 2 * (s.getDirection().dot((m_bbox->getNormalArray()[i])));
-        ngl::Vec3 d = m_bbox->getNormalArray()[i] * x;
-        s.setDirection(s.getDirection() - d);
-        s.setHit();
-      } // end of hit test
-    }   // end of each face test
-  }     // end of for
+        s.setDirection(reflect(s.getDirection(), m_container.normal(k)));
+      }
+    }
+    s.setHit();
+  }
 }
 
-void NGLScene::checkSphereCollisions()
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkContainer()
 {
-  bool collide;
-
-  unsigned int size = m_sphereArray.size();
-
-  for (unsigned int ToCheck = 0; ToCheck < size; ++ToCheck)
+  constexpr size_t numSpheres = 1000000;
+  constexpr int numPasses = 10;
+  std::vector<Sphere> spheres(numSpheres);
+  for (auto &s : spheres)
+  {
+    s = Sphere(ngl::Random::getRandomPoint(2.0f * s_extents, 2.0f * s_extents, 2.0f * s_extents), ngl::Random::getRandomVec3(),
+               ngl::Random::randomPositiveNumber(2) + 0.5f);
+  }
+  // the walls test as BBoxCollision() had it, six planes one sphere at a time
+  float ext[6];
+  ext[0] = ext[1] = (m_bbox->height() / 2.0f);
+  ext[2] = ext[3] = (m_bbox->width() / 2.0f);
+  ext[4] = ext[5] = (m_bbox->depth() / 2.0f);
+  const ngl::Vec3 *normals = m_bbox->getNormalArray();
+  std::vector<uint32_t> loopHits(numSpheres);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < numPasses; ++pass)
   {
-    for (unsigned int Current = 0; Current < size; ++Current)
+    for (size_t i = 0; i < numSpheres; ++i)
     {
-      // don't check against self
-      if (ToCheck == Current)
-        continue;
-
-      else
+      ngl::Vec3 p = spheres[i].getPos();
+      uint32_t hits = 0;
+      for (int k = 0; k < 6; ++k)
       {
-        // cout <<"doing check"<<endl;
-        collide = sphereSphereCollision(m_sphereArray[Current].getPos(), m_sphereArray[Current].getRadius(),
-                                        m_sphereArray[ToCheck].getPos(), m_sphereArray[ToCheck].getRadius());
-        if (collide == true)
+        if (normals[k].dot(p) + spheres[i].getRadius() >= ext[k])
         {
-          m_sphereArray[Current].reverse();
-          m_sphereArray[Current].setHit();
+          hits |= 1u << k;
         }
       }
+      loopHits[i] = hits;
+    }
+  }
+  double loopTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / numPasses;
+
+  std::vector<float> x(numSpheres);
+  std::vector<float> y(numSpheres);
+  std::vector<float> z(numSpheres);
+  std::vector<float> radius(numSpheres);
+  start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < numPasses; ++pass)
+  {
+    for (size_t i = 0; i < numSpheres; ++i)
+    {
+      ngl::Vec3 p = spheres[i].getPos();
+      x[i] = p.m_x;
+      y[i] = p.m_y;
+      z[i] = p.m_z;
+      radius[i] = spheres[i].getRadius();
+    }
+  }
+  double gatherTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / numPasses;
+  std::vector<uint32_t> setHits(numSpheres);
+  auto timeSet = [&](const HalfSpaceSet &_set)
+  {
+    auto setStart = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < numPasses; ++pass)
+    {
+      _set.collide(x.data(), y.data(), z.data(), radius.data(), numSpheres, setHits.data());
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - setStart).count() / numPasses;
+  };
+  bool hopper = m_hopper;
+  setContainer(false);
+  double boxTime = timeSet(m_container);
+  size_t differ = 0;
+  for (size_t i = 0; i < numSpheres; ++i)
+  {
+    differ += loopHits[i] != setHits[i];
+  }
+  setContainer(true);
+  double hopperTime = timeSet(m_container);
+  size_t hopperPlanes = m_container.numPlanes();
+  setContainer(hopper);
+  std::cout << numSpheres << " spheres\n"
+            << "six planes per sphere " << loopTime << " ms\n"
+            << "HalfSpaceSet box " << boxTime << " ms (+" << gatherTime << " ms copying the spheres to arrays), "
+            << differ << " differ\n"
+            << "HalfSpaceSet hopper " << hopperPlanes << " planes " << hopperTime << " ms\n";
+}
+
+ngl::Vec3 NGLScene::reflect(const ngl::Vec3 &_dir, const ngl::Vec3 &_normal)
+{
+  return _dir - _normal * (2.0f * _dir.dot(_normal));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::meshCollision()
+{
+  MeshCollider::Contact contact;
+  for (Sphere &s : m_spheres)
+  {
+    if (m_mesh.collide(s.getPos(), s.getRadius(), contact))
+    {
+      // move the sphere back out of the surface, and only bounce it if it is heading in so a sphere still
+      // inside after the push isn't turned back round into the surface
+      s.set(s.getPos() + contact.m_normal * contact.m_depth, s.getDirection(), s.getRadius());
+      if (s.getDirection().dot(contact.m_normal) < 0.0f)
+      {
+        s.setDirection(reflect(s.getDirection(), contact.m_normal));
+      }
+      s.setHit();
     }
   }
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkMesh()
+{
+  constexpr int numSpheres = 10000;
+  constexpr int numPasses = 10;
+  constexpr int numChecked = 100;
+  // 708 divisions is 1002528 triangles
+  constexpr int divisions = 708;
+  std::vector<ngl::Vec3> vertices;
+  std::vector<uint32_t> indices;
+  makeSurface(divisions, vertices, indices);
+  MeshCollider mesh;
+  auto start = std::chrono::high_resolution_clock::now();
+  mesh.build(std::move(vertices), std::move(indices));
+  double buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+  // spheres scattered through the slab the surface ripples in so most of them are near it
+  std::vector<ngl::Vec3> centres(numSpheres);
+  std::vector<float> radii(numSpheres);
+  for (int i = 0; i < numSpheres; ++i)
+  {
+    ngl::Vec3 p = ngl::Random::getRandomPoint(2.0f * s_extents, s_surfaceAmplitude + 2.0f, 2.0f * s_extents);
+    centres[i] = ngl::Vec3(p.m_x, p.m_y + s_surfaceHeight, p.m_z);
+    radii[i] = ngl::Random::randomPositiveNumber(2) + 0.5f;
+  }
+  std::vector<MeshCollider::Contact> contacts(numSpheres);
+  std::vector<char> touching(numSpheres);
+  start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < numPasses; ++pass)
+  {
+    for (int i = 0; i < numSpheres; ++i)
+    {
+      touching[i] = mesh.collide(centres[i], radii[i], contacts[i]);
+    }
+  }
+  double collideTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / numPasses;
+  size_t numContacts = std::count(touching.begin(), touching.end(), 1);
+
+  // a sample against every triangle, the deepest contact can be on either of two triangles sharing the closest
+  // edge or corner so only whether there is a contact and how deep are compared
+  size_t differ = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numChecked; ++i)
+  {
+    MeshCollider::Contact contact;
+    bool found = mesh.collideAll(centres[i], radii[i], contact);
+    differ += found != static_cast<bool>(touching[i]) || (found && std::abs(contact.m_depth - contacts[i].m_depth) > 1e-4f);
+  }
+  double bruteTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << numSpheres << " spheres against " << mesh.numTriangles() << " triangles, BVH4 build " << buildTime << " ms\n"
+            << "collide " << collideTime << " ms a pass, " << numSpheres / collideTime * 1000.0 << " spheres/s, "
+            << numContacts << " contacts\n"
+            << "every triangle " << bruteTime / numChecked << " ms a sphere, " << differ << " of " << numChecked << " differ\n";
+}
+
+void NGLScene::checkSphereCollisions()
+{
+  bool collide;
+
+  unsigned int size = m_spheres.size();
+
+  for (unsigned int ToCheck = 0; ToCheck < size; ++ToCheck)
+  {
+    // only the spheres whose boxes overlap this one can collide with it
+    m_bvh.overlap(m_sphereBounds[ToCheck], [&](uint32_t _first, uint32_t _count)
+                  {
+                    for (uint32_t i = _first; i < _first + _count; ++i)
+                    {
+                      unsigned int Current = m_bvh.primIndex(i);
+                      // don't check against self
+                      if (ToCheck == Current)
+                      {
+                        continue;
+                      }
+                      collide = sphereSphereCollision(m_spheres[Current].getPos(), m_spheres[Current].getRadius(),
+                                                      m_spheres[ToCheck].getPos(), m_spheres[ToCheck].getRadius());
+                      if (collide == true)
+                      {
+                        m_spheres[Current].reverse();
+                        m_spheres[Current].setHit();
+                      }
+                    }
+                    return false; });
+  }
+}
+
 void NGLScene::checkCollisions()
 {
 
@@ -395,26 +883,32 @@ void NGLScene::checkCollisions()
   {
     checkSphereCollisions();
   }
+  if (m_checkMesh == true)
+  {
+    meshCollision();
+  }
   BBoxCollision();
 }
 
 void NGLScene::removeSphere()
 {
-  std::vector<Sphere>::iterator end = m_sphereArray.end();
-  if (--m_numSpheres == 0)
-  {
-    m_numSpheres = 1;
-  }
-  else
+  // always leave one sphere
+  if (m_spheres.size() <= 1)
   {
-    m_sphereArray.erase(end - 1, end);
+    return;
   }
+  // the last sphere moves into the removed one's place, its handle still finds it
+  SlotHandle victim = m_spheres.contains(m_pickedSphere) ? m_pickedSphere : m_spheres.handle(m_spheres.size() - 1);
+  m_spheres.remove(victim);
+  m_numSpheres = static_cast<int>(m_spheres.size());
+  m_treeDirty = true;
 }
 
 void NGLScene::addSphere()
 {
 
   // add the spheres to the end of the particle list
-  m_sphereArray.push_back(Sphere(ngl::Random::getRandomPoint(s_extents, s_extents, s_extents), ngl::Random::getRandomVec3(), ngl::Random::randomPositiveNumber(2) + 0.5));
-  ++m_numSpheres;
+  m_spheres.insert(Sphere(ngl::Random::getRandomPoint(s_extents, s_extents, s_extents), ngl::Random::getRandomVec3(), ngl::Random::randomPositiveNumber(2) + 0.5));
+  m_numSpheres = static_cast<int>(m_spheres.size());
+  m_treeDirty = true;
 }
@@ -0,0 +1,64 @@
+#include "RayPacket.h"
+#include <algorithm>
+#include <cmath>
+
+void RayPacket::set(const Ray *_rays, uint32_t _count, float _tMax)
+{
+  m_count = std::min(_count, s_maxRays);
+  ngl::Vec3 meanDir(0.0f, 0.0f, 0.0f);
+  for (int a = 0; a < 3; ++a)
+  {
+    m_orgMin[a] = m_invDirMin[a] = FLT_MAX;
+    m_orgMax[a] = m_invDirMax[a] = -FLT_MAX;
+  }
+  for (uint32_t i = 0; i < m_count; ++i)
+  {
+    m_rays[i] = _rays[i];
+    m_tMax[i] = _tMax;
+    for (int a = 0; a < 3; ++a)
+    {
+      float d = _rays[i].m_dir[a];
+      // same clamp as the single ray slab test so a ray in a slab plane doesn't give 0*inf
+      if (std::fabs(d) < 1e-20f)
+      {
+        d = std::copysign(1e-20f, d);
+      }
+      m_org[a][i] = _rays[i].m_origin[a];
+      m_invDir[a][i] = 1.0f / d;
+      m_orgMin[a] = std::min(m_orgMin[a], m_org[a][i]);
+      m_orgMax[a] = std::max(m_orgMax[a], m_org[a][i]);
+      m_invDirMin[a] = std::min(m_invDirMin[a], m_invDir[a][i]);
+      m_invDirMax[a] = std::max(m_invDirMax[a], m_invDir[a][i]);
+    }
+    ngl::Vec3 d = _rays[i].m_dir;
+    d.normalize();
+    meanDir += d;
+  }
+  m_coherent = m_count > 0;
+  for (int a = 0; a < 3; ++a)
+  {
+    // the interval of inverse directions must not straddle zero
+    m_negative[a] = m_invDirMax[a] < 0.0f;
+    m_coherent &= m_negative[a] || m_invDirMin[a] > 0.0f;
+  }
+  if (m_coherent)
+  {
+    meanDir.normalize();
+    for (uint32_t i = 0; i < m_count && m_coherent; ++i)
+    {
+      ngl::Vec3 d = _rays[i].m_dir;
+      d.normalize();
+      m_coherent = d.dot(meanDir) >= s_minCosSpread;
+    }
+  }
+}
+
+float RayPacket::maxTMax() const
+{
+  float t = 0.0f;
+  for (uint32_t i = 0; i < m_count; ++i)
+  {
+    t = std::max(t, m_tMax[i]);
+  }
+  return t;
+}
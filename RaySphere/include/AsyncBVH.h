@@ -0,0 +1,79 @@
+#ifndef ASYNCBVH_H_
+#define ASYNCBVH_H_
+
+#include <future>
+#include <memory>
+#include <vector>
+#include "BVH4.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file AsyncBVH.h
+/// @brief a BVH4 for primitives that move every tick. Each update refits the tree and when the refit tree has got
+/// too slow a full rebuild is started on a background thread, queries keep using the refit tree until the new
+/// one is ready and it is swapped in on a later update, so a tick never waits for a build.
+/// The tree is held by a shared pointer that is replaced atomically. The thread calling update() owns the tree and
+/// can use tree() directly, other threads take a current() snapshot which keeps the tree they started with
+/// alive, and a replaced tree is freed when the last snapshot of it goes. Updates are copy on write so a
+/// snapshot never changes under its reader, a replaced tree nobody else holds is kept and reused for the next copy.
+/// When that spare only differs from the current tree by a refit it is refit as it is, so the node array is only
+/// copied on a tick after a snapshot was still holding the spare, a swap or an optimise.
+//----------------------------------------------------------------------------------------------------------------------
+class AsyncBVH
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @param _maxCostRatio start a rebuild when the refit tree's sahCost() is more than this times its cost when built
+  /// @param _maxLeafSize passed to BVH4::build
+  //----------------------------------------------------------------------------------------------------------------------
+  explicit AsyncBVH(float _maxCostRatio = 1.5f, uint32_t _maxLeafSize = 4);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief waits for a rebuild that is still running
+  //----------------------------------------------------------------------------------------------------------------------
+  ~AsyncBVH();
+  AsyncBVH(const AsyncBVH &) = delete;
+  AsyncBVH &operator=(const AsyncBVH &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the tree now on this thread, any background rebuild is waited for and thrown away
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<AABB> &_bounds);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief called once a tick with the new bounds of every primitive. Swaps in a finished rebuild (refit to the
+  /// new bounds as the primitives have moved since it started) or refits the current tree, then starts a rebuild
+  /// if the tree has got too slow and one isn't already running. If the number of primitives has changed the tree,
+  /// or a finished rebuild made from the old primitives, is thrown away and built again on this thread.
+  /// @param _optimiseBudget microseconds BVH4::optimise() may spend on the refit tree, 0 to only refit
+  /// @returns true if a rebuilt tree was swapped in
+  //----------------------------------------------------------------------------------------------------------------------
+  bool update(const std::vector<AABB> &_bounds, double _optimiseBudget = 0.0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the tree for the thread that calls update(), only valid until its next update()
+  //----------------------------------------------------------------------------------------------------------------------
+  const BVH4 &tree() const { return *m_current; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a snapshot of the tree that other threads can query while updates carry on
+  //----------------------------------------------------------------------------------------------------------------------
+  std::shared_ptr<const BVH4> current() const { return std::atomic_load(&m_current); }
+  bool rebuilding() const { return m_pending.valid(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuilds started and swapped in so far
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numRebuilds() const { return m_numRebuilds; }
+  size_t numSwaps() const { return m_numSwaps; }
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief make _tree the current tree and keep the old one for reuse if no snapshot holds it
+  /// @param _sameShape _tree is the old tree refit, so the old one can be refit again without a copy
+  //----------------------------------------------------------------------------------------------------------------------
+  void publish(std::shared_ptr<BVH4> _tree, bool _sameShape = false);
+  float m_maxCostRatio;
+  uint32_t m_maxLeafSize;
+  std::shared_ptr<const BVH4> m_current;
+  std::shared_ptr<BVH4> m_spare;
+  bool m_spareSameShape = false;
+  std::future<std::shared_ptr<BVH4>> m_pending;
+  size_t m_numRebuilds = 0;
+  size_t m_numSwaps = 0;
+};
+
+#endif
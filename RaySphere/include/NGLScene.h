@@ -6,7 +6,12 @@
 #include <QOpenGLWindow>
 #include "WindowParams.h"
 #include "Sphere.h"
+#include "BVH4.h"
+#include "AsyncBVH.h"
+#include "SphereHit.h"
+#include "TileRenderer.h"
 #include <memory>
+#include <string>
 //----------------------------------------------------------------------------------------------------------------------
 /// @file NGLScene.h
 /// @brief this class inherits from the Qt OpenGLWindow and allows us to use NGL to draw OpenGL
@@ -45,6 +50,15 @@ class NGLScene : public QOpenGLWindow
     /// @brief this is called everytime we resize
     //----------------------------------------------------------------------------------------------------------------------
     void resizeGL(int _w, int _h);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief cast one ray per pixel through the camera on several threads and write the depth or normals, this
+    /// needs no GL context so it can be used without showing the window
+    /// @param _numThreads threads to use, 0 for one per hardware thread
+    /// @param _fileName the image to write, .pfm for floats anything else for an 8 bit PPM
+    /// @param _normals write the normals instead of the depth
+    /// @returns false if the image couldn't be written
+    //----------------------------------------------------------------------------------------------------------------------
+    bool renderImage(int _width, int _height, unsigned int _numThreads, const std::string &_fileName, bool _normals);
 
 private:
     //----------------------------------------------------------------------------------------------------------------------
@@ -77,6 +91,28 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     int m_numSpheres;
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief four wide BVH over the spheres so each ray only tests the spheres it can reach, refit each tick while
+    /// the spheres move and rebuilt in the background when it gets too slow
+    //----------------------------------------------------------------------------------------------------------------------
+    AsyncBVH m_bvh;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the spheres drift with these velocities when m_moveSpheres is on
+    //----------------------------------------------------------------------------------------------------------------------
+    std::vector<ngl::Vec3> m_velocities;
+    bool m_moveSpheres = false;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief microseconds a tick may spend rebuilding the worst subtrees of the refit BVH, [ and ] halve and double it
+    //----------------------------------------------------------------------------------------------------------------------
+    double m_optimiseBudget = 1000.0;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the longest updateScene since the last rebuild was swapped in, in ms
+    //----------------------------------------------------------------------------------------------------------------------
+    double m_slowestTick = 0.0;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief every sphere hit by the rays this tick, filled in by updateScene and read by paintGL
+    //----------------------------------------------------------------------------------------------------------------------
+    std::vector<SphereHit> m_hits;
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief timer the ray is stored as two points this is one of the start points
     //----------------------------------------------------------------------------------------------------------------------
     ngl::Vec3 m_rayStart;
@@ -106,6 +142,70 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void updateScene();
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief mark every sphere the ray passes through as hit using the BVH and add a record for each to m_hits
+    /// @param _rayStart the origin or the ray
+    /// @param _rayDir the direction of the ray
+    /// @param _rayIndex stored in the hit records to say which ray made them
+    //----------------------------------------------------------------------------------------------------------------------
+    void markHits(ngl::Vec3 _rayStart, ngl::Vec3 _rayDir, uint32_t _rayIndex);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the bounding box of every sphere for the BVH
+    //----------------------------------------------------------------------------------------------------------------------
+    void sphereBounds(std::vector<AABB> &o_bounds) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief move the spheres one tick, bouncing off the edges of the area they were made in, and update the BVH
+    //----------------------------------------------------------------------------------------------------------------------
+    void moveSpheres();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief is any sphere on the ray between 0 and _tMax, the traversal stops at the first one found
+    /// @param _ray the ray to test, _tMax is in units of its direction
+    //----------------------------------------------------------------------------------------------------------------------
+    bool occluded(const Ray &_ray, float _tMax) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the nearest sphere in front of a ray through _bvh
+    /// @param _ray the ray, its direction must be unit length
+    //----------------------------------------------------------------------------------------------------------------------
+    PixelHit closestHit(const BVH4 &_bvh, const Ray &_ray) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief occlusion test for a batch of segments
+    /// @param o_occluded resized to hold a bit per segment, bit i (word i/64 bit i%64) is set if segment i is blocked
+    //----------------------------------------------------------------------------------------------------------------------
+    void occluded(const std::vector<Segment> &_segments, std::vector<uint64_t> &o_occluded) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time a batch of random rays finding every sphere hit with the brute force loop and the BVH
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmark();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time finding every sphere hit for camera rays in 4x4 and 8x8 packets against single rays, and the same
+    /// for random rays that can't be traced as packets
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkPackets();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief build a UniformGrid of the spheres and time it against the BVH building and finding every hit and the
+    /// closest hit for the same rays, the closest hits are checked against the brute force loop
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkGrid(const std::vector<Ray> &_rays);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time RaySphereKernel testing every ray against every sphere untiled and with a range of tile sizes,
+    /// and report the fastest tile
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkKernel(const std::vector<Ray> &_rays);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief reflect random rays off the spheres they hit and time the closest hit of the shuffled reflected rays
+    /// traced as they are and through RaySorter
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkSorting();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief jitter copies of the spheres for a number of ticks and compare refitting the BVH each tick, refitting
+    /// with a rebuild when the tree has got too bad, and building it from scratch
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkRefit(const std::vector<Ray> &_rays);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief move copies of the spheres for a number of ticks updating the tree with a blocking rebuild, with
+    /// AsyncBVH and with a time sliced BVH4::optimise() and compare the time of the slowest tick and the tree cost
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkAsync();
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief method to load transform matrices to the shader
     //----------------------------------------------------------------------------------------------------------------------
     void loadMatricesToShader();
@@ -147,14 +247,10 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void timerEvent( QTimerEvent *_event);
     //----------------------------------------------------------------------------------------------------------------------
-		/// @brief to get the actual hit points we need to solve the quadratic equations which will give us
-		/// two roots
-		/// @param _raystart the origin or the ray
-		/// @param _raydir the direction of the ray
-		/// @param _pos the position of the sphere
-		/// @param _radius the radius of the sphere
+		/// @brief draw the entry and exit points of a hit, the points were worked out when the record was made
+		/// @param _hit the record to draw
 		//----------------------------------------------------------------------------------------------------------------------
-		void drawHitPoints(ngl::Vec3 _rayStart,	ngl::Vec3 _rayDir,	ngl::Vec3 _pos, GLfloat _radius	);
+		void drawHitPoints(const SphereHit &_hit);
 		//----------------------------------------------------------------------------------------------------------------------
 		/// @brief do ray sphere intercetion test
 		/// @param _rayStart the origin or the ray
@@ -163,6 +259,11 @@ private:
 		/// @param _radius the radius of the sphere
 		//----------------------------------------------------------------------------------------------------------------------
 		bool raySphere(ngl::Vec3 _rayStart,	 ngl::Vec3 _rayDir,	 ngl::Vec3 _pos, GLfloat _radius	);
+		//----------------------------------------------------------------------------------------------------------------------
+		/// @brief does the sphere touch the ray at t >= 0, raySphere() takes the whole line but the BVH and the grid
+		/// only reach spheres in front of the origin so the benchmarks count hits with this to compare like with like
+		//----------------------------------------------------------------------------------------------------------------------
+		static bool hitAhead(const Ray &_ray, const Sphere &_sphere);
 
 
 
@@ -0,0 +1,122 @@
+#ifndef RAYPACKET_H_
+#define RAYPACKET_H_
+
+#include <cfloat>
+#include <cstdint>
+#include <utility>
+#include "Ray.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file RayPacket.h
+/// @brief a packet of up to 64 rays (a 4x4 or 8x8 tile of camera rays) traced through a BVH4 together. As well as
+/// the per ray slab data the packet keeps the interval of origins and inverse directions of all its rays, so a
+/// single interval arithmetic test can show that every ray misses a box and the whole packet skips it.
+/// The interval test only works when all the rays point the same way along each axis and it stops culling
+/// anything when the rays spread out, so packets that are not coherent are traced one ray at a time instead.
+//----------------------------------------------------------------------------------------------------------------------
+struct RayPacket
+{
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the most rays a packet can hold, enough for an 8x8 tile
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr uint32_t s_maxRays = 64;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief rays whose directions are further than this from the mean (as a cosine) make the packet incoherent
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr float s_minCosSpread = 0.9f;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief fill the packet and work out the interval bounds
+  /// @param _rays the rays to copy in
+  /// @param _count how many rays, at most s_maxRays
+  /// @param _tMax the starting furthest distance for every ray
+  //----------------------------------------------------------------------------------------------------------------------
+  void set(const Ray *_rays, uint32_t _count, float _tMax = FLT_MAX);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a mask with a bit set for every ray in the packet
+  //----------------------------------------------------------------------------------------------------------------------
+  uint64_t allRays() const { return m_count == 64 ? ~uint64_t(0) : (uint64_t(1) << m_count) - 1; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the largest m_tMax of the rays, used to cull boxes for the whole packet
+  //----------------------------------------------------------------------------------------------------------------------
+  float maxTMax() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief slab test one ray of the packet against a box given as min x,y,z then max x,y,z
+  /// @param o_tNear the entry distance when the ray hits
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersectBox(uint32_t _i, const float *_box, float &o_tNear) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief call _func(uint32_t _ray) for each ray with its bit set in _rayMask
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename Func>
+  static void forEachRay(uint64_t _rayMask, Func &&_func);
+
+  Ray m_rays[s_maxRays];
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the furthest distance still wanted for each ray, leaf functions shorten it for closest hits
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_tMax[s_maxRays];
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief per ray slab test data
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_org[3][s_maxRays];
+  float m_invDir[3][s_maxRays];
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief interval of the origins and inverse directions over all the rays
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_orgMin[3];
+  float m_orgMax[3];
+  float m_invDirMin[3];
+  float m_invDirMax[3];
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief true if all the rays point down the negative axis, only meaningful when m_coherent
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_negative[3];
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief all the direction signs agree and the directions are close enough together to trace as a packet
+  //----------------------------------------------------------------------------------------------------------------------
+  bool m_coherent = false;
+  uint32_t m_count = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool RayPacket::intersectBox(uint32_t _i, const float *_box, float &o_tNear) const
+{
+  float tNear = 0.0f;
+  float tFar = m_tMax[_i];
+  for (int a = 0; a < 3; ++a)
+  {
+    float t0 = (_box[a] - m_org[a][_i]) * m_invDir[a][_i];
+    float t1 = (_box[a + 3] - m_org[a][_i]) * m_invDir[a][_i];
+    if (t0 > t1)
+    {
+      std::swap(t0, t1);
+    }
+    tNear = t0 > tNear ? t0 : tNear;
+    tFar = t1 < tFar ? t1 : tFar;
+  }
+  o_tNear = tNear;
+  return tNear <= tFar;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Func>
+void RayPacket::forEachRay(uint64_t _rayMask, Func &&_func)
+{
+  while (_rayMask != 0)
+  {
+#if defined(__GNUC__)
+    uint32_t r = static_cast<uint32_t>(__builtin_ctzll(_rayMask));
+#else
+    uint32_t r = 0;
+    while (!(_rayMask & (uint64_t(1) << r)))
+    {
+      ++r;
+    }
+#endif
+    _func(r);
+    // clear the lowest set bit
+    _rayMask &= _rayMask - 1;
+  }
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef RAYSORTER_H_
+#define RAYSORTER_H_
+
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "BVH4.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file RaySorter.h
+/// @brief reorders an incoherent batch of rays (secondary rays, random rays) so that rays next to each other in the
+/// batch start near each other and point the same way, they then visit the same tree nodes and primitives and
+/// find them still in cache. Each ray gets a 42 bit key, the top 12 bits interleave its direction quantised to
+/// 4 bits per axis, the sign of each component and 3 bits across its half of -1 to 1, so the top 3 bits of the key
+/// are the octant and rays are grouped by it exactly. The low 30 bits are the Morton code of its origin quantised
+/// to 10 bits per axis over the scene bounds. The keys are radix sorted, the batch is traced in key order and the
+/// results are scattered back so the caller sees them in its own order.
+//----------------------------------------------------------------------------------------------------------------------
+class RaySorter
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief sort a batch, afterwards order()[i] is the index in _rays of the i'th ray in key order
+  /// @param _bounds the box the origins are quantised over, origins outside it are clamped to its sides
+  //----------------------------------------------------------------------------------------------------------------------
+  void sort(const std::vector<Ray> &_rays, const AABB &_bounds);
+  const std::vector<uint32_t> &order() const { return m_order; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the rays of the last sort in key order
+  //----------------------------------------------------------------------------------------------------------------------
+  const std::vector<Ray> &sortedRays() const { return m_sorted; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief sort a batch, trace it in key order and write each result to the position of its ray in _rays
+  /// @param _trace called as Result _trace(const Ray &_ray) once for each ray
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename Result, typename TraceFunc>
+  void trace(const std::vector<Ray> &_rays, const AABB &_bounds, std::vector<Result> &o_results, TraceFunc &&_trace);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the sort key of one ray
+  //----------------------------------------------------------------------------------------------------------------------
+  static uint64_t key(const Ray &_ray, const AABB &_bounds);
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief spread the low 10 bits of _v so there are two zero bits between each
+  //----------------------------------------------------------------------------------------------------------------------
+  static uint64_t spreadBits(uint32_t _v);
+  static constexpr int s_originBits = 10;
+  static constexpr int s_directionBits = 4;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bits sorted per radix pass
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr int s_radixBits = 11;
+  std::vector<uint64_t> m_keys;
+  std::vector<uint64_t> m_scratchKeys;
+  std::vector<uint32_t> m_order;
+  std::vector<uint32_t> m_scratchOrder;
+  std::vector<Ray> m_sorted;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Result, typename TraceFunc>
+void RaySorter::trace(const std::vector<Ray> &_rays, const AABB &_bounds, std::vector<Result> &o_results, TraceFunc &&_trace)
+{
+  sort(_rays, _bounds);
+  o_results.resize(_rays.size());
+  for (size_t i = 0; i < m_sorted.size(); ++i)
+  {
+    o_results[m_order[i]] = _trace(m_sorted[i]);
+  }
+}
+
+#endif
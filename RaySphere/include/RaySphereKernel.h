@@ -0,0 +1,74 @@
+#ifndef RAYSPHEREKERNEL_H_
+#define RAYSPHEREKERNEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "Sphere.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file RaySphereKernel.h
+/// @brief every ray against every sphere for large batches with no acceleration structure. The plain double loop
+/// reads the whole sphere set once per ray so once the spheres no longer fit in cache each ray waits on memory.
+/// Here the rays and spheres are copied into SoA arrays and split into tiles, a tile of spheres is tested against
+/// every ray of a tile of rays while it is still in cache, the same blocking a matrix multiply uses. Four spheres
+/// are tested at once with SSE and the hits are written to one compact list.
+/// The tile sizes are tunable as the best values depend on the cache sizes of the machine, the benchmark in
+/// NGLScene tries a range of them.
+//----------------------------------------------------------------------------------------------------------------------
+class RaySphereKernel
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a ray whose line passes through a sphere and the distance along the ray where it enters
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Hit
+  {
+    uint32_t m_ray;
+    uint32_t m_sphere;
+    float m_tNear;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy the sphere centres and squared radii into SoA arrays
+  //----------------------------------------------------------------------------------------------------------------------
+  void setSpheres(const std::vector<Sphere> &_spheres);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy the rays into SoA arrays, the directions don't need to be normalized
+  //----------------------------------------------------------------------------------------------------------------------
+  void setRays(const std::vector<Ray> &_rays);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the number of rays and spheres in a tile
+  //----------------------------------------------------------------------------------------------------------------------
+  void setBlockSizes(size_t _rayBlock, size_t _sphereBlock);
+  size_t rayBlock() const { return m_rayBlock; }
+  size_t sphereBlock() const { return m_sphereBlock; }
+  size_t numRays() const { return m_rayX.size(); }
+  size_t numSpheres() const { return m_sphereX.size(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief test every ray against every sphere, the same test as NGLScene::raySphere() so a hit is the line of
+  /// the ray passing through the sphere
+  /// @param o_hits cleared and filled with every hit, grouped by ray tile and then by sphere tile
+  //----------------------------------------------------------------------------------------------------------------------
+  void intersect(std::vector<Hit> &o_hits) const;
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief one tile of rays against one tile of spheres
+  //----------------------------------------------------------------------------------------------------------------------
+  void intersectTile(size_t _rayBegin, size_t _rayEnd, size_t _sphereBegin, size_t _sphereEnd, std::vector<Hit> &io_hits) const;
+  size_t m_rayBlock = 256;
+  size_t m_sphereBlock = 1024;
+  std::vector<float> m_sphereX;
+  std::vector<float> m_sphereY;
+  std::vector<float> m_sphereZ;
+  std::vector<float> m_sphereRadius2;
+  std::vector<float> m_rayX;
+  std::vector<float> m_rayY;
+  std::vector<float> m_rayZ;
+  std::vector<float> m_rayDirX;
+  std::vector<float> m_rayDirY;
+  std::vector<float> m_rayDirZ;
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include <ngl/ShaderLib.h>
 #include <ngl/Transformation.h>
 #include <ngl/Vec3.h>
+#include "Ray.h"
+#include <cmath>
 
 /*! \brief a simple sphere class */
 class Sphere
@@ -23,6 +25,12 @@ public :
 	inline bool isHit()const {return m_hit;}
   inline ngl::Vec3 getPos() const {return m_pos;}
 	inline GLfloat getRadius() const {return m_radius;}
+	/// @brief solve the ray sphere quadratic once
+	/// @param[in] _ray the ray, the direction doesn't need to be normalized
+	/// @param[out] o_tNear the distance along the ray where it enters the sphere
+	/// @param[out] o_tFar the distance along the ray where it leaves the sphere
+	/// @returns true if the line of the ray passes through the sphere, the distances may be behind the origin
+	inline bool intersect(const Ray &_ray, float &o_tNear, float &o_tFar) const;
 	/// set the sphere values
 	/// @param[in] _pos the position to set
 	/// @param[in] _dir the direction of the sphere
@@ -49,4 +57,20 @@ private :
 
 
 
+inline bool Sphere::intersect(const Ray &_ray, float &o_tNear, float &o_tFar) const
+{
+  ngl::Vec3 oc=_ray.m_origin-m_pos;
+  float a=_ray.m_dir.dot(_ray.m_dir);
+  float b=_ray.m_dir.dot(oc);
+  float discrim=b*b-a*(oc.dot(oc)-m_radius*m_radius);
+  if(discrim <= 0.0f)
+  {
+    return false;
+  }
+  float root=std::sqrt(discrim);
+  o_tNear=(-b-root)/a;
+  o_tFar=(-b+root)/a;
+  return true;
+}
+
 #endif
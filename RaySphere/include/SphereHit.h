@@ -0,0 +1,39 @@
+#ifndef SPHEREHIT_H_
+#define SPHEREHIT_H_
+
+#include <ngl/Vec3.h>
+#include <cstdint>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file SphereHit.h
+/// @brief the result of one ray passing through one sphere. The quadratic is solved once when the record is made
+/// and anything that wants the hit points (drawing, other queries) reads them from here.
+//----------------------------------------------------------------------------------------------------------------------
+struct SphereHit
+{
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief index of the sphere in the scene array
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t m_sphereIndex;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief which of the scene's rays made the hit
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t m_rayIndex;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief distances along the normalized ray where it enters and leaves the sphere, the line of the ray is
+  /// tested so tNear can be negative when the ray starts inside or past the sphere
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_tNear;
+  float m_tFar;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the entry point and the surface normal there
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_point;
+  ngl::Vec3 m_normal;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the exit point
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_exitPoint;
+};
+
+#endif
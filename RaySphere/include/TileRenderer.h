@@ -0,0 +1,143 @@
+#ifndef TILERENDERER_H_
+#define TILERENDERER_H_
+
+#include <ngl/Mat4.h>
+#include <ngl/Vec3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Ray.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TileRenderer.h
+/// @brief casts one primary ray per pixel through the camera given by a view and projection matrix and stores the
+/// depth and normal of the closest hit. The image is split into square tiles which a pool of threads take one at a
+/// time from a shared counter, so threads that get cheap tiles simply take more of them. It needs no GL so it can
+/// be run headless to measure ray query throughput.
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief what the trace function reports for one pixel
+//----------------------------------------------------------------------------------------------------------------------
+struct PixelHit
+{
+  bool m_hit = false;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief distance from the eye, the primary rays have unit length directions
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_depth = 0.0f;
+  ngl::Vec3 m_normal;
+};
+
+class TileRenderer
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief size of the square tiles handed to each thread
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr int s_tileSize = 16;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief set up the camera for an image of the given size
+  /// @param _view the view matrix
+  /// @param _project the projection matrix, its aspect should match the image
+  //----------------------------------------------------------------------------------------------------------------------
+  TileRenderer(const ngl::Mat4 &_view, const ngl::Mat4 &_project, int _width, int _height);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the ray through the centre of pixel _x,_y, pixel 0,0 is the top left
+  //----------------------------------------------------------------------------------------------------------------------
+  Ray primaryRay(int _x, int _y) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief trace every pixel
+  /// @param _numThreads threads to use, 0 uses one per hardware thread
+  /// @param _trace called as PixelHit _trace(const Ray &_ray) from several threads at once so it must only read
+  /// shared data
+  /// @returns the time taken in seconds
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename TraceFunc>
+  double render(unsigned int _numThreads, TraceFunc &&_trace);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write the depth as a one channel PFM, or a grey PPM with the nearest hit white
+  /// @returns false if the file couldn't be written
+  //----------------------------------------------------------------------------------------------------------------------
+  bool writeDepth(const std::string &_fileName) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write the normals as a three channel PFM, or a PPM with each component mapped from -1..1 to 0..255
+  /// @returns false if the file couldn't be written
+  //----------------------------------------------------------------------------------------------------------------------
+  bool writeNormal(const std::string &_fileName) const;
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief number of pixels that hit something in the last render
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numHits() const;
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief transform the point _x,_y,_z by the matrix including the divide by w
+  //----------------------------------------------------------------------------------------------------------------------
+  static ngl::Vec3 transformPoint(const ngl::Mat4 &_m, float _x, float _y, float _z);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write _channels floats per pixel, the format is picked from the extension (.pfm or .ppm)
+  //----------------------------------------------------------------------------------------------------------------------
+  bool write(const std::string &_fileName, const std::vector<float> &_pixels, int _channels) const;
+  int m_width;
+  int m_height;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the eye position and the inverse view projection used to unproject pixels
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_eye;
+  ngl::Mat4 m_inverseViewProject;
+  std::vector<PixelHit> m_pixels;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename TraceFunc>
+double TileRenderer::render(unsigned int _numThreads, TraceFunc &&_trace)
+{
+  if (_numThreads == 0)
+  {
+    _numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const int tilesX = (m_width + s_tileSize - 1) / s_tileSize;
+  const int tilesY = (m_height + s_tileSize - 1) / s_tileSize;
+  const int numTiles = tilesX * tilesY;
+  m_pixels.assign(static_cast<size_t>(m_width) * m_height, PixelHit());
+  std::atomic<int> nextTile(0);
+  auto worker = [&]()
+  {
+    for (int tile = nextTile++; tile < numTiles; tile = nextTile++)
+    {
+      const int x0 = (tile % tilesX) * s_tileSize;
+      const int y0 = (tile / tilesX) * s_tileSize;
+      const int x1 = std::min(x0 + s_tileSize, m_width);
+      const int y1 = std::min(y0 + s_tileSize, m_height);
+      for (int y = y0; y < y1; ++y)
+      {
+        for (int x = x0; x < x1; ++x)
+        {
+          m_pixels[static_cast<size_t>(y) * m_width + x] = _trace(primaryRay(x, y));
+        }
+      }
+    }
+  };
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> threads;
+  threads.reserve(_numThreads - 1);
+  for (unsigned int i = 1; i < _numThreads; ++i)
+  {
+    threads.emplace_back(worker);
+  }
+  // the calling thread does its share too
+  worker();
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+#endif
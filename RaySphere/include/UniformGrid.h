@@ -0,0 +1,185 @@
+#ifndef UNIFORMGRID_H_
+#define UNIFORMGRID_H_
+
+#include <ngl/Vec3.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "BVH4.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file UniformGrid.h
+/// @brief a uniform grid of cube shaped cells each listing the primitives whose boxes overlap it. For large sets of
+/// evenly spread spheres it is much cheaper to build (and so to rebuild every tick) than a tree, it is two passes
+/// of a counting sort. Rays are marched through the cells nearest first with the Amanatides-Woo 3D-DDA and a
+/// primitive that spans several cells is only passed on once per ray, a mailbox remembers the last ray that
+/// tested each primitive.
+//----------------------------------------------------------------------------------------------------------------------
+class UniformGrid
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the last ray each primitive was passed to the caller for, every thread tracing rays needs its own
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Mailbox
+  {
+    std::vector<uint32_t> m_lastRay;
+    uint32_t m_ray = 0;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief build the grid from the bounds of each primitive, the index of a primitive is its position in _bounds
+  /// @param _cellsPerPrim the cell size is chosen to give about this many cells for each primitive
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<AABB> &_bounds, float _cellsPerPrim = 2.0f);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief march a ray through the cells it passes nearest first
+  /// @param _ray the ray to trace
+  /// @param _tMax the furthest distance along the ray to consider
+  /// @param io_mailbox the caller's mailbox, resized to the number of primitives when needed
+  /// @param _prim called once for each primitive in the cells the ray passes as bool _prim(uint32_t _index,
+  /// float &io_tMax). It may shorten io_tMax for a closest hit and returns true to stop. The march ends as soon as
+  /// the far side of the current cell is beyond io_tMax as nothing in a later cell can be closer.
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename PrimFunc>
+  void traverse(const Ray &_ray, float _tMax, Mailbox &io_mailbox, PrimFunc &&_prim) const;
+  int resolution(int _axis) const { return m_res[_axis]; }
+  size_t numCells() const { return static_cast<size_t>(m_res[0]) * m_res[1] * m_res[2]; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the total length of the cell lists, a primitive is counted once for every cell it overlaps
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numEntries() const { return m_cellPrims.size(); }
+  const AABB &bounds() const { return m_bounds; }
+  bool empty() const { return m_numPrims == 0; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bytes used by the cell offsets and lists
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t memoryUsage() const { return (m_cellStart.capacity() + m_cellPrims.capacity()) * sizeof(uint32_t); }
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the most cells along one axis, keeps a few huge primitives from asking for an enormous grid
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr int s_maxResolution = 1024;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the smallest cell side as a fraction of the mean side of the primitive boxes
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr float s_minCellSize = 0.5f;
+  uint32_t cellIndex(int _x, int _y, int _z) const { return (static_cast<uint32_t>(_z) * m_res[1] + _y) * m_res[0] + _x; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the cell holding _value on _axis, clamped into the grid
+  //----------------------------------------------------------------------------------------------------------------------
+  int cellCoord(float _value, int _axis) const;
+  AABB m_bounds;
+  ngl::Vec3 m_cellSize;
+  ngl::Vec3 m_invCellSize;
+  int m_res[3] = {0, 0, 0};
+  uint32_t m_numPrims = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the primitives of cell c are m_cellPrims[m_cellStart[c]] to m_cellPrims[m_cellStart[c+1]-1]
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_cellStart;
+  std::vector<uint32_t> m_cellPrims;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+inline int UniformGrid::cellCoord(float _value, int _axis) const
+{
+  int c = static_cast<int>((_value - m_bounds.m_min[_axis]) * m_invCellSize[_axis]);
+  return std::min(std::max(c, 0), m_res[_axis] - 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename PrimFunc>
+void UniformGrid::traverse(const Ray &_ray, float _tMax, Mailbox &io_mailbox, PrimFunc &&_prim) const
+{
+  if (empty())
+  {
+    return;
+  }
+  // a new id for this ray, the mailbox is cleared when the ids wrap round or the grid has changed size
+  if (++io_mailbox.m_ray == 0 || io_mailbox.m_lastRay.size() != m_numPrims)
+  {
+    io_mailbox.m_lastRay.assign(m_numPrims, 0);
+    io_mailbox.m_ray = 1;
+  }
+  // clip the ray to the grid bounds
+  float invDir[3];
+  float tEnter = 0.0f;
+  float tExit = _tMax;
+  for (int a = 0; a < 3; ++a)
+  {
+    float d = _ray.m_dir[a];
+    if (std::fabs(d) < 1e-20f)
+    {
+      d = std::copysign(1e-20f, d);
+    }
+    invDir[a] = 1.0f / d;
+    float t0 = (m_bounds.m_min[a] - _ray.m_origin[a]) * invDir[a];
+    float t1 = (m_bounds.m_max[a] - _ray.m_origin[a]) * invDir[a];
+    tEnter = std::max(tEnter, std::min(t0, t1));
+    tExit = std::min(tExit, std::max(t0, t1));
+  }
+  if (tEnter > tExit)
+  {
+    return;
+  }
+  // the cell the ray enters in, the step to the next cell on each axis and the distances to the next boundaries
+  const ngl::Vec3 p = _ray.at(tEnter);
+  int cell[3];
+  int step[3];
+  int out[3];
+  float tNext[3];
+  float tDelta[3];
+  for (int a = 0; a < 3; ++a)
+  {
+    cell[a] = cellCoord(p[a], a);
+    if (invDir[a] >= 0.0f)
+    {
+      step[a] = 1;
+      out[a] = m_res[a];
+      tNext[a] = (m_bounds.m_min[a] + (cell[a] + 1) * m_cellSize[a] - _ray.m_origin[a]) * invDir[a];
+    }
+    else
+    {
+      step[a] = -1;
+      out[a] = -1;
+      tNext[a] = (m_bounds.m_min[a] + cell[a] * m_cellSize[a] - _ray.m_origin[a]) * invDir[a];
+    }
+    tDelta[a] = m_cellSize[a] * std::fabs(invDir[a]);
+  }
+  while (true)
+  {
+    const uint32_t c = cellIndex(cell[0], cell[1], cell[2]);
+    for (uint32_t i = m_cellStart[c]; i < m_cellStart[c + 1]; ++i)
+    {
+      const uint32_t prim = m_cellPrims[i];
+      if (io_mailbox.m_lastRay[prim] == io_mailbox.m_ray)
+      {
+        continue;
+      }
+      io_mailbox.m_lastRay[prim] = io_mailbox.m_ray;
+      if (_prim(prim, _tMax))
+      {
+        return;
+      }
+    }
+    // the ray leaves the cell through the nearest boundary, a hit closer than that can't be beaten further on
+    const int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+    if (tNext[axis] >= _tMax)
+    {
+      return;
+    }
+    cell[axis] += step[axis];
+    if (cell[axis] == out[axis])
+    {
+      return;
+    }
+    tNext[axis] += tDelta[axis];
+  }
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "AsyncBVH.h"
+#include <chrono>
+
+AsyncBVH::AsyncBVH(float _maxCostRatio, uint32_t _maxLeafSize)
+  : m_maxCostRatio(_maxCostRatio), m_maxLeafSize(_maxLeafSize), m_current(std::make_shared<BVH4>())
+{
+}
+
+AsyncBVH::~AsyncBVH()
+{
+  if (m_pending.valid())
+  {
+    m_pending.wait();
+  }
+}
+
+void AsyncBVH::build(const std::vector<AABB> &_bounds)
+{
+  if (m_pending.valid())
+  {
+    m_pending.get();
+  }
+  std::shared_ptr<BVH4> tree = std::make_shared<BVH4>();
+  tree->build(_bounds, m_maxLeafSize);
+  publish(tree);
+}
+
+bool AsyncBVH::update(const std::vector<AABB> &_bounds, double _optimiseBudget)
+{
+  bool swapped = false;
+  if (m_pending.valid() && m_pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    std::shared_ptr<BVH4> rebuilt = m_pending.get();
+    if (_bounds.size() != rebuilt->numPrims())
+    {
+      // primitives were added or removed while it was building, its prim indices are for the old set
+      build(_bounds);
+      return true;
+    }
+    // the new tree was built from the bounds when the rebuild started so bring it up to date first
+    rebuilt->refit(_bounds);
+    publish(rebuilt);
+    ++m_numSwaps;
+    swapped = true;
+  }
+  else if (_bounds.size() != m_current->numPrims())
+  {
+    // primitives were added or removed so a refit can't be used
+    build(_bounds);
+    return true;
+  }
+  else
+  {
+    std::shared_ptr<BVH4> next;
+    if (m_spare != nullptr && m_spareSameShape)
+    {
+      // the spare was the current tree before the last refit so it has the same nodes and primitive order, a refit
+      // rewrites every box so it can be refit as it is without copying the current tree into it
+      next = std::move(m_spare);
+    }
+    else
+    {
+      next = m_spare != nullptr ? std::move(m_spare) : std::make_shared<BVH4>();
+      // assigning into the spare reuses its arrays so a tick doesn't allocate
+      *next = *m_current;
+    }
+    next->refit(_bounds);
+    if (_optimiseBudget > 0.0)
+    {
+      // whole tree rebuilds already happen on the background thread
+      next->optimise(_bounds, _optimiseBudget, false);
+    }
+    // the optimiser rebuilds subtrees so after it the old tree no longer has the new one's shape
+    publish(next, _optimiseBudget <= 0.0);
+  }
+  if (!m_pending.valid() && m_current->sahCost() > m_current->builtCost() * m_maxCostRatio)
+  {
+    // the build works on its own copy of the bounds as the caller's change every tick
+    const uint32_t maxLeafSize = m_maxLeafSize;
+    m_pending = std::async(std::launch::async, [bounds = _bounds, maxLeafSize]()
+                           {
+                             std::shared_ptr<BVH4> tree = std::make_shared<BVH4>();
+                             tree->build(bounds, maxLeafSize);
+                             return tree; });
+    ++m_numRebuilds;
+  }
+  return swapped;
+}
+
+void AsyncBVH::publish(std::shared_ptr<BVH4> _tree, bool _sameShape)
+{
+  std::shared_ptr<const BVH4> old = std::atomic_exchange(&m_current, std::shared_ptr<const BVH4>(std::move(_tree)));
+  // a spare kept from an earlier tick may be any shape
+  m_spareSameShape = false;
+  // nothing can take a new snapshot of the old tree now, if this is the last reference no reader has it
+  if (old.use_count() == 1)
+  {
+    m_spare = std::const_pointer_cast<BVH4>(old);
+    m_spareSameShape = _sameShape;
+  }
+}
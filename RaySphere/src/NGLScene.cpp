@@ -6,7 +6,20 @@
 #include <ngl/ShaderLib.h>
 #include <ngl/NGLInit.h>
 #include <ngl/VAOPrimitives.h>
+#include <ngl/Util.h>
+#include <algorithm>
+#include <bitset>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include "TileRenderer.h"
+#include "RaySphereKernel.h"
+#include "RaySorter.h"
+#include "UniformGrid.h"
 
 NGLScene::NGLScene(int _numSpheres)
 {
@@ -24,12 +37,31 @@ NGLScene::NGLScene(int _numSpheres)
 
     m_sphereArray.push_back(Sphere(ngl::Vec3(x, y, 0), ngl::Random::randomPositiveNumber(1) + 0.2));
   }
+  // the tree is only built once here, when the spheres move it is refit every tick
+  std::vector<AABB> bounds;
+  sphereBounds(bounds);
+  m_bvh.build(bounds);
+  m_velocities.resize(m_sphereArray.size());
+  for (auto &v : m_velocities)
+  {
+    v.set(ngl::Random::randomNumber(0.2f), ngl::Random::randomNumber(0.2f), 0.0f);
+  }
 
   // create the points for our ray
   m_rayStart.set(0, 10, 0);
   m_rayEnd.set(0, -5, 0);
   m_rayStart2.set(0, 0, 20);
   m_rayEnd2.set(0, 0, -5);
+  // Now we will create a basic Camera from the graphics library
+  // This is a static camera so it only needs to be set once
+  // First create Values for the camera position
+  ngl::Vec3 from(0.0f, 0.0f, -25.0f);
+  ngl::Vec3 to(0.0f, 0.0f, 0.0f);
+  ngl::Vec3 up(0.0f, 1.0f, 0.0f);
+  m_view = ngl::lookAt(from, to, up);
+  // set the shape using FOV 45 Aspect Ratio based on Width and Height
+  // The final two are near and far clipping planes of 0.5 and 10
+  m_project = ngl::perspective(45.0f, (float)720.0f / 576.0f, 0.5f, 150.0f);
   setTitle("Ray->Sphere intersetions");
 }
 
@@ -56,16 +88,7 @@ void NGLScene::initializeGL()
   glEnable(GL_DEPTH_TEST);
   // enable multisampling for smoother drawing
   glEnable(GL_MULTISAMPLE);
-  // Now we will create a basic Camera from the graphics library
-  // This is a static camera so it only needs to be set once
-  // First create Values for the camera position
-  ngl::Vec3 from(0.0f, 0.0f, -25.0f);
-  ngl::Vec3 to(0.0f, 0.0f, 0.0f);
-  ngl::Vec3 up(0.0f, 1.0f, 0.0f);
-  m_view = ngl::lookAt(from, to, up);
-  // set the shape using FOV 45 Aspect Ratio based on Width and Height
-  // The final two are near and far clipping planes of 0.5 and 10
-  m_project = ngl::perspective(45.0f, (float)720.0f / 576.0f, 0.5f, 150.0f);
+  // the camera is set up in the constructor so the headless renderer can use it without a GL context
   ngl::ShaderLib::use("nglDiffuseShader");
 
   ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 1.0f, 1.0f);
@@ -147,13 +170,11 @@ void NGLScene::paintGL()
     ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 0.0f, 1.0f);
 
     s.draw("nglDiffuseShader", m_mouseGlobalTX, m_view, m_project);
-    if (s.isHit())
-    {
-      ngl::Vec3 dir = m_rayEnd - m_rayStart;
-      ngl::Vec3 dir2 = m_rayEnd2 - m_rayStart2;
-      drawHitPoints(m_rayStart, dir, s.getPos(), s.getRadius());
-      drawHitPoints(m_rayStart2, dir2, s.getPos(), s.getRadius());
-    }
+  }
+  // the hit points were found in updateScene so there is nothing to solve here
+  for (const SphereHit &h : m_hits)
+  {
+    drawHitPoints(h);
   }
   // we build up a VAO for the lines of the start and end points and draw
   m_transform.reset();
@@ -178,56 +199,24 @@ void NGLScene::paintGL()
 }
 
 //----------------------------------------------------------------------------------------------------------------------
-void NGLScene::drawHitPoints(ngl::Vec3 _raystart, ngl::Vec3 _raydir, ngl::Vec3 _pos, GLfloat _radius)
+void NGLScene::drawHitPoints(const SphereHit &_hit)
 {
-  GLfloat A, B, C, discrim;
-  ngl::Vec3 p;
-  GLfloat discRoot;
-  GLfloat t1; // earlier hit
-  GLfloat t2; // second hit
-  // points for the hit points
-  ngl::Vec3 h1;
-  ngl::Vec3 h2;
-
-  // normalize the ray
-  _raydir.normalize();
-  // cal the A value as the dotproduct a.a (see lecture notes)
-  A = _raydir.dot(_raydir);
-  // b= 2*d.(Po-Pc)
-  p = _raystart - _pos;
-  B = _raydir.dot(p) * 2.0;
-  // C = (Po-Pc).(Po-Pc)-r^2
-  C = p.dot(p) - _radius * _radius;
-  // finally get the descrim
-  // b^2-4(ac)
-  discrim = B * B - 4.0 * (A * C);
-  // if the discrim <= 0.0 it's not a hit
-  if (discrim >= 0.0)
-  {
-    discRoot = sqrt(discrim);
-    t1 = (-B - (discRoot)) / 2 * A; // earlier hit
-    t2 = (-B + (discRoot)) / 2 * A; // second hit
-    // move along the ray from origin in ray direction with an offset of t1 / t2
-    // to get the hit points
-    h1 = _raystart + (_raydir * t1);
-    h2 = _raystart + (_raydir * t2);
-    // draw the hit points
-    ngl::ShaderLib::setUniform("Colour", 1.0f, 0.0f, 0.0f, 0.0f);
-    m_transform.reset();
-    {
-      m_transform.setPosition(h1);
-      loadMatricesToShader();
-      ngl::VAOPrimitives::draw("smallSphere");
-    }
+  // draw the hit points
+  ngl::ShaderLib::setUniform("Colour", 1.0f, 0.0f, 0.0f, 0.0f);
+  m_transform.reset();
+  {
+    m_transform.setPosition(_hit.m_point);
+    loadMatricesToShader();
+    ngl::VAOPrimitives::draw("smallSphere");
+  }
 
-    m_transform.reset();
-    {
-      ngl::ShaderLib::setUniform("Colour", 0.0f, 1.0f, 0.0f, 0.0f);
-      m_transform.setPosition(h2);
+  m_transform.reset();
+  {
+    ngl::ShaderLib::setUniform("Colour", 0.0f, 1.0f, 0.0f, 0.0f);
+    m_transform.setPosition(_hit.m_exitPoint);
 
-      loadMatricesToShader();
-      ngl::VAOPrimitives::draw("smallSphere");
-    }
+    loadMatricesToShader();
+    ngl::VAOPrimitives::draw("smallSphere");
   }
 }
 //----------------------------------------------------------------------------------------------------------------------
@@ -269,28 +258,24 @@ void NGLScene::updateScene()
   };
 
   static int s_direction = 0;
-  bool collide;
   ngl::Vec3 dir;
   ngl::Vec3 dir2;
   dir = m_rayEnd - m_rayStart;
   dir2 = m_rayEnd2 - m_rayStart2;
 
+  if (m_moveSpheres)
+  {
+    moveSpheres();
+  }
   // note here we need to iterate by reference as we want to modify the Sphere Objects
   // so we need to explicitly create our object as a reference object
   for (Sphere &s : m_sphereArray)
   {
     s.setNotHit();
-    collide = raySphere(m_rayStart, dir, s.getPos(), s.getRadius());
-    if (collide)
-    {
-      s.setHit();
-    }
-    collide = raySphere(m_rayStart2, dir2, s.getPos(), s.getRadius());
-    if (collide)
-    {
-      s.setHit();
-    }
   }
+  m_hits.clear();
+  markHits(m_rayStart, dir, 0);
+  markHits(m_rayStart2, dir2, 1);
 
   // now update the rays
   if (s_direction == FWD)
@@ -313,6 +298,767 @@ void NGLScene::updateScene()
   }
 }
 
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::sphereBounds(std::vector<AABB> &o_bounds) const
+{
+  o_bounds.resize(m_sphereArray.size());
+  for (size_t i = 0; i < m_sphereArray.size(); ++i)
+  {
+    ngl::Vec3 r(m_sphereArray[i].getRadius(), m_sphereArray[i].getRadius(), m_sphereArray[i].getRadius());
+    o_bounds[i] = AABB();
+    o_bounds[i].extend(m_sphereArray[i].getPos() - r);
+    o_bounds[i].extend(m_sphereArray[i].getPos() + r);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::moveSpheres()
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < m_sphereArray.size(); ++i)
+  {
+    ngl::Vec3 p = m_sphereArray[i].getPos() + m_velocities[i];
+    // the spheres were made in x -10..10 and y -8..8
+    if (std::fabs(p.m_x) > 10.0f)
+    {
+      m_velocities[i].m_x = -m_velocities[i].m_x;
+    }
+    if (std::fabs(p.m_y) > 8.0f)
+    {
+      m_velocities[i].m_y = -m_velocities[i].m_y;
+    }
+    m_sphereArray[i].set(p, m_velocities[i], m_sphereArray[i].getRadius());
+  }
+  std::vector<AABB> bounds;
+  sphereBounds(bounds);
+  bool swapped = m_bvh.update(bounds, m_optimiseBudget);
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  m_slowestTick = std::max(m_slowestTick, ms);
+  if (swapped)
+  {
+    std::cout << "Rebuilt BVH swapped in, SAH cost " << m_bvh.tree().sahCost() << " slowest tick since the last one "
+              << m_slowestTick << " ms\n";
+    m_slowestTick = 0.0;
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::markHits(ngl::Vec3 _rayStart, ngl::Vec3 _rayDir, uint32_t _rayIndex)
+{
+  // with a unit direction the t values are distances
+  _rayDir.normalize();
+  const Ray ray(_rayStart, _rayDir);
+  const BVH4 &bvh = m_bvh.tree();
+  // every hit is wanted so the leaf function never shortens the ray
+  bvh.traverse(ray, FLT_MAX, [&](uint32_t _first, uint32_t _count, float &)
+                 {
+                   for (uint32_t i = _first; i < _first + _count; ++i)
+                   {
+                     uint32_t index = bvh.primIndex(i);
+                     Sphere &s = m_sphereArray[index];
+                     SphereHit hit;
+                     if (s.intersect(ray, hit.m_tNear, hit.m_tFar))
+                     {
+                       s.setHit();
+                       hit.m_sphereIndex = index;
+                       hit.m_rayIndex = _rayIndex;
+                       hit.m_point = ray.at(hit.m_tNear);
+                       hit.m_normal = (hit.m_point - s.getPos()) / s.getRadius();
+                       hit.m_exitPoint = ray.at(hit.m_tFar);
+                       m_hits.push_back(hit);
+                     }
+                   }
+                   return false; });
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool NGLScene::occluded(const Ray &_ray, float _tMax) const
+{
+  bool hit = false;
+  const BVH4 &bvh = m_bvh.tree();
+  bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &)
+                 {
+                   for (uint32_t i = _first; i < _first + _count; ++i)
+                   {
+                     float tNear;
+                     float tFar;
+                     // the sphere blocks the ray if any part of it is between 0 and _tMax
+                     if (m_sphereArray[bvh.primIndex(i)].intersect(_ray, tNear, tFar) && tFar > 0.0f && tNear < _tMax)
+                     {
+                       hit = true;
+                       return true;
+                     }
+                   }
+                   return false; });
+  return hit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::occluded(const std::vector<Segment> &_segments, std::vector<uint64_t> &o_occluded) const
+{
+  o_occluded.assign((_segments.size() + 63) / 64, 0);
+  for (size_t i = 0; i < _segments.size(); ++i)
+  {
+    if (occluded(_segments[i].ray(), 1.0f))
+    {
+      o_occluded[i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool NGLScene::hitAhead(const Ray &_ray, const Sphere &_sphere)
+{
+  float tNear;
+  float tFar;
+  return _sphere.intersect(_ray, tNear, tFar) && tFar >= 0.0f;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmark()
+{
+  // random rays from around the camera through the spheres
+  size_t numSpheres = m_sphereArray.size();
+  size_t numRays = std::max<size_t>(1000, 20000000 / std::max<size_t>(1, numSpheres));
+  std::vector<Ray> rays(numRays);
+  for (auto &r : rays)
+  {
+    ngl::Vec3 from = ngl::Vec3(0.0f, 0.0f, -25.0f) + ngl::Random::getRandomVec3();
+    ngl::Vec3 to(ngl::Random::randomNumber(12), ngl::Random::randomNumber(10), ngl::Random::randomNumber(2));
+    r = Ray(from, to - from);
+  }
+  auto report = [numRays](const char *_name, std::chrono::high_resolution_clock::duration _time, size_t _hits)
+  {
+    double seconds = std::chrono::duration<double>(_time).count();
+    std::cout << _name << " " << seconds * 1000.0 << " ms " << numRays / seconds * 1e-6 << " Mrays/s " << _hits << " hits\n";
+  };
+  std::cout << "Benchmark " << numRays << " rays against " << numSpheres << " spheres\n";
+  const BVH4 &bvh = m_bvh.tree();
+  std::cout << "BVH4 " << bvh.numNodes() << " nodes " << bvh.memoryUsage() / 1024 << " KB\n";
+
+  // the loop from updateScene testing every sphere, counting only hits in front of the origin as the BVH can't
+  // reach the ones behind, the hits of each ray are kept to check the BVH finds the same ones
+  std::vector<uint32_t> expected(numRays, 0);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    for (auto &s : m_sphereArray)
+    {
+      expected[i] += hitAhead(rays[i], s);
+    }
+  }
+  report("brute force", std::chrono::high_resolution_clock::now() - start, std::accumulate(expected.begin(), expected.end(), size_t(0)));
+
+  std::vector<uint32_t> found(numRays, 0);
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t r = 0; r < numRays; ++r)
+  {
+    bvh.traverse(rays[r], FLT_MAX, [&](uint32_t _first, uint32_t _count, float &)
+                   {
+                     for (uint32_t i = _first; i < _first + _count; ++i)
+                     {
+                       found[r] += hitAhead(rays[r], m_sphereArray[bvh.primIndex(i)]);
+                     }
+                     return false; });
+  }
+  report("BVH4", std::chrono::high_resolution_clock::now() - start, std::accumulate(found.begin(), found.end(), size_t(0)));
+  size_t differ = 0;
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    differ += expected[i] != found[i];
+  }
+  std::cout << "  " << differ << " rays differ from brute force\n";
+
+  // occlusion of segments running part way along the same rays, every sphere against stopping at the first
+  std::vector<Segment> segments(numRays);
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    segments[i] = Segment(rays[i].m_origin, rays[i].at(ngl::Random::randomPositiveNumber(1.0f)));
+  }
+  size_t hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &seg : segments)
+  {
+    const Ray r = seg.ray();
+    for (auto &s : m_sphereArray)
+    {
+      float tNear;
+      float tFar;
+      if (s.intersect(r, tNear, tFar) && tFar > 0.0f && tNear < 1.0f)
+      {
+        ++hits;
+        break;
+      }
+    }
+  }
+  report("occlusion brute force", std::chrono::high_resolution_clock::now() - start, hits);
+  std::vector<uint64_t> blocked;
+  start = std::chrono::high_resolution_clock::now();
+  occluded(segments, blocked);
+  auto time = std::chrono::high_resolution_clock::now() - start;
+  hits = 0;
+  for (auto word : blocked)
+  {
+    hits += std::bitset<64>(word).count();
+  }
+  report("occlusion BVH4 any hit", time, hits);
+  benchmarkGrid(rays);
+  benchmarkKernel(rays);
+  benchmarkSorting();
+  benchmarkPackets();
+  benchmarkRefit(rays);
+  benchmarkAsync();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkGrid(const std::vector<Ray> &_rays)
+{
+  const size_t numRays = _rays.size();
+  auto seconds = [](std::chrono::high_resolution_clock::duration _time)
+  { return std::chrono::duration<double>(_time).count(); };
+  auto report = [numRays](const char *_name, double _seconds, size_t _hits)
+  {
+    std::cout << _name << " " << _seconds * 1000.0 << " ms " << numRays / _seconds * 1e-6 << " Mrays/s " << _hits << " hits\n";
+  };
+  std::vector<AABB> bounds;
+  sphereBounds(bounds);
+  BVH4 bvh;
+  auto start = std::chrono::high_resolution_clock::now();
+  bvh.build(bounds);
+  double bvhBuild = seconds(std::chrono::high_resolution_clock::now() - start);
+  UniformGrid grid;
+  start = std::chrono::high_resolution_clock::now();
+  grid.build(bounds);
+  double gridBuild = seconds(std::chrono::high_resolution_clock::now() - start);
+  std::cout << "BVH4 build " << bvhBuild * 1000.0 << " ms, uniform grid build " << gridBuild * 1000.0 << " ms "
+            << grid.resolution(0) << "x" << grid.resolution(1) << "x" << grid.resolution(2) << " cells "
+            << grid.numEntries() << " entries " << grid.memoryUsage() / 1024 << " KB\n";
+
+  // every hit, the mailbox means a sphere in several cells is only tested once so the count matches the brute force loop
+  UniformGrid::Mailbox mailbox;
+  size_t hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &r : _rays)
+  {
+    grid.traverse(r, FLT_MAX, mailbox, [&](uint32_t _index, float &)
+                  {
+                    hits += hitAhead(r, m_sphereArray[_index]);
+                    return false; });
+  }
+  report("uniform grid", seconds(std::chrono::high_resolution_clock::now() - start), hits);
+
+  // closest hit, the grid stops at the first cell whose far side is beyond the nearest hit so far
+  auto nearest = [this](const Ray &_ray, uint32_t _index, float &io_tMax, uint32_t &o_closest)
+  {
+    float tNear;
+    float tFar;
+    if (m_sphereArray[_index].intersect(_ray, tNear, tFar) && tNear > 0.0f && tNear < io_tMax)
+    {
+      io_tMax = tNear;
+      o_closest = _index;
+    }
+  };
+  const uint32_t noHit = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> expected(numRays, noHit);
+  std::vector<uint32_t> closest(numRays, noHit);
+  auto countHits = [noHit](const std::vector<uint32_t> &_closest)
+  { return static_cast<size_t>(std::count_if(_closest.begin(), _closest.end(), [noHit](uint32_t _c)
+                                             { return _c != noHit; })); };
+  auto countWrong = [&expected, &closest]()
+  {
+    size_t wrong = 0;
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+      wrong += expected[i] != closest[i];
+    }
+    return wrong;
+  };
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    float tMax = FLT_MAX;
+    for (uint32_t s = 0; s < m_sphereArray.size(); ++s)
+    {
+      nearest(_rays[i], s, tMax, expected[i]);
+    }
+  }
+  report("closest hit brute force", seconds(std::chrono::high_resolution_clock::now() - start), countHits(expected));
+
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    bvh.traverse(_rays[i], FLT_MAX, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                 {
+                   for (uint32_t p = _first; p < _first + _count; ++p)
+                   {
+                     nearest(_rays[i], bvh.primIndex(p), io_tMax, closest[i]);
+                   }
+                   return false; });
+  }
+  double time = seconds(std::chrono::high_resolution_clock::now() - start);
+  report("closest hit BVH4", time, countHits(closest));
+  std::cout << "  " << countWrong() << " differ from brute force\n";
+
+  std::fill(closest.begin(), closest.end(), noHit);
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    grid.traverse(_rays[i], FLT_MAX, mailbox, [&](uint32_t _index, float &io_tMax)
+                  {
+                    nearest(_rays[i], _index, io_tMax, closest[i]);
+                    return false; });
+  }
+  time = seconds(std::chrono::high_resolution_clock::now() - start);
+  report("closest hit uniform grid", time, countHits(closest));
+  std::cout << "  " << countWrong() << " differ from brute force\n";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkKernel(const std::vector<Ray> &_rays)
+{
+  RaySphereKernel kernel;
+  kernel.setSpheres(m_sphereArray);
+  kernel.setRays(_rays);
+  std::vector<RaySphereKernel::Hit> hits;
+  auto run = [&kernel, &hits](size_t _rayBlock, size_t _sphereBlock)
+  {
+    kernel.setBlockSizes(_rayBlock, _sphereBlock);
+    auto start = std::chrono::high_resolution_clock::now();
+    kernel.intersect(hits);
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  };
+  auto report = [&_rays, &hits](size_t _rayBlock, size_t _sphereBlock, double _seconds)
+  {
+    std::cout << "  " << _rayBlock << " x " << _sphereBlock << " " << _seconds * 1000.0 << " ms "
+              << _rays.size() / _seconds * 1e-6 << " Mrays/s " << hits.size() << " hits\n";
+  };
+  std::cout << "Blocked ray sphere kernel, rays x spheres per tile\n";
+  // one tile holding everything is the plain double loop over SoA arrays, the first run also sizes the hit list
+  run(kernel.numRays(), kernel.numSpheres());
+  double untiled = run(kernel.numRays(), kernel.numSpheres());
+  report(kernel.numRays(), kernel.numSpheres(), untiled);
+  // every pair of tile sizes that splits the batch, the fastest is kept
+  const size_t rayBlocks[] = {16, 64, 256, 1024};
+  const size_t sphereBlocks[] = {256, 1024, 4096, 16384};
+  double best = untiled;
+  size_t bestRays = kernel.numRays();
+  size_t bestSpheres = kernel.numSpheres();
+  for (size_t rayBlock : rayBlocks)
+  {
+    for (size_t sphereBlock : sphereBlocks)
+    {
+      if (rayBlock >= kernel.numRays() && sphereBlock >= kernel.numSpheres())
+      {
+        continue;
+      }
+      double seconds = run(rayBlock, sphereBlock);
+      report(rayBlock, sphereBlock, seconds);
+      if (seconds < best)
+      {
+        best = seconds;
+        bestRays = rayBlock;
+        bestSpheres = sphereBlock;
+      }
+    }
+  }
+  std::cout << "fastest tile " << bestRays << " x " << bestSpheres << " " << untiled / best << " times the untiled loop\n";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkSorting()
+{
+  // enough secondary rays that the ones touching one part of the tree are far apart in an unsorted batch
+  constexpr size_t numPrimary = 1 << 18;
+  const BVH4 &bvh = m_bvh.tree();
+  std::vector<Ray> reflected;
+  reflected.reserve(numPrimary);
+  for (size_t i = 0; i < numPrimary; ++i)
+  {
+    ngl::Vec3 from = ngl::Vec3(0.0f, 0.0f, -25.0f) + ngl::Random::getRandomVec3();
+    ngl::Vec3 to(ngl::Random::randomNumber(12), ngl::Random::randomNumber(10), ngl::Random::randomNumber(2));
+    Ray ray(from, to - from);
+    ray.m_dir.normalize();
+    PixelHit hit = closestHit(bvh, ray);
+    if (hit.m_hit)
+    {
+      // mirror the ray about the normal and start it just off the surface so it can't hit the same point
+      ngl::Vec3 dir = ray.m_dir - hit.m_normal * 2.0f * ray.m_dir.dot(hit.m_normal);
+      reflected.push_back(Ray(ray.at(hit.m_depth) + hit.m_normal * 0.001f, dir));
+    }
+  }
+  std::shuffle(reflected.begin(), reflected.end(), std::mt19937(1234));
+  std::vector<AABB> bounds;
+  sphereBounds(bounds);
+  AABB sceneBounds;
+  for (const AABB &b : bounds)
+  {
+    sceneBounds.extend(b);
+  }
+  auto report = [&reflected](const char *_name, double _seconds, const std::vector<PixelHit> &_hits)
+  {
+    size_t hits = std::count_if(_hits.begin(), _hits.end(), [](const PixelHit &_h)
+                                { return _h.m_hit; });
+    std::cout << _name << " " << _seconds * 1000.0 << " ms " << reflected.size() / _seconds * 1e-6 << " Mrays/s " << hits << " hits\n";
+  };
+  std::cout << "Reflected rays " << reflected.size() << " shuffled\n";
+
+  std::vector<PixelHit> unsorted(reflected.size());
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < reflected.size(); ++i)
+  {
+    unsorted[i] = closestHit(bvh, reflected[i]);
+  }
+  report("closest hit unsorted", std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count(), unsorted);
+
+  // the sort is timed as part of the query as it has to be paid for every batch
+  RaySorter sorter;
+  std::vector<PixelHit> sorted;
+  start = std::chrono::high_resolution_clock::now();
+  sorter.trace(reflected, sceneBounds, sorted, [this, &bvh](const Ray &_ray)
+               { return closestHit(bvh, _ray); });
+  report("closest hit sorted", std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count(), sorted);
+  start = std::chrono::high_resolution_clock::now();
+  sorter.sort(reflected, sceneBounds);
+  std::cout << "  of which sorting " << std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0 << " ms\n";
+  size_t differ = 0;
+  for (size_t i = 0; i < reflected.size(); ++i)
+  {
+    differ += unsorted[i].m_hit != sorted[i].m_hit || unsorted[i].m_depth != sorted[i].m_depth;
+  }
+  std::cout << "  " << differ << " results differ after scattering back\n";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkAsync()
+{
+  // copies of the spheres drift the way moveSpheres() moves them, long enough for several rebuilds
+  constexpr int numTicks = 200;
+  constexpr float maxCostRatio = 1.5f;
+  std::vector<ngl::Vec3> centres(m_sphereArray.size());
+  std::vector<ngl::Vec3> velocities = m_velocities;
+  std::vector<AABB> bounds(m_sphereArray.size());
+  for (size_t i = 0; i < centres.size(); ++i)
+  {
+    centres[i] = m_sphereArray[i].getPos();
+  }
+  auto tick = [&]()
+  {
+    for (size_t i = 0; i < centres.size(); ++i)
+    {
+      centres[i] += velocities[i];
+      if (std::fabs(centres[i].m_x) > 10.0f)
+      {
+        velocities[i].m_x = -velocities[i].m_x;
+      }
+      if (std::fabs(centres[i].m_y) > 8.0f)
+      {
+        velocities[i].m_y = -velocities[i].m_y;
+      }
+      ngl::Vec3 r(m_sphereArray[i].getRadius(), m_sphereArray[i].getRadius(), m_sphereArray[i].getRadius());
+      bounds[i] = AABB();
+      bounds[i].extend(centres[i] - r);
+      bounds[i].extend(centres[i] + r);
+    }
+  };
+  auto report = [](const char *_name, const std::vector<double> &_ms, size_t _rebuilds)
+  {
+    double total = 0.0;
+    for (double ms : _ms)
+    {
+      total += ms;
+    }
+    std::cout << "  " << _name << " mean " << total / _ms.size() << " ms max " << *std::max_element(_ms.begin(), _ms.end())
+              << " ms a tick, " << _rebuilds << " rebuilds\n";
+  };
+  std::cout << "Moving spheres " << numTicks << " ticks, BVH update time a tick\n";
+  std::vector<double> ms(numTicks);
+  tick();
+  BVH4 blocking;
+  blocking.build(bounds);
+  size_t rebuilds = 0;
+  for (auto &t : ms)
+  {
+    tick();
+    auto start = std::chrono::high_resolution_clock::now();
+    rebuilds += blocking.update(bounds, maxCostRatio);
+    t = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  report("refit, rebuild in the tick", ms, rebuilds);
+
+  // start again from the same place so both see the same motion
+  for (size_t i = 0; i < centres.size(); ++i)
+  {
+    centres[i] = m_sphereArray[i].getPos();
+  }
+  velocities = m_velocities;
+  tick();
+  AsyncBVH async(maxCostRatio);
+  async.build(bounds);
+  for (auto &t : ms)
+  {
+    tick();
+    auto start = std::chrono::high_resolution_clock::now();
+    async.update(bounds);
+    t = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  report("refit, rebuild in the background", ms, async.numRebuilds());
+
+  // the optimiser on its own never rebuilds the whole tree, it spends the same budget every tick on the worst subtrees
+  for (size_t i = 0; i < centres.size(); ++i)
+  {
+    centres[i] = m_sphereArray[i].getPos();
+  }
+  velocities = m_velocities;
+  tick();
+  BVH4 optimised;
+  optimised.build(bounds);
+  size_t subtrees = 0;
+  for (auto &t : ms)
+  {
+    tick();
+    auto start = std::chrono::high_resolution_clock::now();
+    optimised.refit(bounds);
+    subtrees += optimised.optimise(bounds, m_optimiseBudget);
+    t = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  report("refit, optimise", ms, 0);
+  std::cout << "  " << async.numSwaps() << " background rebuilds swapped in, " << subtrees << " subtrees rebuilt in "
+            << m_optimiseBudget << " us a tick\n";
+  std::cout << "  final SAH cost blocking " << blocking.sahCost() << " background " << async.tree().sahCost() << " optimised "
+            << optimised.sahCost() << " built " << optimised.builtCost() << "\n";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkRefit(const std::vector<Ray> &_rays)
+{
+  // copies of the centres take a small random step every tick, the scene's own spheres are left where they are
+  std::vector<ngl::Vec3> centres(m_sphereArray.size());
+  std::vector<AABB> bounds(m_sphereArray.size());
+  for (size_t i = 0; i < centres.size(); ++i)
+  {
+    centres[i] = m_sphereArray[i].getPos();
+  }
+  auto sphereBounds = [&]()
+  {
+    for (size_t i = 0; i < centres.size(); ++i)
+    {
+      ngl::Vec3 r(m_sphereArray[i].getRadius(), m_sphereArray[i].getRadius(), m_sphereArray[i].getRadius());
+      bounds[i] = AABB();
+      bounds[i].extend(centres[i] - r);
+      bounds[i].extend(centres[i] + r);
+    }
+  };
+  sphereBounds();
+  BVH4 refitted;
+  refitted.build(bounds);
+  BVH4 updated = refitted;
+  constexpr int numTicks = 20;
+  constexpr float maxCostRatio = 1.5f;
+  double refitMs = 0.0;
+  double updateMs = 0.0;
+  int rebuilds = 0;
+  for (int tick = 0; tick < numTicks; ++tick)
+  {
+    for (auto &c : centres)
+    {
+      c += ngl::Random::getRandomVec3() * 0.2f;
+    }
+    sphereBounds();
+    auto start = std::chrono::high_resolution_clock::now();
+    refitted.refit(bounds);
+    refitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    rebuilds += updated.update(bounds, maxCostRatio);
+    updateMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  BVH4 rebuilt;
+  auto start = std::chrono::high_resolution_clock::now();
+  rebuilt.build(bounds);
+  double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "Refit " << numTicks << " ticks of jittered spheres, refit " << refitMs / numTicks << " ms a tick, refit with "
+            << rebuilds << " rebuilds " << updateMs / numTicks << " ms a tick, full build " << buildMs << " ms\n";
+  std::cout << "  SAH cost built " << refitted.builtCost() << " refit only " << refitted.sahCost() << " refit and rebuild "
+            << updated.sahCost() << " rebuilt " << rebuilt.sahCost() << "\n";
+  auto trace = [&](const char *_name, const BVH4 &_bvh)
+  {
+    size_t hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &r : _rays)
+    {
+      _bvh.traverse(r, FLT_MAX, [&](uint32_t _first, uint32_t _count, float &)
+                    {
+                      for (uint32_t i = _first; i < _first + _count; ++i)
+                      {
+                        uint32_t index = _bvh.primIndex(i);
+                        hits += raySphere(r.m_origin, r.m_dir, centres[index], m_sphereArray[index].getRadius());
+                      }
+                      return false; });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "  " << _name << " " << seconds * 1000.0 << " ms " << _rays.size() / seconds * 1e-6 << " Mrays/s " << hits << " hits\n";
+  };
+  trace("refit only", refitted);
+  trace("refit and rebuild", updated);
+  trace("rebuilt", rebuilt);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkPackets()
+{
+  // primary rays for a 720x576 image from the camera set up in the constructor, stored tile by tile so each
+  // tile is one packet
+  constexpr int imageWidth = 720;
+  constexpr int imageHeight = 576;
+  const ngl::Vec3 eye(0.0f, 0.0f, -25.0f);
+  ngl::Vec3 forward = ngl::Vec3(0.0f, 0.0f, 0.0f) - eye;
+  forward.normalize();
+  ngl::Vec3 right = forward.cross(ngl::Vec3(0.0f, 1.0f, 0.0f));
+  right.normalize();
+  ngl::Vec3 up = right.cross(forward);
+  const float halfHeight = std::tan(ngl::radians(45.0f) * 0.5f);
+  const float halfWidth = halfHeight * imageWidth / imageHeight;
+  auto cameraRays = [&](int _tileSize)
+  {
+    std::vector<Ray> rays;
+    rays.reserve(imageWidth * imageHeight);
+    for (int ty = 0; ty < imageHeight; ty += _tileSize)
+    {
+      for (int tx = 0; tx < imageWidth; tx += _tileSize)
+      {
+        for (int y = ty; y < ty + _tileSize; ++y)
+        {
+          for (int x = tx; x < tx + _tileSize; ++x)
+          {
+            float sx = ((x + 0.5f) / imageWidth * 2.0f - 1.0f) * halfWidth;
+            float sy = (1.0f - (y + 0.5f) / imageHeight * 2.0f) * halfHeight;
+            rays.emplace_back(eye, forward + right * sx + up * sy);
+          }
+        }
+      }
+    }
+    return rays;
+  };
+  std::vector<Ray> randomRays(imageWidth * imageHeight);
+  for (auto &r : randomRays)
+  {
+    ngl::Vec3 from(ngl::Random::randomNumber(12), ngl::Random::randomNumber(10), ngl::Random::randomNumber(12));
+    r = Ray(from, ngl::Random::getRandomVec3());
+  }
+  auto report = [](const char *_name, size_t _numRays, std::chrono::high_resolution_clock::duration _time, size_t _hits)
+  {
+    double seconds = std::chrono::duration<double>(_time).count();
+    std::cout << _name << " " << seconds * 1000.0 << " ms " << _numRays / seconds * 1e-6 << " Mrays/s " << _hits << " hits\n";
+  };
+  const BVH4 &bvh = m_bvh.tree();
+  auto traceSingle = [&](const char *_name, const std::vector<Ray> &_rays)
+  {
+    size_t hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &r : _rays)
+    {
+      bvh.traverse(r, FLT_MAX, [&](uint32_t _first, uint32_t _count, float &)
+                     {
+                       for (uint32_t i = _first; i < _first + _count; ++i)
+                       {
+                         const Sphere &s = m_sphereArray[bvh.primIndex(i)];
+                         hits += raySphere(r.m_origin, r.m_dir, s.getPos(), s.getRadius());
+                       }
+                       return false; });
+    }
+    report(_name, _rays.size(), std::chrono::high_resolution_clock::now() - start, hits);
+  };
+  auto tracePackets = [&](const char *_name, const std::vector<Ray> &_rays, uint32_t _packetSize)
+  {
+    size_t hits = 0;
+    size_t coherent = 0;
+    RayPacket packet;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t first = 0; first < _rays.size(); first += _packetSize)
+    {
+      packet.set(&_rays[first], static_cast<uint32_t>(std::min<size_t>(_packetSize, _rays.size() - first)));
+      coherent += packet.m_coherent;
+      bvh.traverse(packet, [&](uint32_t _first, uint32_t _count, uint64_t _rayMask)
+                     {
+                       RayPacket::forEachRay(_rayMask, [&](uint32_t _r)
+                                             {
+                                               const Ray &r = packet.m_rays[_r];
+                                               for (uint32_t i = _first; i < _first + _count; ++i)
+                                               {
+                                                 const Sphere &s = m_sphereArray[bvh.primIndex(i)];
+                                                 hits += raySphere(r.m_origin, r.m_dir, s.getPos(), s.getRadius());
+                                               } });
+                       return false; });
+    }
+    report(_name, _rays.size(), std::chrono::high_resolution_clock::now() - start, hits);
+    std::cout << "  " << coherent << " of " << (_rays.size() + _packetSize - 1) / _packetSize << " packets coherent\n";
+  };
+  std::cout << "Ray packets " << imageWidth << "x" << imageHeight << " rays\n";
+  std::vector<Ray> rays = cameraRays(8);
+  traceSingle("camera single rays", rays);
+  tracePackets("camera 8x8 packets", rays, 64);
+  rays = cameraRays(4);
+  tracePackets("camera 4x4 packets", rays, 16);
+  traceSingle("random single rays", randomRays);
+  tracePackets("random 8x8 packets", randomRays, 64);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+PixelHit NGLScene::closestHit(const BVH4 &_bvh, const Ray &_ray) const
+{
+  PixelHit pixel;
+  uint32_t closest = 0;
+  _bvh.traverse(_ray, FLT_MAX, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  for (uint32_t i = _first; i < _first + _count; ++i)
+                  {
+                    // nearest root of |o + td - c|^2 = r^2 for a unit length d
+                    const Sphere &s = m_sphereArray[_bvh.primIndex(i)];
+                    ngl::Vec3 oc = _ray.m_origin - s.getPos();
+                    float b = _ray.m_dir.dot(oc);
+                    float discrim = b * b - (oc.dot(oc) - s.getRadius() * s.getRadius());
+                    if (discrim <= 0.0f)
+                    {
+                      continue;
+                    }
+                    float t = -b - std::sqrt(discrim);
+                    if (t > 0.0f && t < io_tMax)
+                    {
+                      io_tMax = t;
+                      closest = _bvh.primIndex(i);
+                      pixel.m_hit = true;
+                      pixel.m_depth = t;
+                    }
+                  }
+                  return false; });
+  if (pixel.m_hit)
+  {
+    pixel.m_normal = (_ray.at(pixel.m_depth) - m_sphereArray[closest].getPos()) / m_sphereArray[closest].getRadius();
+  }
+  return pixel;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool NGLScene::renderImage(int _width, int _height, unsigned int _numThreads, const std::string &_fileName, bool _normals)
+{
+  // same projection resizeGL would set for a window of this size
+  m_project = ngl::perspective(45.0f, static_cast<float>(_width) / _height, 0.05f, 350.0f);
+  TileRenderer renderer(m_view, m_project, _width, _height);
+  // the render threads share one snapshot so a rebuild swapped in part way through can't mix two trees in one image
+  std::shared_ptr<const BVH4> tree = m_bvh.current();
+  const BVH4 &bvh = *tree;
+  double seconds = renderer.render(_numThreads, [this, &bvh](const Ray &_ray)
+                                   { return closestHit(bvh, _ray); });
+  size_t numRays = static_cast<size_t>(renderer.width()) * renderer.height();
+  std::cout << "Rendered " << renderer.width() << "x" << renderer.height() << " " << m_sphereArray.size() << " spheres in "
+            << seconds * 1000.0 << " ms " << numRays / seconds * 1e-6 << " Mrays/s " << renderer.numHits() << " hits\n";
+  bool written = _normals ? renderer.writeNormal(_fileName) : renderer.writeDepth(_fileName);
+  if (!written)
+  {
+    std::cerr << "Unable to write " << _fileName << "\n";
+  }
+  return written;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 void NGLScene::mouseMoveEvent(QMouseEvent *_event)
 {
@@ -426,6 +1172,20 @@ void NGLScene::keyPressEvent(QKeyEvent *_event)
   case Qt::Key_Space:
     m_animate ^= true;
     break;
+  case Qt::Key_B:
+    benchmark();
+    break;
+  case Qt::Key_M:
+    m_moveSpheres ^= true;
+    break;
+  case Qt::Key_BracketLeft:
+    m_optimiseBudget *= 0.5;
+    std::cout << "BVH optimise budget " << m_optimiseBudget << " us\n";
+    break;
+  case Qt::Key_BracketRight:
+    m_optimiseBudget = std::max(m_optimiseBudget * 2.0, 1.0);
+    std::cout << "BVH optimise budget " << m_optimiseBudget << " us\n";
+    break;
 
   default:
     break;
@@ -0,0 +1,88 @@
+#include "RaySorter.h"
+#include <algorithm>
+#include <cmath>
+
+uint64_t RaySorter::spreadBits(uint32_t _v)
+{
+  uint64_t x = _v & 0x3ff;
+  x = (x | (x << 16)) & 0x30000ff;
+  x = (x | (x << 8)) & 0x300f00f;
+  x = (x | (x << 4)) & 0x30c30c3;
+  x = (x | (x << 2)) & 0x9249249;
+  return x;
+}
+
+uint64_t RaySorter::key(const Ray &_ray, const AABB &_bounds)
+{
+  uint32_t origin[3];
+  uint32_t direction[3];
+  float length = _ray.m_dir.length();
+  for (int i = 0; i < 3; ++i)
+  {
+    const float originSteps = (1 << s_originBits) - 1;
+    const float halfSteps = (1 << (s_directionBits - 1)) - 1;
+    float extent = _bounds.m_max[i] - _bounds.m_min[i];
+    float o = extent > 0.0f ? (_ray.m_origin[i] - _bounds.m_min[i]) / extent : 0.0f;
+    origin[i] = static_cast<uint32_t>(std::min(std::max(o, 0.0f), 1.0f) * originSteps);
+    // the top bit is the sign of the component and the bits below it split its half of -1 to 1, so the top bits of
+    // the three axes are the octant and the code still rises with the component
+    float d = length > 0.0f ? _ray.m_dir[i] / length : 0.0f;
+    const bool positive = d >= 0.0f;
+    const float half = positive ? d : d + 1.0f;
+    direction[i] = (positive ? 1u << (s_directionBits - 1) : 0u) | static_cast<uint32_t>(std::min(std::max(half, 0.0f), 1.0f) * halfSteps);
+  }
+  uint64_t originCode = spreadBits(origin[0]) << 2 | spreadBits(origin[1]) << 1 | spreadBits(origin[2]);
+  uint64_t directionCode = spreadBits(direction[0]) << 2 | spreadBits(direction[1]) << 1 | spreadBits(direction[2]);
+  return directionCode << (3 * s_originBits) | originCode;
+}
+
+void RaySorter::sort(const std::vector<Ray> &_rays, const AABB &_bounds)
+{
+  const size_t numRays = _rays.size();
+  m_keys.resize(numRays);
+  m_scratchKeys.resize(numRays);
+  m_order.resize(numRays);
+  m_scratchOrder.resize(numRays);
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    m_keys[i] = key(_rays[i], _bounds);
+    m_order[i] = static_cast<uint32_t>(i);
+  }
+  // least significant digit first radix sort, each pass is a stable counting sort of s_radixBits of the key
+  constexpr int keyBits = 3 * (s_originBits + s_directionBits);
+  constexpr size_t numBuckets = size_t(1) << s_radixBits;
+  std::vector<uint32_t> counts(numBuckets);
+  for (int shift = 0; shift < keyBits; shift += s_radixBits)
+  {
+    std::fill(counts.begin(), counts.end(), 0);
+    for (uint64_t k : m_keys)
+    {
+      ++counts[(k >> shift) & (numBuckets - 1)];
+    }
+    // a digit that is the same for every ray doesn't change the order
+    if (std::find(counts.begin(), counts.end(), numRays) != counts.end())
+    {
+      continue;
+    }
+    uint32_t sum = 0;
+    for (uint32_t &c : counts)
+    {
+      uint32_t count = c;
+      c = sum;
+      sum += count;
+    }
+    for (size_t i = 0; i < numRays; ++i)
+    {
+      uint32_t dest = counts[(m_keys[i] >> shift) & (numBuckets - 1)]++;
+      m_scratchKeys[dest] = m_keys[i];
+      m_scratchOrder[dest] = m_order[i];
+    }
+    m_keys.swap(m_scratchKeys);
+    m_order.swap(m_scratchOrder);
+  }
+  m_sorted.resize(numRays);
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    m_sorted[i] = _rays[m_order[i]];
+  }
+}
@@ -0,0 +1,129 @@
+#include "RaySphereKernel.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RAYSPHEREKERNEL_USE_SSE 1
+#endif
+
+void RaySphereKernel::setSpheres(const std::vector<Sphere> &_spheres)
+{
+  m_sphereX.resize(_spheres.size());
+  m_sphereY.resize(_spheres.size());
+  m_sphereZ.resize(_spheres.size());
+  m_sphereRadius2.resize(_spheres.size());
+  for (size_t i = 0; i < _spheres.size(); ++i)
+  {
+    ngl::Vec3 pos = _spheres[i].getPos();
+    m_sphereX[i] = pos.m_x;
+    m_sphereY[i] = pos.m_y;
+    m_sphereZ[i] = pos.m_z;
+    m_sphereRadius2[i] = _spheres[i].getRadius() * _spheres[i].getRadius();
+  }
+}
+
+void RaySphereKernel::setRays(const std::vector<Ray> &_rays)
+{
+  m_rayX.resize(_rays.size());
+  m_rayY.resize(_rays.size());
+  m_rayZ.resize(_rays.size());
+  m_rayDirX.resize(_rays.size());
+  m_rayDirY.resize(_rays.size());
+  m_rayDirZ.resize(_rays.size());
+  for (size_t i = 0; i < _rays.size(); ++i)
+  {
+    m_rayX[i] = _rays[i].m_origin.m_x;
+    m_rayY[i] = _rays[i].m_origin.m_y;
+    m_rayZ[i] = _rays[i].m_origin.m_z;
+    m_rayDirX[i] = _rays[i].m_dir.m_x;
+    m_rayDirY[i] = _rays[i].m_dir.m_y;
+    m_rayDirZ[i] = _rays[i].m_dir.m_z;
+  }
+}
+
+void RaySphereKernel::setBlockSizes(size_t _rayBlock, size_t _sphereBlock)
+{
+  m_rayBlock = std::max<size_t>(1, _rayBlock);
+  // whole groups of four so only the last tile has a partial group
+  m_sphereBlock = std::max<size_t>(4, (_sphereBlock + 3) & ~size_t(3));
+}
+
+void RaySphereKernel::intersect(std::vector<Hit> &o_hits) const
+{
+  o_hits.clear();
+  for (size_t rayBegin = 0; rayBegin < numRays(); rayBegin += m_rayBlock)
+  {
+    const size_t rayEnd = std::min(rayBegin + m_rayBlock, numRays());
+    for (size_t sphereBegin = 0; sphereBegin < numSpheres(); sphereBegin += m_sphereBlock)
+    {
+      intersectTile(rayBegin, rayEnd, sphereBegin, std::min(sphereBegin + m_sphereBlock, numSpheres()), o_hits);
+    }
+  }
+}
+
+void RaySphereKernel::intersectTile(size_t _rayBegin, size_t _rayEnd, size_t _sphereBegin, size_t _sphereEnd, std::vector<Hit> &io_hits) const
+{
+  for (size_t r = _rayBegin; r < _rayEnd; ++r)
+  {
+    const float ox = m_rayX[r];
+    const float oy = m_rayY[r];
+    const float oz = m_rayZ[r];
+    const float dx = m_rayDirX[r];
+    const float dy = m_rayDirY[r];
+    const float dz = m_rayDirZ[r];
+    const float a = dx * dx + dy * dy + dz * dz;
+    // the discriminant of |o + td - c|^2 = r^2 with b = d.(o-c), it is positive when the line passes through
+    auto addHit = [&](size_t _s, float _b, float _discrim)
+    {
+      io_hits.push_back({static_cast<uint32_t>(r), static_cast<uint32_t>(_s), (-_b - std::sqrt(_discrim)) / a});
+    };
+    size_t s = _sphereBegin;
+#ifdef RAYSPHEREKERNEL_USE_SSE
+    const __m128 ox4 = _mm_set1_ps(ox);
+    const __m128 oy4 = _mm_set1_ps(oy);
+    const __m128 oz4 = _mm_set1_ps(oz);
+    const __m128 dx4 = _mm_set1_ps(dx);
+    const __m128 dy4 = _mm_set1_ps(dy);
+    const __m128 dz4 = _mm_set1_ps(dz);
+    const __m128 a4 = _mm_set1_ps(a);
+    for (; s + 4 <= _sphereEnd; s += 4)
+    {
+      const __m128 ocx = _mm_sub_ps(ox4, _mm_loadu_ps(&m_sphereX[s]));
+      const __m128 ocy = _mm_sub_ps(oy4, _mm_loadu_ps(&m_sphereY[s]));
+      const __m128 ocz = _mm_sub_ps(oz4, _mm_loadu_ps(&m_sphereZ[s]));
+      const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx4, ocx), _mm_mul_ps(dy4, ocy)), _mm_mul_ps(dz4, ocz));
+      const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)),
+                                  _mm_loadu_ps(&m_sphereRadius2[s]));
+      const __m128 discrim = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a4, c));
+      const int mask = _mm_movemask_ps(_mm_cmpgt_ps(discrim, _mm_setzero_ps()));
+      if (mask != 0)
+      {
+        alignas(16) float bs[4];
+        alignas(16) float ds[4];
+        _mm_store_ps(bs, b);
+        _mm_store_ps(ds, discrim);
+        for (int lane = 0; lane < 4; ++lane)
+        {
+          if (mask & (1 << lane))
+          {
+            addHit(s + lane, bs[lane], ds[lane]);
+          }
+        }
+      }
+    }
+#endif
+    for (; s < _sphereEnd; ++s)
+    {
+      const float ocx = ox - m_sphereX[s];
+      const float ocy = oy - m_sphereY[s];
+      const float ocz = oz - m_sphereZ[s];
+      const float b = dx * ocx + dy * ocy + dz * ocz;
+      const float discrim = b * b - a * (ocx * ocx + ocy * ocy + ocz * ocz - m_sphereRadius2[s]);
+      if (discrim > 0.0f)
+      {
+        addHit(s, b, discrim);
+      }
+    }
+  }
+}
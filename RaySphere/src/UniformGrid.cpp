@@ -0,0 +1,117 @@
+#include "UniformGrid.h"
+
+void UniformGrid::build(const std::vector<AABB> &_bounds, float _cellsPerPrim)
+{
+  m_bounds = AABB();
+  m_numPrims = static_cast<uint32_t>(_bounds.size());
+  m_res[0] = m_res[1] = m_res[2] = 0;
+  m_cellStart.clear();
+  m_cellPrims.clear();
+  if (_bounds.empty())
+  {
+    return;
+  }
+  float meanSide = 0.0f;
+  for (const AABB &b : _bounds)
+  {
+    m_bounds.extend(b);
+    const ngl::Vec3 size = b.m_max - b.m_min;
+    meanSide += (size.m_x + size.m_y + size.m_z) / 3.0f;
+  }
+  meanSide /= m_numPrims;
+  // cube shaped cells sized to give about _cellsPerPrim cells for each primitive, a flat axis gets one cell. When
+  // an axis hits the resolution limit the cells it would have had are shared out over the other axes again.
+  // Cells much smaller than the primitives only put each primitive in more cells so they are kept above a fraction
+  // of the mean primitive size
+  const ngl::Vec3 extent = m_bounds.m_max - m_bounds.m_min;
+  bool fixed[3] = {false, false, false};
+  for (int a = 0; a < 3; ++a)
+  {
+    if (!(extent[a] > 0.0f))
+    {
+      m_res[a] = 1;
+      fixed[a] = true;
+    }
+  }
+  for (int pass = 0; pass < 3; ++pass)
+  {
+    float volume = 1.0f;
+    float cells = _cellsPerPrim * m_numPrims;
+    int numFree = 0;
+    for (int a = 0; a < 3; ++a)
+    {
+      if (fixed[a])
+      {
+        cells /= m_res[a];
+      }
+      else
+      {
+        volume *= extent[a];
+        ++numFree;
+      }
+    }
+    if (numFree == 0)
+    {
+      break;
+    }
+    const float cellSide = std::max(std::pow(volume / std::max(cells, 1.0f), 1.0f / numFree), meanSide * s_minCellSize);
+    bool capped = false;
+    for (int a = 0; a < 3; ++a)
+    {
+      if (!fixed[a])
+      {
+        m_res[a] = std::max(static_cast<int>(std::ceil(extent[a] / cellSide)), 1);
+        if (m_res[a] >= s_maxResolution)
+        {
+          m_res[a] = s_maxResolution;
+          fixed[a] = capped = true;
+        }
+      }
+    }
+    if (!capped)
+    {
+      break;
+    }
+  }
+  for (int a = 0; a < 3; ++a)
+  {
+    m_cellSize[a] = extent[a] > 0.0f ? extent[a] / m_res[a] : 1.0f;
+    m_invCellSize[a] = 1.0f / m_cellSize[a];
+  }
+
+  // counting sort of the primitives into the cells they overlap, first count each cell then fill the lists in
+  // primitive order so a cell's list is sorted
+  m_cellStart.assign(numCells() + 1, 0);
+  auto forEachCell = [this](const AABB &_b, auto &&_func)
+  {
+    const int x0 = cellCoord(_b.m_min.m_x, 0), x1 = cellCoord(_b.m_max.m_x, 0);
+    const int y0 = cellCoord(_b.m_min.m_y, 1), y1 = cellCoord(_b.m_max.m_y, 1);
+    const int z0 = cellCoord(_b.m_min.m_z, 2), z1 = cellCoord(_b.m_max.m_z, 2);
+    for (int z = z0; z <= z1; ++z)
+    {
+      for (int y = y0; y <= y1; ++y)
+      {
+        for (int x = x0; x <= x1; ++x)
+        {
+          _func(cellIndex(x, y, z));
+        }
+      }
+    }
+  };
+  for (const AABB &b : _bounds)
+  {
+    forEachCell(b, [this](uint32_t _cell)
+                { ++m_cellStart[_cell + 1]; });
+  }
+  for (size_t c = 1; c < m_cellStart.size(); ++c)
+  {
+    m_cellStart[c] += m_cellStart[c - 1];
+  }
+  m_cellPrims.resize(m_cellStart.back());
+  std::vector<uint32_t> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+  for (uint32_t i = 0; i < m_numPrims; ++i)
+  {
+    forEachCell(_bounds[i], [this, &fill, i](uint32_t _cell)
+                { m_cellPrims[fill[_cell]++] = i; });
+  }
+}
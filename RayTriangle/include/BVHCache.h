@@ -0,0 +1,91 @@
+#ifndef BVHCACHE_H_
+#define BVHCACHE_H_
+
+#include <cstdint>
+#include <string>
+#include "BVH4.h"
+#include "IndexedMesh.h"
+#include "MappedFile.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file BVHCache.h
+/// @brief keeps the BVH of a mesh on disk so it is only built the first time the mesh is used. The file is a
+/// small header followed by the nodes and the primitive index array exactly as BVH4 uses them. Child and leaf
+/// references are array indices rather than pointers so the file can be memory mapped anywhere and traversed in
+/// place without being copied or parsed.
+/// The header stores a format version, the node size, the byte order and a hash of the mesh. A file that doesn't
+/// match the mesh, was written by another version or fails the range checks is treated as stale and the tree
+/// is rebuilt and written again. Loading still touches every byte once: loadOrBuild() hashes the whole mesh to
+/// compare with the header, and load() checks every child reference, the tree depth and every primitive index so
+/// a bad file can't send the traversal outside the mapping or past the end of its stack. That is a single pass at
+/// memory speed, far quicker than a build.
+//----------------------------------------------------------------------------------------------------------------------
+class BVHCache
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bump this whenever the file layout or the build changes so old files are rebuilt
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr uint32_t s_version = 1;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief load the tree for _mesh from _fileName, or build it and write the file if it is missing or stale
+  /// @param o_bvh attached to the mapped file or built in memory, it is only valid while this cache is alive
+  /// @returns true if the tree came from the file
+  //----------------------------------------------------------------------------------------------------------------------
+  bool loadOrBuild(const std::string &_fileName, const IndexedMesh &_mesh, BVH4 &o_bvh, uint32_t _maxLeafSize = 4);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief map _fileName and attach o_bvh to it if it was written for a mesh with this hash and triangle count
+  /// @returns false if the file is missing or stale, o_bvh is left alone
+  //----------------------------------------------------------------------------------------------------------------------
+  bool load(const std::string &_fileName, uint64_t _meshHash, uint32_t _numTriangles, uint32_t _maxLeafSize, BVH4 &o_bvh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief write the tree, the file is written under a temporary name and renamed so a reader never sees half a file
+  //----------------------------------------------------------------------------------------------------------------------
+  static bool write(const std::string &_fileName, uint64_t _meshHash, const BVH4 &_bvh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief hash of the vertex positions and indices
+  //----------------------------------------------------------------------------------------------------------------------
+  static uint64_t meshHash(const IndexedMesh &_mesh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief seconds taken by the last loadOrBuild and why the file wasn't used if it wasn't
+  //----------------------------------------------------------------------------------------------------------------------
+  double loadTime() const { return m_loadTime; }
+  const std::string &staleReason() const { return m_staleReason; }
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the start of the file, the arrays follow at the given offsets from the start of the file
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Header
+  {
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_byteOrder;
+    uint32_t m_nodeSize;
+    uint32_t m_maxLeafSize;
+    uint64_t m_meshHash;
+    uint64_t m_fileSize;
+    uint64_t m_nodeOffset;
+    uint64_t m_primOffset;
+    uint32_t m_numNodes;
+    uint32_t m_numPrims;
+    float m_bounds[6];
+    uint64_t m_headerHash;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the arrays start on a cache line boundary so the mapped nodes keep their alignment
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr uint64_t s_alignment = 64;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the first bytes of every cache file, and a value that reads differently on a machine of the other
+  /// byte order
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr char s_magic[8] = {'N', 'G', 'L', 'B', 'V', 'H', '4', '\0'};
+  static constexpr uint32_t s_byteOrder = 0x01020304;
+  static uint64_t hashBytes(const void *_data, size_t _size, uint64_t _hash);
+  MappedFile m_file;
+  double m_loadTime = 0.0;
+  std::string m_staleReason;
+};
+
+#endif
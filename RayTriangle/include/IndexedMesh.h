@@ -0,0 +1,100 @@
+#ifndef INDEXEDMESH_H_
+#define INDEXEDMESH_H_
+
+#include <ngl/Vec3.h>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "BVH4.h"
+#include "TriAccel.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file IndexedMesh.h
+/// @brief a triangle mesh stored as a shared vertex array and a 32 bit index buffer. The positions are kept as a
+/// structure of arrays so a loader can fill each component with straight stores, and each triangle is three
+/// indices so a vertex shared by several triangles is only stored once. The ray queries and the drawing both work
+/// on these arrays directly so a large mesh doesn't need a record or a VAO per triangle.
+//----------------------------------------------------------------------------------------------------------------------
+struct IndexedMesh
+{
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the vertex positions one component per array
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_x;
+  std::vector<float> m_y;
+  std::vector<float> m_z;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief three vertex indices per triangle
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_indices;
+  size_t numVertices() const { return m_x.size(); }
+  size_t numTriangles() const { return m_indices.size() / 3; }
+  ngl::Vec3 vertex(uint32_t _index) const { return ngl::Vec3(m_x[_index], m_y[_index], m_z[_index]); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief corner _corner (0..2) of triangle _tri
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 corner(size_t _tri, int _corner) const { return vertex(m_indices[_tri * 3 + _corner]); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief size the arrays, the contents are left for the caller to fill in
+  //----------------------------------------------------------------------------------------------------------------------
+  void resize(size_t _numVertices, size_t _numTriangles)
+  {
+    m_x.resize(_numVertices);
+    m_y.resize(_numVertices);
+    m_z.resize(_numVertices);
+    m_indices.resize(_numTriangles * 3);
+  }
+  uint32_t addVertex(const ngl::Vec3 &_p)
+  {
+    m_x.push_back(_p.m_x);
+    m_y.push_back(_p.m_y);
+    m_z.push_back(_p.m_z);
+    return static_cast<uint32_t>(m_x.size() - 1);
+  }
+  void addTriangle(uint32_t _i0, uint32_t _i1, uint32_t _i2)
+  {
+    m_indices.push_back(_i0);
+    m_indices.push_back(_i1);
+    m_indices.push_back(_i2);
+  }
+  void clear()
+  {
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_indices.clear();
+  }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief unit normal of triangle _tri from its winding
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 faceNormal(size_t _tri) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the positions as packed xyz for a vertex buffer
+  //----------------------------------------------------------------------------------------------------------------------
+  void interleavedPositions(std::vector<ngl::Vec3> &o_positions) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief per vertex normals, the sum of the face normals around each vertex weighted by face area
+  //----------------------------------------------------------------------------------------------------------------------
+  void vertexNormals(std::vector<ngl::Vec3> &o_normals) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief Moller-Trumbore test of triangle _tri read straight from the shared vertices, the edges are worked out
+  /// for each test rather than stored so nothing extra is kept per triangle. Queries through a BVH use the
+  /// closestHit() and occluded() templates in TriAccel.h.
+  /// @returns true if the ray hit the triangle closer than _tMax, o_hit is only written on a hit
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersect(const Ray &_ray, uint32_t _tri, float _tMax, TriHit &o_hit) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bytes used by the vertex and index arrays
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t memoryUsage() const { return (m_x.capacity() + m_y.capacity() + m_z.capacity()) * sizeof(float) + m_indices.capacity() * sizeof(uint32_t); }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool IndexedMesh::intersect(const Ray &_ray, uint32_t _tri, float _tMax, TriHit &o_hit) const
+{
+  const uint32_t *index = &m_indices[static_cast<size_t>(_tri) * 3];
+  return intersectTriangle(_ray, vertex(index[0]), vertex(index[1]), vertex(index[2]), _tri, _tMax, o_hit);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MappedFile.h
+/// @brief read only view of a whole file. On POSIX systems the file is memory mapped so pages are only read from
+/// disk as they are touched and are shared with the page cache, elsewhere the file is read into memory.
+//----------------------------------------------------------------------------------------------------------------------
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief how the mapping will be read, passed on to the kernel so it reads ahead for a file parsed front to back
+  /// and doesn't for one that is jumped around in
+  //----------------------------------------------------------------------------------------------------------------------
+  enum class Access
+  {
+    Sequential,
+    Random
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief map the file, any file already open is closed first
+  /// @returns false if the file couldn't be opened
+  //----------------------------------------------------------------------------------------------------------------------
+  bool open(const std::string &_fileName, Access _access = Access::Sequential);
+  void close();
+  bool isOpen() const { return m_data != nullptr; }
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief holds the contents when the file can't be mapped
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<char> m_buffer;
+  bool m_mapped = false;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef MESHLOADER_H_
+#define MESHLOADER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "IndexedMesh.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file MeshLoader.h
+/// @brief loads large Wavefront OBJ and binary PLY meshes straight into an IndexedMesh. The file is memory mapped
+/// and split into chunks that are parsed on a pool of threads. OBJ chunks are parsed twice, once to count the
+/// vertices and triangles so every chunk knows where its output goes, and again to write them, so the arrays
+/// are sized once and nothing is copied afterwards. Only positions and faces are read, polygons are split into
+/// triangle fans and negative (relative) OBJ indices are supported.
+//----------------------------------------------------------------------------------------------------------------------
+class MeshLoader
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @param _numThreads threads to parse with, 0 uses one per hardware thread
+  //----------------------------------------------------------------------------------------------------------------------
+  explicit MeshLoader(unsigned int _numThreads = 0);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief load a .obj or .ply file, the format is picked from the extension
+  /// @param o_mesh replaced by the mesh in the file
+  /// @returns false if the file couldn't be read, error() says why
+  //----------------------------------------------------------------------------------------------------------------------
+  bool load(const std::string &_fileName, IndexedMesh &o_mesh);
+  const std::string &error() const { return m_error; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief seconds taken by the last load including mapping the file
+  //----------------------------------------------------------------------------------------------------------------------
+  double loadTime() const { return m_loadTime; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the most resident memory the process has used so far in bytes, 0 where it can't be queried
+  //----------------------------------------------------------------------------------------------------------------------
+  static size_t peakMemoryUsage();
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the PLY scalar types in the order of their names in the header
+  //----------------------------------------------------------------------------------------------------------------------
+  enum class PlyType : uint8_t
+  {
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief one property of a PLY element, a list stores a count of m_countType followed by that many m_type
+  //----------------------------------------------------------------------------------------------------------------------
+  struct PlyProperty
+  {
+    std::string m_name;
+    PlyType m_type = PlyType::Float32;
+    PlyType m_countType = PlyType::UInt8;
+    bool m_list = false;
+  };
+  struct PlyElement
+  {
+    std::string m_name;
+    size_t m_count = 0;
+    std::vector<PlyProperty> m_properties;
+  };
+  static size_t plySize(PlyType _type);
+  static bool parsePlyType(const std::string &_name, PlyType &o_type);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief read one unaligned value, _swap reverses the bytes for files in the other byte order
+  //----------------------------------------------------------------------------------------------------------------------
+  static double readPly(const char *_p, PlyType _type, bool _swap);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief text parsing that stops at _end as the mapped file isn't null terminated, the parse functions return
+  /// the character after the number or nullptr if there is no number
+  //----------------------------------------------------------------------------------------------------------------------
+  static const char *skipSpace(const char *_p, const char *_end);
+  static const char *parseInt(const char *_p, const char *_end, long long &o_value);
+  static const char *parseFloat(const char *_p, const char *_end, float &o_value);
+  bool loadOBJ(const char *_data, size_t _size, IndexedMesh &o_mesh);
+  bool loadPLY(const char *_data, size_t _size, IndexedMesh &o_mesh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief split the text into about _numChunks pieces that start and end on line boundaries
+  //----------------------------------------------------------------------------------------------------------------------
+  static std::vector<const char *> splitLines(const char *_data, size_t _size, size_t _numChunks);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief call _func(i) for every i in 0.._count-1 on the thread pool, each thread takes the next index from a
+  /// shared counter
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename Func>
+  void parallelFor(size_t _count, Func &&_func) const;
+  unsigned int m_numThreads;
+  std::string m_error;
+  double m_loadTime = 0.0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Func>
+void MeshLoader::parallelFor(size_t _count, Func &&_func) const
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&]()
+  {
+    for (size_t i = next++; i < _count; i = next++)
+    {
+      _func(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  const size_t numThreads = std::min<size_t>(m_numThreads, _count);
+  for (size_t i = 1; i < numThreads; ++i)
+  {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+}
+
+#endif
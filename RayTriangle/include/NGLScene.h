@@ -1,10 +1,17 @@
 #ifndef NGLSCENE_H_
 #define NGLSCENE_H_
 #include <ngl/Transformation.h>
+#include <ngl/AbstractVAO.h>
 #include <QOpenGLWindow>
 #include "WindowParams.h"
 #include "Triangle.h"
+#include "BVH4.h"
+#include "TriangleSoA.h"
+#include "IndexedMesh.h"
+#include "BVHCache.h"
+#include <cfloat>
 #include <memory>
+#include <string>
 //----------------------------------------------------------------------------------------------------------------------
 /// @file NGLScene.h
 /// @brief this class inherits from the Qt OpenGLWindow and allows us to use NGL to draw OpenGL
@@ -23,9 +30,11 @@ class NGLScene : public QOpenGLWindow
   public:
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief ctor for our NGL drawing class
-    /// @param [in] parent the parent window to the class
+    /// @param _numTriangles the number of random triangles to make when no mesh is loaded
+    /// @param _meshFile an OBJ or binary PLY file to use instead of the random triangles, if it can't be loaded the
+    /// random triangles are used
     //----------------------------------------------------------------------------------------------------------------------
-    NGLScene(int _numTriangles);
+    NGLScene(int _numTriangles, const std::string &_meshFile = std::string());
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief dtor must close down ngl and release OpenGL resources
     //----------------------------------------------------------------------------------------------------------------------
@@ -43,6 +52,15 @@ class NGLScene : public QOpenGLWindow
     /// @brief this is called everytime we resize
     //----------------------------------------------------------------------------------------------------------------------
     void resizeGL(int _w, int _h);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief cast one ray per pixel through the camera on several threads and write the depth or normals, this
+    /// needs no GL context so it can be used without showing the window
+    /// @param _numThreads threads to use, 0 for one per hardware thread
+    /// @param _fileName the image to write, .pfm for floats anything else for an 8 bit PPM
+    /// @param _normals write the normals instead of the depth
+    /// @returns false if the image couldn't be written
+    //----------------------------------------------------------------------------------------------------------------------
+    bool renderImage(int _width, int _height, unsigned int _numThreads, const std::string &_fileName, bool _normals);
 
 private:
     //----------------------------------------------------------------------------------------------------------------------
@@ -70,6 +88,31 @@ private:
     std::vector<std::unique_ptr<Triangle>> m_triangleArray;
     /// @brief number of spheres
     int m_numTriangles;
+    /// @brief above this many triangles, or for a loaded mesh, the mesh is drawn from one indexed VAO rather than a
+    /// Triangle object each
+    static constexpr size_t s_maxTriangleObjects = 10000;
+    /// @brief the whole mesh as one vertex, normal and 32 bit index buffer, only made when m_triangleArray isn't
+    std::unique_ptr<ngl::AbstractVAO> m_meshVAO;
+    bool drawTriangleObjects() const { return !m_meshFromFile && m_mesh.numTriangles() <= s_maxTriangleObjects; }
+    /// @brief the triangles as shared vertices and indices, either random or loaded from a file
+    IndexedMesh m_mesh;
+    /// @brief true if m_mesh came from a file, the drawable triangles are only made for the random triangles
+    bool m_meshFromFile = false;
+    /// @brief the benchmarks are set up for the random triangles around the origin, a loaded mesh is fitted into
+    /// the same view by scaling about its centre
+    ngl::Vec3 m_sceneCentre;
+    float m_sceneScale = 1.0f;
+    ngl::Vec3 toScene(const ngl::Vec3 &_p) const { return m_sceneCentre + _p * m_sceneScale; }
+    /// @brief read only copies of the random triangles for comparing query structures, a loaded mesh is queried
+    /// straight from m_mesh and these stay empty
+    std::vector<TriAccel> m_triAccel;
+    /// @brief holds the mapped BVH file of a loaded mesh, m_bvh points into it
+    BVHCache m_bvhCache;
+    /// @brief four wide BVH over the triangles so the ray only tests the ones it can reach
+    BVH4 m_bvh;
+    /// @brief the random triangles again in SoA blocks stored in the BVH leaf order, empty for a loaded mesh
+    TriangleSoA m_triSoA;
+    bool hasTriangleRecords() const { return !m_triAccel.empty(); }
     ngl::Vec3 m_rayStart;
     ngl::Vec3 m_rayEnd;
     //----------------------------------------------------------------------------------------------------------------------
@@ -81,6 +124,52 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void loadMatricesToColourShader();
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief make m_meshVAO from m_mesh
+    //----------------------------------------------------------------------------------------------------------------------
+    void createMeshVAO();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief draw m_mesh with one call then outline the triangles the ray passes through and mark the hits
+    //----------------------------------------------------------------------------------------------------------------------
+    void drawMesh();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief print the bytes per triangle of the drawable Triangle objects and of the indexed mesh
+    //----------------------------------------------------------------------------------------------------------------------
+    void reportMemory() const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time closest hit queries for a batch of random rays using the brute force loop and the BVH
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmark();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time closest hits for camera rays in 4x4 and 8x8 packets against single rays, and the same for random
+    /// rays that can't be traced as packets
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkPackets();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief closest hit through m_bvh, from the SoA blocks for the random triangles or the shared vertices for a
+    /// loaded mesh
+    //----------------------------------------------------------------------------------------------------------------------
+    TriHit closestSceneHit(const Ray &_ray, float _tMax = FLT_MAX) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief the leaf test of closestSceneHit() for leaf primitives _first to _first + _count
+    /// @returns true if a triangle was hit closer than _tMax, o_hit is only written on a hit
+    //----------------------------------------------------------------------------------------------------------------------
+    bool intersectLeaf(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief place the triangles as one mesh many times in a two level BVH and time the top level rebuild and ray
+    /// queries, and compare the memory with copying every instance into world space
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkInstances();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief compress the mesh to 16 bit positions and octahedral normals, measure the error and compare the ray
+    /// throughput and memory with the float mesh
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkQuantised(const std::vector<Ray> &_rays);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief jitter a copy of the mesh for a number of ticks and compare refitting the BVH each tick, refitting
+    /// with a rebuild when the tree has got too bad, and building it from scratch
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkRefit(const std::vector<Ray> &_rays);
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief Qt Event called when a key is pressed
     /// @param [in] _event the Qt event to query for size etc
     //----------------------------------------------------------------------------------------------------------------------
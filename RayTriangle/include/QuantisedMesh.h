@@ -0,0 +1,108 @@
+#ifndef QUANTISEDMESH_H_
+#define QUANTISEDMESH_H_
+
+#include <ngl/Vec3.h>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "BVH4.h"
+#include "TriAccel.h"
+#include "IndexedMesh.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file QuantisedMesh.h
+/// @brief a compressed copy of an IndexedMesh for very large scenes. Each position is stored as three 16 bit
+/// steps across the mesh bounds (6 bytes against 12) and each vertex normal as a 16 bit pair of octahedral
+/// coordinates (4 bytes against 12), the indices are kept as they are. The intersection test decodes the three
+/// corners as it goes, the edges are worked out from the integer steps so they are exact on the quantised grid.
+/// The decoded triangles move by up to maxError() so the BVH used with this mesh must be built from
+/// triangleBounds() rather than from the original positions.
+//----------------------------------------------------------------------------------------------------------------------
+class QuantisedMesh
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief quantise the positions of _mesh to its bounds and encode its area weighted vertex normals
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(const IndexedMesh &_mesh);
+  size_t numVertices() const { return m_positions.size(); }
+  size_t numTriangles() const { return m_indices.size() / 3; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief decoded position and unit normal of vertex _index
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 vertex(uint32_t _index) const;
+  ngl::Vec3 normal(uint32_t _index) const { return decodeNormal(m_normals[_index]); }
+  ngl::Vec3 corner(size_t _tri, int _corner) const { return vertex(m_indices[_tri * 3 + _corner]); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the normal at a hit blended from the vertex normals with the hit's barycentric coordinates
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 shadingNormal(const TriHit &_hit) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bounds of each decoded triangle for building the BVH
+  //----------------------------------------------------------------------------------------------------------------------
+  void triangleBounds(std::vector<AABB> &o_bounds) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the furthest a decoded position can be from the original, half a step on each axis plus the float
+  /// rounding of the decode
+  //----------------------------------------------------------------------------------------------------------------------
+  float maxError() const { return m_step.length() * 0.5f + (m_origin.length() + m_step.length() * s_steps) * FLT_EPSILON; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief Moller-Trumbore test of triangle _tri with the corners decoded on the fly, through the BVH with the
+  /// closestHit() and occluded() templates in TriAccel.h
+  /// @returns true if the ray hit the triangle closer than _tMax, o_hit is only written on a hit
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersect(const Ray &_ray, uint32_t _tri, float _tMax, TriHit &o_hit) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bytes used by the positions, normals and indices
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t memoryUsage() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief octahedral encoding of a unit vector, the direction is projected onto the octahedron |x|+|y|+|z|=1,
+  /// the lower half is folded over the upper and x and y are kept as 16 bit signed values
+  //----------------------------------------------------------------------------------------------------------------------
+  static uint32_t encodeNormal(const ngl::Vec3 &_n);
+  static ngl::Vec3 decodeNormal(uint32_t _code);
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a position as steps of m_step from m_origin, kept together so one vertex is one read
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Position
+  {
+    uint16_t m_x;
+    uint16_t m_y;
+    uint16_t m_z;
+  };
+  static constexpr float s_steps = 65535.0f;
+  ngl::Vec3 m_origin;
+  ngl::Vec3 m_step;
+  std::vector<Position> m_positions;
+  std::vector<uint32_t> m_normals;
+  std::vector<uint32_t> m_indices;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+inline ngl::Vec3 QuantisedMesh::vertex(uint32_t _index) const
+{
+  const Position &p = m_positions[_index];
+  return ngl::Vec3(m_origin.m_x + p.m_x * m_step.m_x, m_origin.m_y + p.m_y * m_step.m_y, m_origin.m_z + p.m_z * m_step.m_z);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool QuantisedMesh::intersect(const Ray &_ray, uint32_t _tri, float _tMax, TriHit &o_hit) const
+{
+  const uint32_t *index = &m_indices[static_cast<size_t>(_tri) * 3];
+  const Position &p0 = m_positions[index[0]];
+  const Position &p1 = m_positions[index[1]];
+  const Position &p2 = m_positions[index[2]];
+  const ngl::Vec3 v0(m_origin.m_x + p0.m_x * m_step.m_x, m_origin.m_y + p0.m_y * m_step.m_y, m_origin.m_z + p0.m_z * m_step.m_z);
+  // the step differences are exact integers so each edge is rounded once rather than taking the error of two decodes
+  const ngl::Vec3 edge1((static_cast<int>(p1.m_x) - p0.m_x) * m_step.m_x, (static_cast<int>(p1.m_y) - p0.m_y) * m_step.m_y,
+                        (static_cast<int>(p1.m_z) - p0.m_z) * m_step.m_z);
+  const ngl::Vec3 edge2((static_cast<int>(p2.m_x) - p0.m_x) * m_step.m_x, (static_cast<int>(p2.m_y) - p0.m_y) * m_step.m_y,
+                        (static_cast<int>(p2.m_z) - p0.m_z) * m_step.m_z);
+  return intersectEdges(_ray, v0, edge1, edge2, _tri, _tMax, o_hit);
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef TRIACCEL_H_
+#define TRIACCEL_H_
+
+#include <ngl/Vec3.h>
+#include <cfloat>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Ray.h"
+#include "BVH4.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TriAccel.h
+/// @brief a compact read only triangle record for ray queries. Everything the Moller-Trumbore test needs is
+/// worked out once when the record is made, and the intersection routines only read the record and write the
+/// result into a hit record owned by the caller, so they can be used from several threads at once.
+/// The test used is picked at compile time with a mode parameter, MollerTrumbore is the fast test with
+/// tolerances and Watertight is the Woop, Benthin and Wald test which never lets a ray slip between two
+/// triangles that share an edge.
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the result of a ray triangle query
+//----------------------------------------------------------------------------------------------------------------------
+struct TriHit
+{
+  static constexpr uint32_t s_noHit = 0xffffffff;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief distance along the ray direction
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_t = FLT_MAX;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief barycentric coordinates of the hit, the weights of v1 and v2
+  //----------------------------------------------------------------------------------------------------------------------
+  float m_u = 0.0f;
+  float m_v = 0.0f;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief index of the triangle hit or s_noHit
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t m_triIndex = s_noHit;
+  bool isHit() const { return m_triIndex != s_noHit; }
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the Moller-Trumbore test shared by TriAccel and the mesh types, with the tolerances they all use so they
+/// give the same hits
+/// @param _v0 _v1 _v2 the corners, or for intersectEdges() the first corner and the two edges leaving it
+/// @returns true if the ray hit the triangle closer than _tMax, o_hit is only written on a hit
+//----------------------------------------------------------------------------------------------------------------------
+bool intersectEdges(const Ray &_ray, const ngl::Vec3 &_v0, const ngl::Vec3 &_edge1, const ngl::Vec3 &_edge2, uint32_t _triIndex,
+                    float _tMax, TriHit &o_hit);
+bool intersectTriangle(const Ray &_ray, const ngl::Vec3 &_v0, const ngl::Vec3 &_v1, const ngl::Vec3 &_v2, uint32_t _triIndex,
+                       float _tMax, TriHit &o_hit);
+
+struct TriAccel
+{
+  TriAccel() = default;
+  TriAccel(const ngl::Vec3 &_v0, const ngl::Vec3 &_v1, const ngl::Vec3 &_v2);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief test the ray against the triangle, the hit is only recorded if it is closer than _tMax
+  /// @param _ray the ray to test
+  /// @param _triIndex the index written into the hit record
+  /// @param _tMax the furthest distance to accept
+  /// @param o_hit filled in when there is a hit
+  /// @returns true if the ray hit the triangle closer than _tMax
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersect(const Ray &_ray, uint32_t _triIndex, float _tMax, TriHit &o_hit) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief first vertex and the two edges leaving it
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_v0;
+  ngl::Vec3 m_edge1;
+  ngl::Vec3 m_edge2;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief unit face normal
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 m_normal;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief triangle record for the watertight test, the test needs the exact vertex positions so that
+/// two triangles sharing an edge evaluate it in exactly the same way
+//----------------------------------------------------------------------------------------------------------------------
+struct WatertightTri
+{
+  WatertightTri() = default;
+  WatertightTri(const ngl::Vec3 &_v0, const ngl::Vec3 &_v1, const ngl::Vec3 &_v2) : m_v0(_v0), m_v1(_v1), m_v2(_v2) {}
+  ngl::Vec3 m_v0;
+  ngl::Vec3 m_v1;
+  ngl::Vec3 m_v2;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief per ray values for the watertight test, the ray is sheared so it points down +z and the triangle
+/// test becomes a 2D edge function test
+//----------------------------------------------------------------------------------------------------------------------
+struct WatertightRay
+{
+  explicit WatertightRay(const Ray &_ray);
+  ngl::Vec3 m_origin;
+  int m_kx;
+  int m_ky;
+  int m_kz;
+  float m_sx;
+  float m_sy;
+  float m_sz;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the modes used to choose the ray triangle test at compile time. Each mode names the triangle record
+/// it works on, the per ray data it needs and the test itself.
+//----------------------------------------------------------------------------------------------------------------------
+struct MollerTrumbore
+{
+  using Record = TriAccel;
+  using RayData = Ray;
+  static bool intersect(const Record &_tri, const RayData &_ray, uint32_t _triIndex, float _tMax, TriHit &o_hit)
+  {
+    return _tri.intersect(_ray, _triIndex, _tMax, o_hit);
+  }
+};
+
+struct Watertight
+{
+  using Record = WatertightTri;
+  using RayData = WatertightRay;
+  static bool intersect(const Record &_tri, const RayData &_ray, uint32_t _triIndex, float _tMax, TriHit &o_hit);
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief closest hit of one ray against every triangle in the array
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mode = MollerTrumbore>
+TriHit closestHit(const std::vector<typename Mode::Record> &_tris, const Ray &_ray, float _tMax = FLT_MAX)
+{
+  const typename Mode::RayData ray(_ray);
+  TriHit hit;
+  hit.m_t = _tMax;
+  for (uint32_t i = 0; i < _tris.size(); ++i)
+  {
+    // each hit shortens the ray so only closer triangles can replace it
+    Mode::intersect(_tris[i], ray, i, hit.m_t, hit);
+  }
+  return hit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief closest hit of a batch of rays against every triangle in the array, o_hits is resized to match _rays
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mode = MollerTrumbore>
+void closestHits(const std::vector<typename Mode::Record> &_tris, const std::vector<Ray> &_rays, std::vector<TriHit> &o_hits)
+{
+  o_hits.resize(_rays.size());
+  for (size_t i = 0; i < _rays.size(); ++i)
+  {
+    o_hits[i] = closestHit<Mode>(_tris, _rays[i]);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief closest hit of one ray through a BVH built over the triangles in the array
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mode = MollerTrumbore>
+TriHit closestHit(const BVH4 &_bvh, const std::vector<typename Mode::Record> &_tris, const Ray &_ray, float _tMax = FLT_MAX)
+{
+  const typename Mode::RayData ray(_ray);
+  TriHit hit;
+  _bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  for (uint32_t i = _first; i < _first + _count; ++i)
+                  {
+                    uint32_t id = _bvh.primIndex(i);
+                    if (Mode::intersect(_tris[id], ray, id, io_tMax, hit))
+                    {
+                      io_tMax = hit.m_t;
+                    }
+                  }
+                  return false; });
+  return hit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief is anything on the ray between 0 and _tMax, the loop stops at the first triangle hit
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mode = MollerTrumbore>
+bool occluded(const std::vector<typename Mode::Record> &_tris, const Ray &_ray, float _tMax)
+{
+  const typename Mode::RayData ray(_ray);
+  TriHit hit;
+  for (uint32_t i = 0; i < _tris.size(); ++i)
+  {
+    if (Mode::intersect(_tris[i], ray, i, _tMax, hit))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief is anything on the ray between 0 and _tMax, the traversal stops at the first triangle hit
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mode = MollerTrumbore>
+bool occluded(const BVH4 &_bvh, const std::vector<typename Mode::Record> &_tris, const Ray &_ray, float _tMax)
+{
+  const typename Mode::RayData ray(_ray);
+  bool blocked = false;
+  _bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  TriHit hit;
+                  for (uint32_t i = _first; i < _first + _count && !blocked; ++i)
+                  {
+                    uint32_t id = _bvh.primIndex(i);
+                    blocked = Mode::intersect(_tris[id], ray, id, io_tMax, hit);
+                  }
+                  return blocked; });
+  return blocked;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief closest hit of one ray through a BVH over a mesh that tests its own triangles by index, IndexedMesh and
+/// QuantisedMesh, anything with intersect(ray, triangle, tMax, hit)
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mesh, typename = decltype(std::declval<const Mesh &>().intersect(std::declval<const Ray &>(), uint32_t(), float(), std::declval<TriHit &>()))>
+TriHit closestHit(const BVH4 &_bvh, const Mesh &_mesh, const Ray &_ray, float _tMax = FLT_MAX)
+{
+  TriHit hit;
+  _bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  for (uint32_t i = _first; i < _first + _count; ++i)
+                  {
+                    if (_mesh.intersect(_ray, _bvh.primIndex(i), io_tMax, hit))
+                    {
+                      io_tMax = hit.m_t;
+                    }
+                  }
+                  return false; });
+  return hit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief is anything on the ray between 0 and _tMax for the same mesh types, the traversal stops at the first
+/// triangle hit
+//----------------------------------------------------------------------------------------------------------------------
+template <typename Mesh, typename = decltype(std::declval<const Mesh &>().intersect(std::declval<const Ray &>(), uint32_t(), float(), std::declval<TriHit &>()))>
+bool occluded(const BVH4 &_bvh, const Mesh &_mesh, const Ray &_ray, float _tMax)
+{
+  bool blocked = false;
+  _bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  TriHit hit;
+                  for (uint32_t i = _first; i < _first + _count && !blocked; ++i)
+                  {
+                    blocked = _mesh.intersect(_ray, _bvh.primIndex(i), io_tMax, hit);
+                  }
+                  return blocked; });
+  return blocked;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool intersectEdges(const Ray &_ray, const ngl::Vec3 &_v0, const ngl::Vec3 &_edge1, const ngl::Vec3 &_edge2, uint32_t _triIndex,
+                           float _tMax, TriHit &o_hit)
+{
+  ngl::Vec3 pvec = _ray.m_dir.cross(_edge2);
+  float det = _edge1.dot(pvec);
+  // ray parallel to the triangle
+  if (det > -0.00001f && det < 0.00001f)
+  {
+    return false;
+  }
+  float invDet = 1.0f / det;
+  ngl::Vec3 tvec = _ray.m_origin - _v0;
+  float u = tvec.dot(pvec) * invDet;
+  if (u < -0.001f || u > 1.001f)
+  {
+    return false;
+  }
+  ngl::Vec3 qvec = tvec.cross(_edge1);
+  float v = _ray.m_dir.dot(qvec) * invDet;
+  if (v < -0.001f || u + v > 1.001f)
+  {
+    return false;
+  }
+  // the Moller-Trumbore t is the distance along the ray so no second plane intersection is needed
+  float t = _edge2.dot(qvec) * invDet;
+  if (t <= 0.0f || t >= _tMax)
+  {
+    return false;
+  }
+  o_hit.m_t = t;
+  o_hit.m_u = u;
+  o_hit.m_v = v;
+  o_hit.m_triIndex = _triIndex;
+  return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool intersectTriangle(const Ray &_ray, const ngl::Vec3 &_v0, const ngl::Vec3 &_v1, const ngl::Vec3 &_v2, uint32_t _triIndex,
+                              float _tMax, TriHit &o_hit)
+{
+  return intersectEdges(_ray, _v0, _v1 - _v0, _v2 - _v0, _triIndex, _tMax, o_hit);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool TriAccel::intersect(const Ray &_ray, uint32_t _triIndex, float _tMax, TriHit &o_hit) const
+{
+  return intersectEdges(_ray, m_v0, m_edge1, m_edge2, _triIndex, _tMax, o_hit);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+inline bool Watertight::intersect(const Record &_tri, const RayData &_ray, uint32_t _triIndex, float _tMax, TriHit &o_hit)
+{
+  // vertices relative to the ray origin
+  const ngl::Vec3 a = _tri.m_v0 - _ray.m_origin;
+  const ngl::Vec3 b = _tri.m_v1 - _ray.m_origin;
+  const ngl::Vec3 c = _tri.m_v2 - _ray.m_origin;
+  // shear and scale so the ray is the +z axis
+  const float ax = a[_ray.m_kx] - _ray.m_sx * a[_ray.m_kz];
+  const float ay = a[_ray.m_ky] - _ray.m_sy * a[_ray.m_kz];
+  const float bx = b[_ray.m_kx] - _ray.m_sx * b[_ray.m_kz];
+  const float by = b[_ray.m_ky] - _ray.m_sy * b[_ray.m_kz];
+  const float cx = c[_ray.m_kx] - _ray.m_sx * c[_ray.m_kz];
+  const float cy = c[_ray.m_ky] - _ray.m_sy * c[_ray.m_kz];
+  // scaled barycentric coordinates from the 2D edge functions
+  float u = cx * by - cy * bx;
+  float v = ax * cy - ay * cx;
+  float w = bx * ay - by * ax;
+  // exactly on an edge in float, redo the edge functions in double so the shared edge gives the same answer
+  if (u == 0.0f || v == 0.0f || w == 0.0f)
+  {
+    u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+    v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+    w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+  }
+  // both faces are hit so the ray is inside if all the signs agree
+  if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+  {
+    return false;
+  }
+  const float det = u + v + w;
+  if (det == 0.0f)
+  {
+    return false;
+  }
+  const float az = _ray.m_sz * a[_ray.m_kz];
+  const float bz = _ray.m_sz * b[_ray.m_kz];
+  const float cz = _ray.m_sz * c[_ray.m_kz];
+  const float invDet = 1.0f / det;
+  const float t = (u * az + v * bz + w * cz) * invDet;
+  if (!(t > 0.0f && t < _tMax))
+  {
+    return false;
+  }
+  // u weights v0, v and w weight v1 and v2 which is what TriHit stores
+  o_hit.m_t = t;
+  o_hit.m_u = v * invDet;
+  o_hit.m_v = w * invDet;
+  o_hit.m_triIndex = _triIndex;
+  return true;
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <ngl/ShaderLib.h>
 #include <ngl/Transformation.h>
 #include <ngl/AbstractVAO.h>
+#include <ngl/MultiBufferVAO.h>
+#include "TriAccel.h"
 class Triangle
 {
 
@@ -15,18 +17,31 @@ public :
 	~Triangle();
 	// method to draw the tri
   void draw(const std::string &_shaderName, const ngl::Mat4 &_globalMat,const ngl::Mat4 &_view, const ngl::Mat4 &_project);
-	// method to see if ray has intercepted with triangle.
+	// method to see if ray has intercepted with triangle, stores the result for drawing
 	void rayTriangleIntersect(ngl::Vec3 _rayStart, ngl::Vec3 _rayEnd);
+	// the precomputed record used by the ray queries
+	const TriAccel &getAccel() const {return m_accel;}
   void loadMatricesToShader(ngl::Transformation &_tx, const ngl::Mat4 &_globalMat, const ngl::Mat4 &_view , const ngl::Mat4 &_project) const;
+  // accessors for the vertices, used to build the acceleration structure
+  ngl::Vec3 getV0() const {return m_v0;}
+  ngl::Vec3 getV1() const {return m_v1;}
+  ngl::Vec3 getV2() const {return m_v2;}
+  // hit state of the last call to rayTriangleIntersect
+  bool isHit() const {return m_hit;}
+  void setNotHit() {m_hit=false;}
+  // distance along the ray direction of the last hit
+  ngl::Real getHitDistance() const {return m_hitDistance;}
+  // bytes each triangle uses on the CPU including its vertex arrays and VAO object, and in the GPU buffers
+  static size_t memoryUsage() {return sizeof(Triangle)+2*3*sizeof(ngl::Vec3)+sizeof(ngl::MultiBufferVAO);}
+  static size_t gpuMemoryUsage() {return 2*3*sizeof(ngl::Vec3);}
 
 private :
 	// The triangles verticies
   ngl::Vec3 m_v0;
   ngl::Vec3 m_v1;
   ngl::Vec3 m_v2;
-	// two edges for the triangle / ray calculation
-  ngl::Vec3 m_edge1;
-  ngl::Vec3 m_edge2;
+	// the edges and normal for the triangle / ray calculation
+  TriAccel m_accel;
 	// the center of the triangle
   ngl::Vec3 m_center;
 	// @brief the vertex normals of the triangle
@@ -36,10 +51,8 @@ private :
 
 	// flag to indicate if tri has been intersected with ray
   bool m_hit;
-	// u,v,w values for the calculation of hit point
-  ngl::Real m_u;
-  ngl::Real m_v;
-  ngl::Real m_w;
+	// distance along the ray of the hit point
+  ngl::Real m_hitDistance;
 	// the actual hit point of the tri
   ngl::Vec3 m_hitPoint;
   /// @brief our vertex array object
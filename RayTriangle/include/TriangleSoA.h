@@ -0,0 +1,121 @@
+#ifndef TRIANGLESOA_H_
+#define TRIANGLESOA_H_
+
+#include <cstdint>
+#include <vector>
+#include "Ray.h"
+#include "TriAccel.h"
+#include "BVH4.h"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define TRIANGLESOA_WIDTH 16
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define TRIANGLESOA_WIDTH 8
+#else
+#define TRIANGLESOA_WIDTH 8
+#endif
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TriangleSoA.h
+/// @brief triangles stored as structure of arrays (v0, edge1 and edge2 split into x, y and z arrays) so one ray can be
+/// tested against a whole block of triangles at once. With AVX-512 a block is 16 triangles, with AVX2 it is 8 and
+/// without either the same 8 lane loop is left to the compiler.
+/// The triangles can be put in any order, so if they are stored in the primitive order of a BVH every leaf is a
+/// contiguous range and intersect() becomes the leaf routine.
+//----------------------------------------------------------------------------------------------------------------------
+class TriangleSoA
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief number of triangles tested at once
+  //----------------------------------------------------------------------------------------------------------------------
+  static constexpr uint32_t s_width = TRIANGLESOA_WIDTH;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief copy the triangles into the SoA arrays
+  /// @param _tris the triangles
+  /// @param _order optional order to store them in (for example BVH4::primIndexData()), the hit records still
+  /// report the index into _tris
+  //----------------------------------------------------------------------------------------------------------------------
+  void build(const std::vector<TriAccel> &_tris, const uint32_t *_order = nullptr);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief closest hit of the ray against the stored triangles _first to _first+_count-1
+  /// @param _tMax only hits closer than this are accepted
+  /// @param o_hit filled in when a closer hit is found
+  /// @returns true if a hit closer than _tMax was found
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersect(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief closest hit of the ray against every stored triangle
+  //----------------------------------------------------------------------------------------------------------------------
+  TriHit closestHit(const Ray &_ray, float _tMax = FLT_MAX) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief does the ray hit any of the triangles _first to _first+_count-1 closer than _tMax, stops at the first
+  /// block with a hit
+  //----------------------------------------------------------------------------------------------------------------------
+  bool occluded(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax) const;
+  uint32_t size() const { return m_size; }
+  size_t memoryUsage() const;
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief test up to s_width triangles starting at _first
+  //----------------------------------------------------------------------------------------------------------------------
+  bool intersectBlock(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the arrays are padded by s_width so a block load at the end never reads past the end
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_v0x;
+  std::vector<float> m_v0y;
+  std::vector<float> m_v0z;
+  std::vector<float> m_e1x;
+  std::vector<float> m_e1y;
+  std::vector<float> m_e1z;
+  std::vector<float> m_e2x;
+  std::vector<float> m_e2y;
+  std::vector<float> m_e2z;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the index of each triangle in the array passed to build
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_ids;
+  uint32_t m_size = 0;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief closest hit of one ray through a BVH, the triangles must have been built in _bvh.primIndexData() order
+/// so each leaf is one call to intersect
+//----------------------------------------------------------------------------------------------------------------------
+inline TriHit closestHit(const BVH4 &_bvh, const TriangleSoA &_tris, const Ray &_ray, float _tMax = FLT_MAX)
+{
+  TriHit hit;
+  _bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  if (_tris.intersect(_ray, _first, _count, io_tMax, hit))
+                  {
+                    io_tMax = hit.m_t;
+                  }
+                  return false; });
+  return hit;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief is anything on the ray between 0 and _tMax, the traversal stops at the first leaf with a hit
+//----------------------------------------------------------------------------------------------------------------------
+inline bool occluded(const BVH4 &_bvh, const TriangleSoA &_tris, const Ray &_ray, float _tMax)
+{
+  bool blocked = false;
+  _bvh.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                {
+                  blocked = _tris.occluded(_ray, _first, _count, io_tMax);
+                  return blocked; });
+  return blocked;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief occlusion test for a batch of segments
+/// @param o_occluded resized to hold a bit per segment, bit i (word i/64 bit i%64) is set if segment i is blocked
+//----------------------------------------------------------------------------------------------------------------------
+void occluded(const BVH4 &_bvh, const TriangleSoA &_tris, const std::vector<Segment> &_segments, std::vector<uint64_t> &o_occluded);
+
+#endif
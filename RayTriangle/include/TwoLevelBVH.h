@@ -0,0 +1,117 @@
+#ifndef TWOLEVELBVH_H_
+#define TWOLEVELBVH_H_
+
+#include <ngl/Mat4.h>
+#include <ngl/Vec3.h>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "BVH4.h"
+#include "IndexedMesh.h"
+#include "Ray.h"
+#include "TriAccel.h"
+#include "TriangleSoA.h"
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file TwoLevelBVH.h
+/// @brief a two level acceleration structure for instanced triangle meshes. Each unique mesh gets its own bottom
+/// level BVH built once in object space, and a small top level BVH is built over the world space bounds of the
+/// instances. At an instance leaf the ray is taken into the object space of the instance and traced through the
+/// mesh's own tree, so a mesh repeated a thousand times is only stored once. Moving an instance only needs the
+/// top level rebuilt which is cheap as there is one box per instance.
+/// The ray direction is transformed without being normalized so t values mean the same in every instance and
+/// the closest hit can be compared across them.
+//----------------------------------------------------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief the closest hit in an instanced scene, m_hit.m_triIndex is the triangle within the instance's mesh
+//----------------------------------------------------------------------------------------------------------------------
+struct InstanceHit
+{
+  TriHit m_hit;
+  uint32_t m_instance = TriHit::s_noHit;
+  bool isHit() const { return m_instance != TriHit::s_noHit; }
+};
+
+class TwoLevelBVH
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief add a mesh and build its bottom level tree
+  /// @param _mesh the triangles in object space
+  /// @returns the mesh index used by addInstance
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t addMesh(const IndexedMesh &_mesh);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief place a copy of a mesh in the scene, build() must be called before tracing
+  /// @param _mesh index returned by addMesh
+  /// @param _transform object to world matrix
+  /// @returns the instance index
+  //----------------------------------------------------------------------------------------------------------------------
+  uint32_t addInstance(uint32_t _mesh, const ngl::Mat4 &_transform);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief move an instance, build() must be called before tracing
+  //----------------------------------------------------------------------------------------------------------------------
+  void setTransform(uint32_t _instance, const ngl::Mat4 &_transform);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief rebuild the top level tree over the instances, the meshes are not touched
+  //----------------------------------------------------------------------------------------------------------------------
+  void build();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief closest hit of a world space ray
+  //----------------------------------------------------------------------------------------------------------------------
+  InstanceHit closestHit(const Ray &_ray, float _tMax = FLT_MAX) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief is anything on the ray between 0 and _tMax, stops at the first hit
+  //----------------------------------------------------------------------------------------------------------------------
+  bool occluded(const Ray &_ray, float _tMax) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the unit world space face normal of a hit
+  //----------------------------------------------------------------------------------------------------------------------
+  ngl::Vec3 worldNormal(const InstanceHit &_hit) const;
+  size_t numMeshes() const { return m_meshes.size(); }
+  size_t numInstances() const { return m_instances.size(); }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the number of triangles in the scene counting every instance
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t numInstancedTriangles() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bytes used by the meshes, their trees, the instances and the top level tree
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t memoryUsage() const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bytes the same scene would use with every instance copied into world space with its own tree
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t flattenedMemoryUsage() const;
+
+private:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a unique mesh, the triangles are kept as records and as SoA blocks in BVH leaf order
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Mesh
+  {
+    std::vector<TriAccel> m_tris;
+    TriangleSoA m_soa;
+    BVH4 m_bvh;
+  };
+  struct Instance
+  {
+    uint32_t m_mesh;
+    ngl::Mat4 m_transform;
+    ngl::Mat4 m_inverse;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief transform a point including the translation, or a direction without it
+  //----------------------------------------------------------------------------------------------------------------------
+  static ngl::Vec3 transformPoint(const ngl::Mat4 &_m, const ngl::Vec3 &_p);
+  static ngl::Vec3 transformVector(const ngl::Mat4 &_m, const ngl::Vec3 &_v);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the ray in the object space of an instance
+  //----------------------------------------------------------------------------------------------------------------------
+  Ray toObject(const Instance &_instance, const Ray &_ray) const;
+  std::vector<Mesh> m_meshes;
+  std::vector<Instance> m_instances;
+  BVH4 m_tlas;
+};
+
+#endif
@@ -0,0 +1,802 @@
+#include "BVH4.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <thread>
+
+void AABB::extend(const ngl::Vec3 &_p)
+{
+  m_min.set(std::min(m_min.m_x, _p.m_x), std::min(m_min.m_y, _p.m_y), std::min(m_min.m_z, _p.m_z));
+  m_max.set(std::max(m_max.m_x, _p.m_x), std::max(m_max.m_y, _p.m_y), std::max(m_max.m_z, _p.m_z));
+}
+
+void AABB::extend(const AABB &_b)
+{
+  extend(_b.m_min);
+  extend(_b.m_max);
+}
+
+float AABB::surfaceArea() const
+{
+  if (isEmpty())
+  {
+    return 0.0f;
+  }
+  ngl::Vec3 d = m_max - m_min;
+  return 2.0f * (d.m_x * d.m_y + d.m_y * d.m_z + d.m_z * d.m_x);
+}
+
+size_t BVH4::memoryUsage() const
+{
+  return m_numNodes * sizeof(BVH4Node) + m_numPrims * sizeof(uint32_t);
+}
+
+void BVH4::attach(const BVH4Node *_nodes, uint32_t _numNodes, const uint32_t *_primIndices, uint32_t _numPrims,
+                  const AABB &_bounds, uint32_t _maxLeafSize)
+{
+  m_nodes.clear();
+  m_nodes.shrink_to_fit();
+  m_primIndices.clear();
+  m_primIndices.shrink_to_fit();
+  m_externalNodes = _nodes;
+  m_externalPrims = _primIndices;
+  m_numNodes = _numNodes;
+  m_numPrims = _numPrims;
+  m_bounds = _bounds;
+  m_maxLeafSize = _maxLeafSize;
+  // worked out on the first update rather than reading the whole of a mapped tree here
+  m_builtCost = 0.0f;
+  m_builtTopCost = 0.0f;
+  m_sliced = SlicedBuild();
+}
+
+void BVH4::build(const std::vector<AABB> &_bounds, uint32_t _maxLeafSize)
+{
+  m_nodes.clear();
+  m_primIndices.clear();
+  m_externalNodes = nullptr;
+  m_externalPrims = nullptr;
+  m_numNodes = 0;
+  m_numPrims = 0;
+  m_bounds = AABB();
+  m_builtCost = 0.0f;
+  m_builtTopCost = 0.0f;
+  m_sliced = SlicedBuild();
+  m_maxLeafSize = std::max(1u, std::min(_maxLeafSize, 255u));
+  if (_bounds.empty())
+  {
+    return;
+  }
+  uint32_t numPrims = static_cast<uint32_t>(_bounds.size());
+  m_primIndices.resize(numPrims);
+  std::iota(std::begin(m_primIndices), std::end(m_primIndices), 0u);
+  std::vector<ngl::Vec3> centroids(numPrims);
+  for (uint32_t i = 0; i < numPrims; ++i)
+  {
+    centroids[i] = _bounds[i].center();
+    m_bounds.extend(_bounds[i]);
+  }
+  // build a binary tree first, then pull grandchildren up into the parent to get four wide nodes
+  std::vector<BuildNode> tree;
+  tree.reserve(2 * numPrims);
+  uint32_t root = buildBinary(tree, m_primIndices.data(), _bounds, centroids, 0, numPrims, 0);
+  m_nodes.reserve(numPrims / 2 + 1);
+  collapseRoot(tree, root);
+  m_numNodes = static_cast<uint32_t>(m_nodes.size());
+  m_numPrims = numPrims;
+  m_builtCost = sahCost();
+  m_builtTopCost = topLevelCost();
+}
+
+void BVH4::collapseRoot(const std::vector<BuildNode> &_tree, uint32_t _root)
+{
+  if (_tree[_root].m_count != 0)
+  {
+    // everything fits in one leaf, still create a root node so traversal always starts at an inner node
+    m_nodes.emplace_back();
+    BVH4Node &node = m_nodes.back();
+    clearNode(node);
+    setSlot(node, 0, _tree[_root].m_bounds);
+    node.m_child[0] = _tree[_root].m_first;
+    node.m_count[0] = _tree[_root].m_count;
+  }
+  else
+  {
+    collapse(_tree, _root);
+  }
+}
+
+void BVH4::setSlot(BVH4Node &io_node, int _slot, const AABB &_bounds)
+{
+  io_node.m_minX[_slot] = _bounds.m_min.m_x;
+  io_node.m_minY[_slot] = _bounds.m_min.m_y;
+  io_node.m_minZ[_slot] = _bounds.m_min.m_z;
+  io_node.m_maxX[_slot] = _bounds.m_max.m_x;
+  io_node.m_maxY[_slot] = _bounds.m_max.m_y;
+  io_node.m_maxZ[_slot] = _bounds.m_max.m_z;
+}
+
+void BVH4::clearNode(BVH4Node &o_node)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    o_node.m_minX[i] = o_node.m_minY[i] = o_node.m_minZ[i] = FLT_MAX;
+    o_node.m_maxX[i] = o_node.m_maxY[i] = o_node.m_maxZ[i] = -FLT_MAX;
+    o_node.m_child[i] = s_emptySlot;
+    o_node.m_count[i] = 0;
+  }
+}
+
+bool BVH4::isUnused(const BVH4Node &_node)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    if (_node.m_count[i] != 0 || _node.m_child[i] != s_emptySlot)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BVH4::ownNodes()
+{
+  if (m_externalNodes == nullptr)
+  {
+    return;
+  }
+  m_nodes.assign(m_externalNodes, m_externalNodes + m_numNodes);
+  m_primIndices.assign(m_externalPrims, m_externalPrims + m_numPrims);
+  m_externalNodes = nullptr;
+  m_externalPrims = nullptr;
+}
+
+AABB BVH4::leafBounds(uint32_t _first, uint32_t _count, const std::vector<AABB> &_bounds) const
+{
+  AABB b;
+  for (uint32_t i = _first; i < _first + _count; ++i)
+  {
+    b.extend(_bounds[m_primIndices[i]]);
+  }
+  return b;
+}
+
+AABB BVH4::refitNode(uint32_t _node, const std::vector<AABB> &_bounds)
+{
+  AABB nodeBounds;
+  for (int i = 0; i < 4; ++i)
+  {
+    const uint32_t child = m_nodes[_node].m_child[i];
+    const uint32_t count = m_nodes[_node].m_count[i];
+    if (count == 0 && child == s_emptySlot)
+    {
+      continue;
+    }
+    AABB b = count != 0 ? leafBounds(child, count, _bounds) : refitNode(child, _bounds);
+    setSlot(m_nodes[_node], i, b);
+    nodeBounds.extend(b);
+  }
+  return nodeBounds;
+}
+
+void BVH4::collectSubtrees(uint32_t _node, int _depth, std::vector<uint32_t> &o_subtrees) const
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    if (m_nodes[_node].m_count[i] != 0 || m_nodes[_node].m_child[i] == s_emptySlot)
+    {
+      continue;
+    }
+    if (_depth + 1 == s_refitDepth)
+    {
+      o_subtrees.push_back(m_nodes[_node].m_child[i]);
+    }
+    else
+    {
+      collectSubtrees(m_nodes[_node].m_child[i], _depth + 1, o_subtrees);
+    }
+  }
+}
+
+AABB BVH4::refitTop(uint32_t _node, int _depth, const std::vector<AABB> &_bounds, const std::vector<AABB> &_subtreeBounds, size_t &io_next)
+{
+  // visits the children in the same order as collectSubtrees so the subtree boxes come out in order
+  AABB nodeBounds;
+  for (int i = 0; i < 4; ++i)
+  {
+    const uint32_t child = m_nodes[_node].m_child[i];
+    const uint32_t count = m_nodes[_node].m_count[i];
+    if (count == 0 && child == s_emptySlot)
+    {
+      continue;
+    }
+    AABB b;
+    if (count != 0)
+    {
+      b = leafBounds(child, count, _bounds);
+    }
+    else if (_depth + 1 == s_refitDepth)
+    {
+      b = _subtreeBounds[io_next++];
+    }
+    else
+    {
+      b = refitTop(child, _depth + 1, _bounds, _subtreeBounds, io_next);
+    }
+    setSlot(m_nodes[_node], i, b);
+    nodeBounds.extend(b);
+  }
+  return nodeBounds;
+}
+
+void BVH4::refit(const std::vector<AABB> &_bounds, unsigned int _numThreads)
+{
+  if (empty())
+  {
+    return;
+  }
+  // an attached tree is read only so take a copy to refit
+  ownNodes();
+  // each subtree only writes its own nodes so they can be refit at the same time
+  std::vector<uint32_t> subtrees;
+  collectSubtrees(0, 0, subtrees);
+  std::vector<AABB> subtreeBounds(subtrees.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]()
+  {
+    for (size_t i = next++; i < subtrees.size(); i = next++)
+    {
+      subtreeBounds[i] = refitNode(subtrees[i], _bounds);
+    }
+  };
+  if (_numThreads == 0)
+  {
+    _numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min<size_t>(_numThreads, subtrees.size()); ++i)
+  {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+  size_t used = 0;
+  m_bounds = refitTop(0, 0, _bounds, subtreeBounds, used);
+}
+
+bool BVH4::update(const std::vector<AABB> &_bounds, float _maxCostRatio, unsigned int _numThreads)
+{
+  if (_bounds.size() != m_numPrims || empty())
+  {
+    build(_bounds, m_maxLeafSize);
+    return true;
+  }
+  if (m_builtCost <= 0.0f)
+  {
+    m_builtCost = sahCost();
+  }
+  refit(_bounds, _numThreads);
+  if (sahCost() <= m_builtCost * _maxCostRatio)
+  {
+    return false;
+  }
+  build(_bounds, m_maxLeafSize);
+  return true;
+}
+
+uint32_t BVH4::rankNodes(uint32_t _node, int _depth, std::vector<OptimiseCandidate> &o_candidates, float &o_cost) const
+{
+  AABB nodeBounds;
+  uint32_t numPrims = 0;
+  float cost = 0.0f;
+  for (int i = 0; i < 4; ++i)
+  {
+    const uint32_t child = m_nodes[_node].m_child[i];
+    const uint32_t count = m_nodes[_node].m_count[i];
+    if (count == 0 && child == s_emptySlot)
+    {
+      continue;
+    }
+    AABB b;
+    b.m_min.set(m_nodes[_node].m_minX[i], m_nodes[_node].m_minY[i], m_nodes[_node].m_minZ[i]);
+    b.m_max.set(m_nodes[_node].m_maxX[i], m_nodes[_node].m_maxY[i], m_nodes[_node].m_maxZ[i]);
+    nodeBounds.extend(b);
+    if (count != 0)
+    {
+      cost += b.surfaceArea() * count;
+      numPrims += count;
+    }
+    else
+    {
+      float childCost = 0.0f;
+      numPrims += rankNodes(child, _depth + 1, o_candidates, childCost);
+      cost += childCost;
+    }
+  }
+  o_cost = cost + nodeBounds.surfaceArea();
+  // primitives that have drifted apart make every box they are in bigger so their subtrees cost more per primitive,
+  // a parent also counts its own box for every primitive so it usually ranks above its children
+  o_candidates.push_back({o_cost / numPrims, _node, numPrims, _depth});
+  return numPrims;
+}
+
+void BVH4::subtreeExtent(uint32_t _node, uint32_t &io_end, uint32_t &io_firstPrim, uint32_t &io_numPrims) const
+{
+  io_end = std::max(io_end, _node + 1);
+  for (int i = 0; i < 4; ++i)
+  {
+    const uint32_t child = m_nodes[_node].m_child[i];
+    const uint32_t count = m_nodes[_node].m_count[i];
+    if (count != 0)
+    {
+      io_firstPrim = std::min(io_firstPrim, child);
+      io_numPrims += count;
+    }
+    else if (child != s_emptySlot)
+    {
+      subtreeExtent(child, io_end, io_firstPrim, io_numPrims);
+    }
+  }
+}
+
+uint32_t BVH4::rebuildSubtree(uint32_t _node, int _depth, const std::vector<AABB> &_bounds, std::vector<ngl::Vec3> &io_centroids,
+                              std::vector<BuildNode> &io_tree, std::vector<BVH4Node> &io_nodes, std::vector<uint32_t> &io_saved)
+{
+  uint32_t end = _node + 1;
+  uint32_t firstPrim = m_numPrims;
+  uint32_t numPrims = 0;
+  subtreeExtent(_node, end, firstPrim, numPrims);
+  // nodes left unused by an earlier rebuild of this subtree (or one below it) directly follow it and can be reused
+  while (end < m_numNodes && isUnused(m_nodes[end]))
+  {
+    ++end;
+  }
+  io_saved.assign(m_primIndices.begin() + firstPrim, m_primIndices.begin() + firstPrim + numPrims);
+  for (uint32_t i = firstPrim; i < firstPrim + numPrims; ++i)
+  {
+    io_centroids[m_primIndices[i]] = _bounds[m_primIndices[i]].center();
+  }
+  // starting the binary build at this depth keeps the whole tree within s_maxDepth so the traversal stack is still
+  // big enough
+  io_tree.clear();
+  uint32_t root = buildBinary(io_tree, m_primIndices.data(), _bounds, io_centroids, firstPrim, numPrims, _depth);
+  // collapse() appends to m_nodes so give it the scratch array to fill, node indices then start at 0
+  std::swap(m_nodes, io_nodes);
+  m_nodes.clear();
+  collapseRoot(io_tree, root);
+  std::swap(m_nodes, io_nodes);
+  if (io_nodes.size() > end - _node)
+  {
+    if (end != m_numNodes)
+    {
+      // the new subtree doesn't fit where the old one was, put the primitives back the way the old leaves expect
+      std::copy(io_saved.begin(), io_saved.end(), m_primIndices.begin() + firstPrim);
+      return 0;
+    }
+    // nothing comes after the last subtree (the root's range is the whole array) so it can grow
+    end = _node + static_cast<uint32_t>(io_nodes.size());
+    m_nodes.resize(end);
+    m_numNodes = end;
+  }
+  for (size_t i = 0; i < io_nodes.size(); ++i)
+  {
+    BVH4Node &node = m_nodes[_node + i];
+    node = io_nodes[i];
+    for (int c = 0; c < 4; ++c)
+    {
+      if (node.m_count[c] == 0 && node.m_child[c] != s_emptySlot)
+      {
+        node.m_child[c] += _node;
+      }
+    }
+  }
+  for (uint32_t i = _node + static_cast<uint32_t>(io_nodes.size()); i < end; ++i)
+  {
+    clearNode(m_nodes[i]);
+  }
+  return end;
+}
+
+float BVH4::topLevelCost() const
+{
+  const float rootArea = m_bounds.surfaceArea();
+  return empty() || rootArea <= 0.0f ? 0.0f : topLevelCost(0, 0) / rootArea;
+}
+
+float BVH4::topLevelCost(uint32_t _node, int _depth) const
+{
+  const BVH4Node &node = nodeData()[_node];
+  AABB nodeBounds;
+  float cost = 0.0f;
+  for (int i = 0; i < 4; ++i)
+  {
+    if (node.m_count[i] == 0 && node.m_child[i] == s_emptySlot)
+    {
+      continue;
+    }
+    AABB b;
+    b.m_min.set(node.m_minX[i], node.m_minY[i], node.m_minZ[i]);
+    b.m_max.set(node.m_maxX[i], node.m_maxY[i], node.m_maxZ[i]);
+    nodeBounds.extend(b);
+    if (node.m_count[i] != 0)
+    {
+      cost += b.surfaceArea() * node.m_count[i];
+    }
+    else if (_depth + 1 < s_refitDepth)
+    {
+      cost += topLevelCost(node.m_child[i], _depth + 1);
+    }
+  }
+  return cost + nodeBounds.surfaceArea();
+}
+
+void BVH4::startSlicedBuild(const std::vector<AABB> &_bounds)
+{
+  // the copy of the bounds is what the new tree is built around, it is refit to wherever things are when it is done
+  m_sliced.m_bounds = _bounds;
+  m_sliced.m_centroids.resize(m_numPrims);
+  for (uint32_t i = 0; i < m_numPrims; ++i)
+  {
+    m_sliced.m_centroids[i] = _bounds[i].center();
+  }
+  m_sliced.m_primIndices.resize(m_numPrims);
+  std::iota(std::begin(m_sliced.m_primIndices), std::end(m_sliced.m_primIndices), 0u);
+  m_sliced.m_tree.clear();
+  m_sliced.m_tree.reserve(2 * m_numPrims);
+  m_sliced.m_tasks.clear();
+  m_sliced.m_tasks.push_back({s_emptySlot, false, 0, m_numPrims, 0});
+}
+
+bool BVH4::continueSlicedBuild(const std::vector<AABB> &_bounds, std::chrono::steady_clock::time_point _start, double _budget)
+{
+  SlicedBuild &b = m_sliced;
+  while (!b.m_tasks.empty())
+  {
+    if (std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _start).count() >= _budget)
+    {
+      return false;
+    }
+    // the left task is pushed last so the binary tree comes out in the same order as a recursive build
+    const BuildTask task = b.m_tasks.back();
+    b.m_tasks.pop_back();
+    uint32_t nodeIndex = static_cast<uint32_t>(b.m_tree.size());
+    if (task.m_count <= s_slicedChunk)
+    {
+      buildBinary(b.m_tree, b.m_primIndices.data(), b.m_bounds, b.m_centroids, task.m_first, task.m_count, task.m_depth);
+    }
+    else
+    {
+      b.m_tree.emplace_back();
+      uint32_t leftCount = split(b.m_primIndices.data(), b.m_bounds, b.m_centroids, task.m_first, task.m_count, task.m_depth,
+                                 b.m_tree[nodeIndex].m_bounds);
+      if (leftCount == 0)
+      {
+        b.m_tree[nodeIndex].m_first = task.m_first;
+        b.m_tree[nodeIndex].m_count = task.m_count;
+      }
+      else
+      {
+        b.m_tasks.push_back({nodeIndex, true, task.m_first + leftCount, task.m_count - leftCount, task.m_depth + 1});
+        b.m_tasks.push_back({nodeIndex, false, task.m_first, leftCount, task.m_depth + 1});
+      }
+    }
+    if (task.m_parent != s_emptySlot)
+    {
+      (task.m_right ? b.m_tree[task.m_parent].m_right : b.m_tree[task.m_parent].m_left) = nodeIndex;
+    }
+  }
+  m_nodes.clear();
+  collapseRoot(b.m_tree, 0);
+  m_primIndices.swap(b.m_primIndices);
+  m_numNodes = static_cast<uint32_t>(m_nodes.size());
+  m_bounds = b.m_tree[0].m_bounds;
+  m_builtCost = sahCost();
+  m_builtTopCost = topLevelCost();
+  // keep the arrays for the next sliced build, an empty m_bounds marks that none is running
+  b.m_bounds.clear();
+  refit(_bounds);
+  return true;
+}
+
+uint32_t BVH4::optimise(const std::vector<AABB> &_bounds, double _budget, bool _fullRebuild)
+{
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&]()
+  {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  };
+  const float rootArea = m_bounds.surfaceArea();
+  if (empty() || _bounds.size() != m_numPrims || rootArea <= 0.0f)
+  {
+    return 0;
+  }
+  ownNodes();
+  uint32_t numRebuilt = 0;
+  if (_fullRebuild && m_numPrims * static_cast<double>(m_rebuildCost) > _budget)
+  {
+    if (m_builtTopCost <= 0.0f)
+    {
+      m_builtTopCost = topLevelCost();
+    }
+    if (m_sliced.m_bounds.empty() && topLevelCost() > m_builtTopCost * s_slicedRebuildRatio)
+    {
+      startSlicedBuild(_bounds);
+    }
+    if (!m_sliced.m_bounds.empty() && continueSlicedBuild(_bounds, start, _budget * 0.5))
+    {
+      ++numRebuilt;
+    }
+  }
+  std::vector<OptimiseCandidate> candidates;
+  std::vector<uint32_t> subtrees;
+  if (m_numPrims * static_cast<double>(m_rebuildCost) > _budget)
+  {
+    collectSubtrees(0, 0, subtrees);
+  }
+  if (subtrees.empty())
+  {
+    float cost;
+    rankNodes(0, 0, candidates, cost);
+  }
+  else
+  {
+    // the top of a big tree can't be rebuilt within the budget anyway, so rank the subtrees below it in turn
+    // carrying on from the last call and leave most of the time for rebuilding
+    float cost;
+    const double rankUntil = elapsed() + _budget * 0.25;
+    for (size_t i = 0; i < subtrees.size() && elapsed() < rankUntil; ++i)
+    {
+      rankNodes(subtrees[m_optimiseCursor++ % subtrees.size()], s_refitDepth, candidates, cost);
+    }
+  }
+  candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const OptimiseCandidate &_c)
+                                  { return _c.m_numPrims * static_cast<double>(m_rebuildCost) > _budget; }),
+                   candidates.end());
+  auto worst = candidates.begin() + std::min<size_t>(candidates.size(), s_maxOptimiseCandidates);
+  std::partial_sort(candidates.begin(), worst, candidates.end(), [](const OptimiseCandidate &_a, const OptimiseCandidate &_b)
+                    { return _a.m_badness > _b.m_badness; });
+  candidates.erase(worst, candidates.end());
+  // node ranges already rewritten this call, nodes inside them have moved or gone
+  std::vector<std::pair<uint32_t, uint32_t>> rewritten;
+  std::vector<ngl::Vec3> centroids;
+  std::vector<BuildNode> tree;
+  std::vector<BVH4Node> nodes;
+  std::vector<uint32_t> saved;
+  for (const OptimiseCandidate &c : candidates)
+  {
+    const double remaining = _budget - elapsed();
+    if (remaining <= 0.0)
+    {
+      break;
+    }
+    if (c.m_numPrims * static_cast<double>(m_rebuildCost) > remaining)
+    {
+      continue;
+    }
+    if (std::any_of(rewritten.begin(), rewritten.end(), [&](const std::pair<uint32_t, uint32_t> &_r)
+                    { return c.m_node >= _r.first && c.m_node < _r.second; }))
+    {
+      continue;
+    }
+    if (centroids.empty())
+    {
+      centroids.resize(m_numPrims);
+    }
+    const double before = elapsed();
+    uint32_t end = rebuildSubtree(c.m_node, c.m_depth, _bounds, centroids, tree, nodes, saved);
+    m_rebuildCost = 0.5f * m_rebuildCost + 0.5f * static_cast<float>((elapsed() - before) / c.m_numPrims);
+    if (end != 0)
+    {
+      rewritten.emplace_back(c.m_node, end);
+      ++numRebuilt;
+    }
+  }
+  return numRebuilt;
+}
+
+float BVH4::sahCost() const
+{
+  const float rootArea = m_bounds.surfaceArea();
+  if (empty() || rootArea <= 0.0f)
+  {
+    return 0.0f;
+  }
+  const BVH4Node *nodes = nodeData();
+  double cost = 0.0;
+  for (uint32_t n = 0; n < m_numNodes; ++n)
+  {
+    AABB nodeBounds;
+    for (int i = 0; i < 4; ++i)
+    {
+      if (nodes[n].m_count[i] == 0 && nodes[n].m_child[i] == s_emptySlot)
+      {
+        continue;
+      }
+      AABB b;
+      b.m_min.set(nodes[n].m_minX[i], nodes[n].m_minY[i], nodes[n].m_minZ[i]);
+      b.m_max.set(nodes[n].m_maxX[i], nodes[n].m_maxY[i], nodes[n].m_maxZ[i]);
+      nodeBounds.extend(b);
+      cost += static_cast<double>(b.surfaceArea()) * nodes[n].m_count[i];
+    }
+    cost += nodeBounds.surfaceArea();
+  }
+  return static_cast<float>(cost / rootArea);
+}
+
+uint32_t BVH4::buildBinary(std::vector<BuildNode> &_tree, uint32_t *io_primIndices, const std::vector<AABB> &_bounds,
+                           const std::vector<ngl::Vec3> &_centroids, uint32_t _first, uint32_t _count, int _depth) const
+{
+  uint32_t nodeIndex = static_cast<uint32_t>(_tree.size());
+  _tree.emplace_back();
+  uint32_t leftCount = split(io_primIndices, _bounds, _centroids, _first, _count, _depth, _tree[nodeIndex].m_bounds);
+  if (leftCount == 0)
+  {
+    _tree[nodeIndex].m_first = _first;
+    _tree[nodeIndex].m_count = _count;
+    return nodeIndex;
+  }
+  uint32_t left = buildBinary(_tree, io_primIndices, _bounds, _centroids, _first, leftCount, _depth + 1);
+  uint32_t right = buildBinary(_tree, io_primIndices, _bounds, _centroids, _first + leftCount, _count - leftCount, _depth + 1);
+  _tree[nodeIndex].m_left = left;
+  _tree[nodeIndex].m_right = right;
+  return nodeIndex;
+}
+
+uint32_t BVH4::split(uint32_t *io_primIndices, const std::vector<AABB> &_bounds, const std::vector<ngl::Vec3> &_centroids,
+                     uint32_t _first, uint32_t _count, int _depth, AABB &o_bounds) const
+{
+  AABB bounds;
+  AABB centroidBounds;
+  for (uint32_t i = _first; i < _first + _count; ++i)
+  {
+    bounds.extend(_bounds[io_primIndices[i]]);
+    centroidBounds.extend(_centroids[io_primIndices[i]]);
+  }
+  o_bounds = bounds;
+  if (_count == 1 || _depth >= s_maxDepth)
+  {
+    return 0;
+  }
+
+  // binned SAH over all three axes
+  constexpr int numBins = 16;
+  float bestCost = FLT_MAX;
+  int bestAxis = -1;
+  int bestSplit = 0;
+  ngl::Vec3 extent = centroidBounds.m_max - centroidBounds.m_min;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    if (extent[axis] <= 0.0f)
+    {
+      continue;
+    }
+    AABB binBounds[numBins];
+    uint32_t binCount[numBins] = {0};
+    float scale = numBins / extent[axis];
+    for (uint32_t i = _first; i < _first + _count; ++i)
+    {
+      uint32_t p = io_primIndices[i];
+      int bin = std::min(numBins - 1, static_cast<int>((_centroids[p][axis] - centroidBounds.m_min[axis]) * scale));
+      ++binCount[bin];
+      binBounds[bin].extend(_bounds[p]);
+    }
+    // sweep from the right to get the cost of every right hand side, then from the left to evaluate
+    float rightArea[numBins];
+    uint32_t rightCount[numBins];
+    AABB acc;
+    uint32_t count = 0;
+    for (int i = numBins - 1; i > 0; --i)
+    {
+      acc.extend(binBounds[i]);
+      count += binCount[i];
+      rightArea[i] = acc.surfaceArea();
+      rightCount[i] = count;
+    }
+    acc = AABB();
+    count = 0;
+    for (int i = 0; i < numBins - 1; ++i)
+    {
+      acc.extend(binBounds[i]);
+      count += binCount[i];
+      if (count == 0 || rightCount[i + 1] == 0)
+      {
+        continue;
+      }
+      float cost = acc.surfaceArea() * count + rightArea[i + 1] * rightCount[i + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = i;
+      }
+    }
+  }
+
+  uint32_t *begin = io_primIndices + _first;
+  uint32_t *end = begin + _count;
+  uint32_t *mid = nullptr;
+  if (bestAxis >= 0)
+  {
+    // cost of traversing one node plus the children, compared with just testing every primitive here
+    float parentArea = bounds.surfaceArea();
+    float splitCost = 1.0f + (parentArea > 0.0f ? bestCost / parentArea : 0.0f);
+    if (_count <= m_maxLeafSize && splitCost >= static_cast<float>(_count))
+    {
+      return 0;
+    }
+    float scale = numBins / extent[bestAxis];
+    float minC = centroidBounds.m_min[bestAxis];
+    mid = std::partition(begin, end, [&](uint32_t _p)
+                         { return std::min(numBins - 1, static_cast<int>((_centroids[_p][bestAxis] - minC) * scale)) <= bestSplit; });
+  }
+  else
+  {
+    // all the centroids are in the same place so no split helps, halve the range if it is too big for a leaf
+    if (_count <= m_maxLeafSize)
+    {
+      return 0;
+    }
+    mid = begin + _count / 2;
+  }
+  return static_cast<uint32_t>(mid - begin);
+}
+
+uint32_t BVH4::collapse(const std::vector<BuildNode> &_tree, uint32_t _node)
+{
+  // start with the two children and keep opening the largest inner child until there are four slots
+  uint32_t slots[4] = {_tree[_node].m_left, _tree[_node].m_right, 0, 0};
+  int numSlots = 2;
+  while (numSlots < 4)
+  {
+    int best = -1;
+    float bestArea = -1.0f;
+    for (int i = 0; i < numSlots; ++i)
+    {
+      const BuildNode &child = _tree[slots[i]];
+      if (child.m_count == 0 && child.m_bounds.surfaceArea() > bestArea)
+      {
+        bestArea = child.m_bounds.surfaceArea();
+        best = i;
+      }
+    }
+    if (best < 0)
+    {
+      break;
+    }
+    uint32_t opened = slots[best];
+    slots[best] = _tree[opened].m_left;
+    slots[numSlots++] = _tree[opened].m_right;
+  }
+
+  uint32_t nodeIndex = static_cast<uint32_t>(m_nodes.size());
+  m_nodes.emplace_back();
+  for (int i = 0; i < 4; ++i)
+  {
+    // m_nodes can grow while recursing so always index rather than hold a reference
+    if (i >= numSlots)
+    {
+      BVH4Node &node = m_nodes[nodeIndex];
+      node.m_minX[i] = node.m_minY[i] = node.m_minZ[i] = FLT_MAX;
+      node.m_maxX[i] = node.m_maxY[i] = node.m_maxZ[i] = -FLT_MAX;
+      node.m_child[i] = s_emptySlot;
+      node.m_count[i] = 0;
+      continue;
+    }
+    const BuildNode &child = _tree[slots[i]];
+    uint32_t childRef = child.m_count != 0 ? child.m_first : collapse(_tree, slots[i]);
+    BVH4Node &node = m_nodes[nodeIndex];
+    node.m_minX[i] = child.m_bounds.m_min.m_x;
+    node.m_minY[i] = child.m_bounds.m_min.m_y;
+    node.m_minZ[i] = child.m_bounds.m_min.m_z;
+    node.m_maxX[i] = child.m_bounds.m_max.m_x;
+    node.m_maxY[i] = child.m_bounds.m_max.m_y;
+    node.m_maxZ[i] = child.m_bounds.m_max.m_z;
+    node.m_child[i] = childRef;
+    node.m_count[i] = child.m_count;
+  }
+  return nodeIndex;
+}
@@ -0,0 +1,195 @@
+#include "BVHCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+uint64_t BVHCache::hashBytes(const void *_data, size_t _size, uint64_t _hash)
+{
+  // eight bytes at a time as a multiply and shift mix, quick enough to hash a few hundred MB on every start up
+  const unsigned char *bytes = static_cast<const unsigned char *>(_data);
+  size_t i = 0;
+  for (; i + 8 <= _size; i += 8)
+  {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(word));
+    _hash = (_hash ^ word) * 0x9e3779b97f4a7c15ull;
+    _hash ^= _hash >> 32;
+  }
+  for (; i < _size; ++i)
+  {
+    _hash = (_hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return _hash;
+}
+
+uint64_t BVHCache::meshHash(const IndexedMesh &_mesh)
+{
+  const uint64_t sizes[2] = {_mesh.numVertices(), _mesh.numTriangles()};
+  uint64_t hash = hashBytes(sizes, sizeof(sizes), 0xcbf29ce484222325ull);
+  hash = hashBytes(_mesh.m_x.data(), _mesh.m_x.size() * sizeof(float), hash);
+  hash = hashBytes(_mesh.m_y.data(), _mesh.m_y.size() * sizeof(float), hash);
+  hash = hashBytes(_mesh.m_z.data(), _mesh.m_z.size() * sizeof(float), hash);
+  return hashBytes(_mesh.m_indices.data(), _mesh.m_indices.size() * sizeof(uint32_t), hash);
+}
+
+bool BVHCache::loadOrBuild(const std::string &_fileName, const IndexedMesh &_mesh, BVH4 &o_bvh, uint32_t _maxLeafSize)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  const uint64_t hash = meshHash(_mesh);
+  const uint32_t numTriangles = static_cast<uint32_t>(_mesh.numTriangles());
+  bool cached = load(_fileName, hash, numTriangles, _maxLeafSize, o_bvh);
+  if (!cached)
+  {
+    std::vector<AABB> bounds(numTriangles);
+    for (uint32_t i = 0; i < numTriangles; ++i)
+    {
+      bounds[i].extend(_mesh.corner(i, 0));
+      bounds[i].extend(_mesh.corner(i, 1));
+      bounds[i].extend(_mesh.corner(i, 2));
+    }
+    o_bvh.build(bounds, _maxLeafSize);
+    if (!write(_fileName, hash, o_bvh))
+    {
+      m_staleReason += ", unable to write " + _fileName;
+    }
+  }
+  m_loadTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  return cached;
+}
+
+bool BVHCache::load(const std::string &_fileName, uint64_t _meshHash, uint32_t _numTriangles, uint32_t _maxLeafSize, BVH4 &o_bvh)
+{
+  m_staleReason.clear();
+  m_file.close();
+  // the traversal jumps about the nodes so reading ahead would only fetch pages it doesn't want
+  if (!m_file.open(_fileName, MappedFile::Access::Random))
+  {
+    m_staleReason = "no cache file";
+    return false;
+  }
+  auto stale = [&](const char *_reason)
+  {
+    m_staleReason = _reason;
+    m_file.close();
+    return false;
+  };
+  Header header;
+  if (m_file.size() < sizeof(Header))
+  {
+    return stale("file too small");
+  }
+  std::memcpy(&header, m_file.data(), sizeof(Header));
+  if (std::memcmp(header.m_magic, s_magic, sizeof(s_magic)) != 0 || header.m_byteOrder != s_byteOrder)
+  {
+    return stale("not a BVH cache for this machine");
+  }
+  if (header.m_version != s_version || header.m_nodeSize != sizeof(BVH4Node))
+  {
+    return stale("written by a different version");
+  }
+  if (header.m_headerHash != hashBytes(&header, offsetof(Header, m_headerHash), 0))
+  {
+    return stale("corrupt header");
+  }
+  if (header.m_meshHash != _meshHash || header.m_numPrims != _numTriangles || header.m_maxLeafSize != _maxLeafSize)
+  {
+    return stale("built for a different mesh");
+  }
+  const uint64_t nodeBytes = static_cast<uint64_t>(header.m_numNodes) * sizeof(BVH4Node);
+  const uint64_t primBytes = static_cast<uint64_t>(header.m_numPrims) * sizeof(uint32_t);
+  if (header.m_fileSize != m_file.size() || header.m_nodeOffset % s_alignment != 0 || header.m_primOffset % sizeof(uint32_t) != 0 ||
+      header.m_nodeOffset < sizeof(Header) || header.m_nodeOffset + nodeBytes > m_file.size() ||
+      header.m_primOffset < header.m_nodeOffset + nodeBytes || header.m_primOffset + primBytes > m_file.size() ||
+      (header.m_numNodes == 0) != (header.m_numPrims == 0))
+  {
+    return stale("truncated or badly laid out");
+  }
+  const BVH4Node *nodes = reinterpret_cast<const BVH4Node *>(m_file.data() + header.m_nodeOffset);
+  const uint32_t *prims = reinterpret_cast<const uint32_t *>(m_file.data() + header.m_primOffset);
+  // a bad index would send the traversal outside the mapping, children are always stored after their parent so
+  // checking that also rules out loops. That order also means a node's depth is known before its children are
+  // reached, a chain deeper than a build can make would overflow the traversal stack.
+  std::vector<uint8_t> depth(header.m_numNodes, 0);
+  for (uint32_t n = 0; n < header.m_numNodes; ++n)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      const uint32_t child = nodes[n].m_child[i];
+      const uint32_t count = nodes[n].m_count[i];
+      bool valid = count == 0 ? child == BVH4::s_emptySlot || (child > n && child < header.m_numNodes)
+                              : count <= header.m_numPrims && child <= header.m_numPrims - count;
+      if (!valid)
+      {
+        return stale("node references out of range");
+      }
+      if (count == 0 && child != BVH4::s_emptySlot)
+      {
+        if (depth[n] >= BVH4::s_maxDepth)
+        {
+          return stale("tree too deep");
+        }
+        depth[child] = std::max(depth[child], static_cast<uint8_t>(depth[n] + 1));
+      }
+    }
+  }
+  for (uint32_t i = 0; i < header.m_numPrims; ++i)
+  {
+    if (prims[i] >= _numTriangles)
+    {
+      return stale("primitive index out of range");
+    }
+  }
+  AABB bounds;
+  bounds.m_min.set(header.m_bounds[0], header.m_bounds[1], header.m_bounds[2]);
+  bounds.m_max.set(header.m_bounds[3], header.m_bounds[4], header.m_bounds[5]);
+  o_bvh.attach(nodes, header.m_numNodes, prims, header.m_numPrims, bounds, header.m_maxLeafSize);
+  return true;
+}
+
+bool BVHCache::write(const std::string &_fileName, uint64_t _meshHash, const BVH4 &_bvh)
+{
+  Header header;
+  std::memset(&header, 0, sizeof(Header));
+  std::memcpy(header.m_magic, s_magic, sizeof(s_magic));
+  header.m_version = s_version;
+  header.m_byteOrder = s_byteOrder;
+  header.m_nodeSize = sizeof(BVH4Node);
+  header.m_maxLeafSize = _bvh.maxLeafSize();
+  header.m_meshHash = _meshHash;
+  header.m_numNodes = _bvh.numNodes();
+  header.m_numPrims = _bvh.numPrims();
+  header.m_nodeOffset = (sizeof(Header) + s_alignment - 1) / s_alignment * s_alignment;
+  header.m_primOffset = header.m_nodeOffset + static_cast<uint64_t>(header.m_numNodes) * sizeof(BVH4Node);
+  header.m_fileSize = header.m_primOffset + static_cast<uint64_t>(header.m_numPrims) * sizeof(uint32_t);
+  const AABB &b = _bvh.bounds();
+  const float bounds[6] = {b.m_min.m_x, b.m_min.m_y, b.m_min.m_z, b.m_max.m_x, b.m_max.m_y, b.m_max.m_z};
+  std::memcpy(header.m_bounds, bounds, sizeof(bounds));
+  header.m_headerHash = hashBytes(&header, offsetof(Header, m_headerHash), 0);
+
+  const std::string tempName = _fileName + ".tmp";
+  {
+    std::ofstream file(tempName, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+      return false;
+    }
+    const char padding[s_alignment] = {};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+    file.write(padding, static_cast<std::streamsize>(header.m_nodeOffset - sizeof(Header)));
+    file.write(reinterpret_cast<const char *>(_bvh.nodeData()), static_cast<std::streamsize>(header.m_numNodes * sizeof(BVH4Node)));
+    file.write(reinterpret_cast<const char *>(_bvh.primIndexData()), static_cast<std::streamsize>(header.m_numPrims * sizeof(uint32_t)));
+    if (!file.good())
+    {
+      file.close();
+      std::remove(tempName.c_str());
+      return false;
+    }
+  }
+  // rename won't replace an existing file everywhere so remove the old one first
+  std::remove(_fileName.c_str());
+  return std::rename(tempName.c_str(), _fileName.c_str()) == 0;
+}
@@ -0,0 +1,44 @@
+#include "IndexedMesh.h"
+#include <ngl/Util.h>
+
+ngl::Vec3 IndexedMesh::faceNormal(size_t _tri) const
+{
+  return ngl::calcNormal(corner(_tri, 0), corner(_tri, 1), corner(_tri, 2));
+}
+
+void IndexedMesh::interleavedPositions(std::vector<ngl::Vec3> &o_positions) const
+{
+  o_positions.resize(numVertices());
+  for (uint32_t i = 0; i < o_positions.size(); ++i)
+  {
+    o_positions[i] = vertex(i);
+  }
+}
+
+void IndexedMesh::vertexNormals(std::vector<ngl::Vec3> &o_normals) const
+{
+  o_normals.assign(numVertices(), ngl::Vec3(0.0f, 0.0f, 0.0f));
+  for (size_t t = 0; t < numTriangles(); ++t)
+  {
+    const uint32_t *index = &m_indices[t * 3];
+    const ngl::Vec3 v0 = vertex(index[0]);
+    // the length of the cross product is twice the area so big faces count for more, the direction comes from
+    // calcNormal so it faces the same way as the drawable triangles
+    const float area = (vertex(index[1]) - v0).cross(vertex(index[2]) - v0).length();
+    if (area == 0.0f)
+    {
+      continue;
+    }
+    ngl::Vec3 n = faceNormal(t) * area;
+    o_normals[index[0]] += n;
+    o_normals[index[1]] += n;
+    o_normals[index[2]] += n;
+  }
+  for (auto &n : o_normals)
+  {
+    if (n.lengthSquared() > 0.0f)
+    {
+      n.normalize();
+    }
+  }
+}
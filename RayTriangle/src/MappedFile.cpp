@@ -0,0 +1,81 @@
+#include "MappedFile.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPEDFILE_USE_MMAP
+#else
+#include <fstream>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const std::string &_fileName, Access _access)
+{
+  close();
+#ifdef MAPPEDFILE_USE_MMAP
+  int fd = ::open(_fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  m_size = static_cast<size_t>(info.st_size);
+  if (m_size == 0)
+  {
+    // an empty file can't be mapped but is still a valid file
+    ::close(fd);
+    m_buffer.assign(1, 0);
+    m_data = m_buffer.data();
+    return true;
+  }
+  void *addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  ::close(fd);
+  if (addr == MAP_FAILED)
+  {
+    m_size = 0;
+    return false;
+  }
+  madvise(addr, m_size, _access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+  m_data = static_cast<const char *>(addr);
+  m_mapped = true;
+  return true;
+#else
+  std::ifstream file(_fileName, std::ios::binary | std::ios::ate);
+  if (!file.is_open())
+  {
+    return false;
+  }
+  m_size = static_cast<size_t>(file.tellg());
+  m_buffer.resize(m_size + 1);
+  file.seekg(0);
+  file.read(m_buffer.data(), static_cast<std::streamsize>(m_size));
+  m_data = m_buffer.data();
+  return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifdef MAPPEDFILE_USE_MMAP
+  if (m_mapped)
+  {
+    munmap(const_cast<char *>(m_data), m_size);
+  }
+#endif
+  m_data = nullptr;
+  m_size = 0;
+  m_mapped = false;
+  m_buffer.clear();
+  m_buffer.shrink_to_fit();
+}
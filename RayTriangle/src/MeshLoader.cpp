@@ -0,0 +1,705 @@
+#include "MeshLoader.h"
+#include "MappedFile.h"
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+MeshLoader::MeshLoader(unsigned int _numThreads)
+{
+  m_numThreads = _numThreads != 0 ? _numThreads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+size_t MeshLoader::peakMemoryUsage()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+  {
+    return 0;
+  }
+#if defined(__APPLE__)
+  // macOS reports bytes, Linux kilobytes
+  return static_cast<size_t>(usage.ru_maxrss);
+#else
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+bool MeshLoader::load(const std::string &_fileName, IndexedMesh &o_mesh)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  m_error.clear();
+  o_mesh.clear();
+  std::string extension = _fileName.substr(std::min(_fileName.size(), _fileName.rfind('.')));
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char _c)
+                 { return static_cast<char>(std::tolower(_c)); });
+  if (extension != ".obj" && extension != ".ply")
+  {
+    m_error = "unknown mesh format " + extension + ", expected .obj or .ply";
+    return false;
+  }
+  MappedFile file;
+  if (!file.open(_fileName))
+  {
+    m_error = "unable to open " + _fileName;
+    return false;
+  }
+  bool loaded = extension == ".obj" ? loadOBJ(file.data(), file.size(), o_mesh) : loadPLY(file.data(), file.size(), o_mesh);
+  if (!loaded)
+  {
+    o_mesh.clear();
+  }
+  m_loadTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  return loaded;
+}
+
+std::vector<const char *> MeshLoader::splitLines(const char *_data, size_t _size, size_t _numChunks)
+{
+  const char *end = _data + _size;
+  std::vector<const char *> bounds(1, _data);
+  const size_t chunkSize = std::max<size_t>(1 << 16, _size / std::max<size_t>(1, _numChunks));
+  for (const char *p = _data + chunkSize; p < end; p += chunkSize)
+  {
+    // move the split to just after the next newline so no line is cut in two
+    const char *newline = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (newline == nullptr)
+    {
+      break;
+    }
+    p = newline + 1;
+    bounds.push_back(p);
+  }
+  if (bounds.back() != end)
+  {
+    bounds.push_back(end);
+  }
+  return bounds;
+}
+
+const char *MeshLoader::skipSpace(const char *_p, const char *_end)
+{
+  while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\r'))
+  {
+    ++_p;
+  }
+  return _p;
+}
+
+const char *MeshLoader::parseInt(const char *_p, const char *_end, long long &o_value)
+{
+  bool negative = false;
+  if (_p < _end && (*_p == '-' || *_p == '+'))
+  {
+    negative = *_p++ == '-';
+  }
+  const char *digits = _p;
+  long long value = 0;
+  while (_p < _end && *_p >= '0' && *_p <= '9')
+  {
+    value = value * 10 + (*_p++ - '0');
+  }
+  if (_p == digits)
+  {
+    return nullptr;
+  }
+  o_value = negative ? -value : value;
+  return _p;
+}
+
+const char *MeshLoader::parseFloat(const char *_p, const char *_end, float &o_value)
+{
+  // strtod is locale dependent and much slower, meshes only need plain decimal and exponent forms
+  static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  bool negative = false;
+  if (_p < _end && (*_p == '-' || *_p == '+'))
+  {
+    negative = *_p++ == '-';
+  }
+  const char *digits = _p;
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int numDigits = 0;
+  for (; _p < _end && *_p >= '0' && *_p <= '9'; ++_p)
+  {
+    // digits past what a 64 bit int holds only change the exponent
+    if (numDigits < 19)
+    {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*_p - '0');
+      numDigits += mantissa != 0;
+    }
+    else
+    {
+      ++exponent;
+    }
+  }
+  if (_p < _end && *_p == '.')
+  {
+    for (++_p; _p < _end && *_p >= '0' && *_p <= '9'; ++_p)
+    {
+      if (numDigits < 19)
+      {
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*_p - '0');
+        numDigits += mantissa != 0;
+        --exponent;
+      }
+    }
+  }
+  if (_p == digits || (_p == digits + 1 && *digits == '.'))
+  {
+    return nullptr;
+  }
+  if (_p < _end && (*_p == 'e' || *_p == 'E'))
+  {
+    long long e = 0;
+    const char *next = parseInt(_p + 1, _end, e);
+    if (next != nullptr)
+    {
+      exponent += static_cast<int>(std::max(-400LL, std::min(400LL, e)));
+      _p = next;
+    }
+  }
+  double value = static_cast<double>(mantissa);
+  while (exponent > 22)
+  {
+    value *= 1e22;
+    exponent -= 22;
+  }
+  while (exponent < -22)
+  {
+    value /= 1e22;
+    exponent += 22;
+  }
+  value = exponent >= 0 ? value * powers[exponent] : value / powers[-exponent];
+  o_value = static_cast<float>(negative ? -value : value);
+  return _p;
+}
+
+bool MeshLoader::loadOBJ(const char *_data, size_t _size, IndexedMesh &o_mesh)
+{
+  const std::vector<const char *> chunks = splitLines(_data, _size, m_numThreads * 8);
+  const size_t numChunks = chunks.size() - 1;
+  // first pass counts what each chunk holds, a polygon with n corners is n-2 triangles
+  std::vector<size_t> vertexStart(numChunks + 1, 0);
+  std::vector<size_t> triangleStart(numChunks + 1, 0);
+  parallelFor(numChunks, [&](size_t _chunk)
+              {
+                const char *end = chunks[_chunk + 1];
+                size_t numVertices = 0;
+                size_t numTriangles = 0;
+                for (const char *p = chunks[_chunk]; p < end;)
+                {
+                  const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+                  lineEnd = lineEnd != nullptr ? lineEnd : end;
+                  p = skipSpace(p, lineEnd);
+                  if (p + 1 < lineEnd && (p[1] == ' ' || p[1] == '\t'))
+                  {
+                    if (p[0] == 'v')
+                    {
+                      ++numVertices;
+                    }
+                    else if (p[0] == 'f')
+                    {
+                      size_t corners = 0;
+                      for (p = skipSpace(p + 1, lineEnd); p < lineEnd; p = skipSpace(p, lineEnd))
+                      {
+                        ++corners;
+                        while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+                        {
+                          ++p;
+                        }
+                      }
+                      numTriangles += corners > 2 ? corners - 2 : 0;
+                    }
+                  }
+                  p = lineEnd + 1;
+                }
+                vertexStart[_chunk + 1] = numVertices;
+                triangleStart[_chunk + 1] = numTriangles;
+              });
+  for (size_t i = 0; i < numChunks; ++i)
+  {
+    vertexStart[i + 1] += vertexStart[i];
+    triangleStart[i + 1] += triangleStart[i];
+  }
+  const size_t numVertices = vertexStart[numChunks];
+  if (numVertices > UINT32_MAX)
+  {
+    m_error = "too many vertices for 32 bit indices";
+    return false;
+  }
+  o_mesh.resize(numVertices, triangleStart[numChunks]);
+  // second pass writes each chunk's vertices and triangles into its own part of the arrays
+  std::atomic<bool> failed(false);
+  parallelFor(numChunks, [&](size_t _chunk)
+              {
+                const char *end = chunks[_chunk + 1];
+                size_t vertex = vertexStart[_chunk];
+                uint32_t *index = &o_mesh.m_indices[triangleStart[_chunk] * 3];
+                for (const char *p = chunks[_chunk]; p < end && !failed;)
+                {
+                  const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+                  lineEnd = lineEnd != nullptr ? lineEnd : end;
+                  p = skipSpace(p, lineEnd);
+                  if (p + 1 < lineEnd && (p[1] == ' ' || p[1] == '\t'))
+                  {
+                    if (p[0] == 'v')
+                    {
+                      float xyz[3];
+                      p += 1;
+                      for (int i = 0; i < 3 && p != nullptr; ++i)
+                      {
+                        p = parseFloat(skipSpace(p, lineEnd), lineEnd, xyz[i]);
+                      }
+                      if (p == nullptr)
+                      {
+                        failed = true;
+                        break;
+                      }
+                      o_mesh.m_x[vertex] = xyz[0];
+                      o_mesh.m_y[vertex] = xyz[1];
+                      o_mesh.m_z[vertex] = xyz[2];
+                      ++vertex;
+                    }
+                    else if (p[0] == 'f')
+                    {
+                      // only the position index of each v/vt/vn corner is used
+                      uint32_t first = 0;
+                      uint32_t previous = 0;
+                      int corner = 0;
+                      for (p = skipSpace(p + 1, lineEnd); p < lineEnd; p = skipSpace(p, lineEnd), ++corner)
+                      {
+                        long long i = 0;
+                        p = parseInt(p, lineEnd, i);
+                        // OBJ indices start at 1, 0 isn't a vertex
+                        if (p == nullptr || i == 0)
+                        {
+                          failed = true;
+                          break;
+                        }
+                        // negative indices count back from the last vertex read
+                        i = i > 0 ? i - 1 : static_cast<long long>(vertex) + i;
+                        if (i < 0 || i >= static_cast<long long>(numVertices))
+                        {
+                          failed = true;
+                          break;
+                        }
+                        while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+                        {
+                          ++p;
+                        }
+                        const uint32_t current = static_cast<uint32_t>(i);
+                        if (corner == 0)
+                        {
+                          first = current;
+                        }
+                        else if (corner >= 2)
+                        {
+                          *index++ = first;
+                          *index++ = previous;
+                          *index++ = current;
+                        }
+                        previous = current;
+                      }
+                      if (failed)
+                      {
+                        break;
+                      }
+                    }
+                  }
+                  p = lineEnd + 1;
+                }
+              });
+  if (failed)
+  {
+    m_error = "badly formed vertex or face index";
+    return false;
+  }
+  return true;
+}
+
+size_t MeshLoader::plySize(PlyType _type)
+{
+  static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+  return sizes[static_cast<int>(_type)];
+}
+
+double MeshLoader::readPly(const char *_p, PlyType _type, bool _swap)
+{
+  // copy the bytes out as the data has no alignment, reversing them if the file's byte order isn't ours
+  char bytes[8];
+  const size_t size = plySize(_type);
+  for (size_t i = 0; i < size; ++i)
+  {
+    bytes[i] = _p[_swap ? size - 1 - i : i];
+  }
+  switch (_type)
+  {
+  case PlyType::Int8:
+    return static_cast<signed char>(bytes[0]);
+  case PlyType::UInt8:
+    return static_cast<unsigned char>(bytes[0]);
+  case PlyType::Int16:
+  {
+    int16_t v;
+    std::memcpy(&v, bytes, sizeof(v));
+    return v;
+  }
+  case PlyType::UInt16:
+  {
+    uint16_t v;
+    std::memcpy(&v, bytes, sizeof(v));
+    return v;
+  }
+  case PlyType::Int32:
+  {
+    int32_t v;
+    std::memcpy(&v, bytes, sizeof(v));
+    return v;
+  }
+  case PlyType::UInt32:
+  {
+    uint32_t v;
+    std::memcpy(&v, bytes, sizeof(v));
+    return v;
+  }
+  case PlyType::Float32:
+  {
+    float v;
+    std::memcpy(&v, bytes, sizeof(v));
+    return v;
+  }
+  case PlyType::Float64:
+  {
+    double v;
+    std::memcpy(&v, bytes, sizeof(v));
+    return v;
+  }
+  }
+  return 0.0;
+}
+
+bool MeshLoader::parsePlyType(const std::string &_name, PlyType &o_type)
+{
+  static const char *names[][2] = {{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+                                   {"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}};
+  for (int i = 0; i < 8; ++i)
+  {
+    if (_name == names[i][0] || _name == names[i][1])
+    {
+      o_type = static_cast<PlyType>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool MeshLoader::loadPLY(const char *_data, size_t _size, IndexedMesh &o_mesh)
+{
+  const char *end = _data + _size;
+  // the header is plain text ending with an end_header line, the binary data starts on the next line
+  const char *headerEnd = nullptr;
+  for (const char *p = _data; p < end && headerEnd == nullptr;)
+  {
+    const char *lineEnd = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (lineEnd == nullptr)
+    {
+      break;
+    }
+    if (std::strncmp(p, "end_header", 10) == 0)
+    {
+      headerEnd = lineEnd + 1;
+    }
+    p = lineEnd + 1;
+  }
+  if (_size < 3 || std::strncmp(_data, "ply", 3) != 0 || headerEnd == nullptr)
+  {
+    m_error = "not a PLY file";
+    return false;
+  }
+  std::istringstream header(std::string(_data, headerEnd));
+  std::vector<PlyElement> elements;
+  bool bigEndian = false;
+  std::string line;
+  while (std::getline(header, line))
+  {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "format")
+    {
+      std::string format;
+      words >> format;
+      if (format != "binary_little_endian" && format != "binary_big_endian")
+      {
+        m_error = "only binary PLY files are supported";
+        return false;
+      }
+      bigEndian = format == "binary_big_endian";
+    }
+    else if (keyword == "element")
+    {
+      PlyElement element;
+      words >> element.m_name >> element.m_count;
+      elements.push_back(element);
+    }
+    else if (keyword == "property" && !elements.empty())
+    {
+      PlyProperty property;
+      std::string type;
+      words >> type;
+      bool valid = true;
+      if (type == "list")
+      {
+        std::string countType;
+        words >> countType >> type;
+        property.m_list = true;
+        valid = parsePlyType(countType, property.m_countType);
+      }
+      words >> property.m_name;
+      if (!valid || !parsePlyType(type, property.m_type))
+      {
+        m_error = "unknown PLY property type in \"" + line + "\"";
+        return false;
+      }
+      elements.back().m_properties.push_back(property);
+    }
+  }
+  const uint16_t one = 1;
+  const bool swap = bigEndian != (*reinterpret_cast<const unsigned char *>(&one) == 0);
+  // step _p over one value of a property, or return nullptr if the data runs out
+  auto skipProperty = [&](const PlyProperty &_property, const char *_p) -> const char *
+  {
+    if (_property.m_list)
+    {
+      if (plySize(_property.m_countType) > static_cast<size_t>(end - _p))
+      {
+        return nullptr;
+      }
+      // the count comes from the file so it is range checked as a double before it is converted or multiplied
+      const double count = readPly(_p, _property.m_countType, swap);
+      _p += plySize(_property.m_countType);
+      if (count < 0.0 || count > static_cast<double>(static_cast<size_t>(end - _p) / plySize(_property.m_type)))
+      {
+        return nullptr;
+      }
+      return _p + static_cast<size_t>(count) * plySize(_property.m_type);
+    }
+    return plySize(_property.m_type) <= static_cast<size_t>(end - _p) ? _p + plySize(_property.m_type) : nullptr;
+  };
+  const char *p = headerEnd;
+  bool haveVertices = false;
+  bool haveFaces = false;
+  for (auto &element : elements)
+  {
+    if (element.m_name == "vertex")
+    {
+      // vertices are a fixed size so each thread can go straight to its own range
+      size_t stride = 0;
+      size_t offset[3] = {0, 0, 0};
+      PlyType type[3] = {PlyType::Float32, PlyType::Float32, PlyType::Float32};
+      int found = 0;
+      for (auto &property : element.m_properties)
+      {
+        if (property.m_list)
+        {
+          m_error = "list properties on PLY vertices are not supported";
+          return false;
+        }
+        for (int axis = 0; axis < 3; ++axis)
+        {
+          if (property.m_name == std::string(1, static_cast<char>('x' + axis)))
+          {
+            offset[axis] = stride;
+            type[axis] = property.m_type;
+            found |= 1 << axis;
+          }
+        }
+        stride += plySize(property.m_type);
+      }
+      if (found != 7 || element.m_count > static_cast<size_t>(end - p) / stride)
+      {
+        m_error = "PLY vertices need x y and z and the file must hold all of them";
+        return false;
+      }
+      if (element.m_count > UINT32_MAX)
+      {
+        m_error = "too many vertices for 32 bit indices";
+        return false;
+      }
+      o_mesh.m_x.resize(element.m_count);
+      o_mesh.m_y.resize(element.m_count);
+      o_mesh.m_z.resize(element.m_count);
+      constexpr size_t blockSize = 1 << 16;
+      const char *vertices = p;
+      const bool fastPath = !swap && type[0] == PlyType::Float32 && type[1] == PlyType::Float32 && type[2] == PlyType::Float32;
+      parallelFor((element.m_count + blockSize - 1) / blockSize, [&](size_t _block)
+                  {
+                    const size_t last = std::min(element.m_count, (_block + 1) * blockSize);
+                    for (size_t i = _block * blockSize; i < last; ++i)
+                    {
+                      const char *v = vertices + i * stride;
+                      if (fastPath)
+                      {
+                        std::memcpy(&o_mesh.m_x[i], v + offset[0], sizeof(float));
+                        std::memcpy(&o_mesh.m_y[i], v + offset[1], sizeof(float));
+                        std::memcpy(&o_mesh.m_z[i], v + offset[2], sizeof(float));
+                      }
+                      else
+                      {
+                        o_mesh.m_x[i] = static_cast<float>(readPly(v + offset[0], type[0], swap));
+                        o_mesh.m_y[i] = static_cast<float>(readPly(v + offset[1], type[1], swap));
+                        o_mesh.m_z[i] = static_cast<float>(readPly(v + offset[2], type[2], swap));
+                      }
+                    }
+                  });
+      p += element.m_count * stride;
+      haveVertices = true;
+    }
+    else if (element.m_name == "face")
+    {
+      const PlyProperty *indices = nullptr;
+      for (auto &property : element.m_properties)
+      {
+        if (property.m_list && (property.m_name == "vertex_indices" || property.m_name == "vertex_index"))
+        {
+          indices = &property;
+        }
+      }
+      if (indices == nullptr || !haveVertices)
+      {
+        m_error = "PLY faces need a vertex_indices list and must come after the vertices";
+        return false;
+      }
+      // faces can have any number of corners so a quick serial walk over the counts finds where every block of
+      // faces starts in the file and in the index buffer, then the blocks are decoded in parallel
+      constexpr size_t blockSize = 1 << 14;
+      // every face takes at least a byte, checked before the count from the file sizes anything
+      if (element.m_count > static_cast<size_t>(end - p))
+      {
+        m_error = "PLY file ends part way through the faces";
+        return false;
+      }
+      const size_t numBlocks = (element.m_count + blockSize - 1) / blockSize;
+      std::vector<const char *> blockData(numBlocks);
+      std::vector<size_t> blockTriangle(numBlocks + 1, 0);
+      size_t numTriangles = 0;
+      for (size_t i = 0; i < element.m_count; ++i)
+      {
+        if (i % blockSize == 0)
+        {
+          blockData[i / blockSize] = p;
+          blockTriangle[i / blockSize] = numTriangles;
+        }
+        const char *item = p;
+        for (auto &property : element.m_properties)
+        {
+          const char *next = skipProperty(property, item);
+          if (next == nullptr)
+          {
+            m_error = "PLY file ends part way through the faces";
+            return false;
+          }
+          if (&property == indices)
+          {
+            // skipProperty() has already checked the count fits in the file
+            size_t corners = static_cast<size_t>(readPly(item, property.m_countType, swap));
+            numTriangles += corners > 2 ? corners - 2 : 0;
+          }
+          item = next;
+        }
+        p = item;
+      }
+      blockTriangle[numBlocks] = numTriangles;
+      o_mesh.m_indices.resize(numTriangles * 3);
+      const uint32_t numVertices = static_cast<uint32_t>(o_mesh.numVertices());
+      std::atomic<bool> badIndex(false);
+      parallelFor(numBlocks, [&](size_t _block)
+                  {
+                    const char *item = blockData[_block];
+                    uint32_t *index = &o_mesh.m_indices[blockTriangle[_block] * 3];
+                    const size_t last = std::min(element.m_count, (_block + 1) * blockSize);
+                    for (size_t i = _block * blockSize; i < last; ++i)
+                    {
+                      for (auto &property : element.m_properties)
+                      {
+                        if (!property.m_list)
+                        {
+                          item += plySize(property.m_type);
+                          continue;
+                        }
+                        const size_t corners = static_cast<size_t>(readPly(item, property.m_countType, swap));
+                        item += plySize(property.m_countType);
+                        if (&property == indices)
+                        {
+                          const size_t indexSize = plySize(property.m_type);
+                          uint32_t first = 0;
+                          uint32_t previous = 0;
+                          for (size_t c = 0; c < corners; ++c)
+                          {
+                            const double value = readPly(item + c * indexSize, property.m_type, swap);
+                            // converting an out of range double is undefined so a bad index is written as 0
+                            uint32_t current = 0;
+                            if (value < 0.0 || value >= numVertices)
+                            {
+                              badIndex = true;
+                            }
+                            else
+                            {
+                              current = static_cast<uint32_t>(value);
+                            }
+                            if (c == 0)
+                            {
+                              first = current;
+                            }
+                            else if (c >= 2)
+                            {
+                              *index++ = first;
+                              *index++ = previous;
+                              *index++ = current;
+                            }
+                            previous = current;
+                          }
+                        }
+                        item += corners * plySize(property.m_type);
+                      }
+                    }
+                  });
+      if (badIndex)
+      {
+        m_error = "PLY face index out of range";
+        return false;
+      }
+      haveFaces = true;
+    }
+    else
+    {
+      // anything else such as edges is skipped
+      for (size_t i = 0; i < element.m_count && p != nullptr; ++i)
+      {
+        for (size_t j = 0; j < element.m_properties.size() && p != nullptr; ++j)
+        {
+          p = skipProperty(element.m_properties[j], p);
+        }
+      }
+      if (p == nullptr)
+      {
+        m_error = "PLY file ends part way through element " + element.m_name;
+        return false;
+      }
+    }
+  }
+  if (!haveFaces)
+  {
+    m_error = "PLY file has no faces";
+    return false;
+  }
+  return true;
+}
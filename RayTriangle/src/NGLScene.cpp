@@ -7,15 +7,121 @@
 #include <ngl/Random.h>
 #include <ngl/VAOFactory.h>
 #include <ngl/SimpleVAO.h>
+#include <ngl/Util.h>
+#include <algorithm>
+#include <bitset>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include "BVHCache.h"
+#include "MeshLoader.h"
+#include "MultiBufferIndexVAO.h"
+#include "QuantisedMesh.h"
+#include "TileRenderer.h"
+#include "TwoLevelBVH.h"
 
-NGLScene::NGLScene(int _numTriangles)
+NGLScene::NGLScene(int _numTriangles, const std::string &_meshFile)
 {
   m_numTriangles = _numTriangles;
   setTitle("Ray->Triangle Intersections");
   // create the points for our ray
   m_rayStart.set(0, 0, 0.2f);
   m_rayEnd.set(0, 0, -20);
+  // Now we will create a basic Camera from the graphics library
+  // This is a static camera so it only needs to be set once
+  // First create Values for the camera position
+  ngl::Vec3 from(0.0f, 1.0f, 15.0f);
+  ngl::Vec3 to(0.0f, 0.0f, 0.0f);
+  ngl::Vec3 up(0.0f, 1.0f, 0.0f);
+  m_view = ngl::lookAt(from, to, up);
+  // set the shape using FOV 45 Aspect Ratio based on Width and Height
+  // The final two are near and far clipping planes of 0.5 and 10
+  m_project = ngl::perspective(45.0f, 720.0f / 576.0f, 0.5f, 150.0f);
+  if (!_meshFile.empty())
+  {
+    MeshLoader loader;
+    m_meshFromFile = loader.load(_meshFile, m_mesh);
+    if (m_meshFromFile)
+    {
+      std::cout << "Loaded " << _meshFile << " " << m_mesh.numVertices() << " vertices " << m_mesh.numTriangles()
+                << " triangles in " << loader.loadTime() * 1000.0 << " ms, mesh " << m_mesh.memoryUsage() / (1024 * 1024)
+                << " MB peak memory " << MeshLoader::peakMemoryUsage() / (1024 * 1024) << " MB\n";
+    }
+    else
+    {
+      std::cerr << "Unable to load " << _meshFile << " " << loader.error() << ", using random triangles\n";
+    }
+  }
+  // the triangle positions and the ray query structures need no GL, only the drawable triangles are made in
+  // initializeGL
+  if (!m_meshFromFile)
+  {
+    for (int i = 0; i < m_numTriangles; ++i)
+    {
+      ngl::Vec3 c = ngl::Random::getRandomVec3() * 10.0f;
+      ngl::Vec3 v0(ngl::Random::randomNumber(2) + 0.1f, ngl::Random::randomNumber(2) + 0.1f, -ngl::Random::randomPositiveNumber(2) + 0.1f);
+      ngl::Vec3 v1(ngl::Random::randomNumber(2) + 0.1f, ngl::Random::randomNumber(2) + 0.1f, -ngl::Random::randomPositiveNumber(2) + 0.1f);
+      ngl::Vec3 v2(ngl::Random::randomNumber(2) + 0.1f, ngl::Random::randomNumber(2) + 0.1f, -ngl::Random::randomPositiveNumber(2) + 0.1f);
+      uint32_t i0 = m_mesh.addVertex(c + v0);
+      uint32_t i1 = m_mesh.addVertex(c + v1);
+      uint32_t i2 = m_mesh.addVertex(c + v2);
+      m_mesh.addTriangle(i0, i1, i2);
+    }
+  }
+  // the triangles don't move so the tree is only built once
+  size_t numTriangles = m_mesh.numTriangles();
+  if (m_meshFromFile)
+  {
+    // the tree of a loaded mesh is kept in a file next to it and mapped straight in on later runs
+    bool cached = m_bvhCache.loadOrBuild(_meshFile + ".bvh4", m_mesh, m_bvh);
+    std::cout << (cached ? "Mapped BVH cache in " : "Built BVH (" + m_bvhCache.staleReason() + ") in ")
+              << m_bvhCache.loadTime() * 1000.0 << " ms\n";
+  }
+  else
+  {
+    std::vector<AABB> bounds(numTriangles);
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+      bounds[i].extend(m_mesh.corner(i, 0));
+      bounds[i].extend(m_mesh.corner(i, 1));
+      bounds[i].extend(m_mesh.corner(i, 2));
+    }
+    m_bvh.build(bounds);
+    // the random triangles are there to compare query structures so they also get a record each and the SoA
+    // blocks, a loaded mesh is only ever queried from the shared vertices so it doesn't carry copies of them
+    m_triAccel.resize(numTriangles);
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+      m_triAccel[i] = TriAccel(m_mesh.corner(i, 0), m_mesh.corner(i, 1), m_mesh.corner(i, 2));
+    }
+    m_triSoA.build(m_triAccel, m_bvh.primIndexData());
+  }
+  if (m_meshFromFile && !m_bvh.bounds().isEmpty())
+  {
+    // a loaded mesh can be any size, the random triangles fill a sphere of about radius 12 so scale to match
+    m_sceneCentre = (m_bvh.bounds().m_min + m_bvh.bounds().m_max) * 0.5f;
+    m_sceneScale = std::max((m_bvh.bounds().m_max - m_sceneCentre).length(), FLT_MIN) / 12.0f;
+    m_view = ngl::lookAt(toScene(from), toScene(to), up);
+  }
+  reportMemory();
+}
+
+void NGLScene::reportMemory() const
+{
+  // a Triangle costs the same whatever it holds so its size is shown even when none are made
+  const double numTriangles = static_cast<double>(std::max<size_t>(1, m_mesh.numTriangles()));
+  const size_t meshGPU = m_mesh.numVertices() * 2 * sizeof(ngl::Vec3) + m_mesh.m_indices.size() * sizeof(uint32_t);
+  std::cout << "Bytes per triangle, Triangle objects " << Triangle::memoryUsage() << " CPU " << Triangle::gpuMemoryUsage()
+            << " GPU, indexed mesh " << m_mesh.memoryUsage() / numTriangles << " CPU " << meshGPU / numTriangles << " GPU ("
+            << m_mesh.numVertices() << " vertices)\n";
+  std::cout << "  ray queries ";
+  if (hasTriangleRecords())
+  {
+    std::cout << "TriAccel " << sizeof(TriAccel) << " SoA " << m_triSoA.memoryUsage() / numTriangles << " ";
+  }
+  std::cout << "BVH4 " << m_bvh.memoryUsage() / numTriangles << ", drawing with "
+            << (drawTriangleObjects() ? "Triangle objects" : "the indexed mesh") << "\n";
 }
 
 NGLScene::~NGLScene()
@@ -41,16 +147,7 @@ void NGLScene::initializeGL()
   glEnable(GL_DEPTH_TEST);
   // enable multisampling for smoother drawing
   glEnable(GL_MULTISAMPLE);
-  // Now we will create a basic Camera from the graphics library
-  // This is a static camera so it only needs to be set once
-  // First create Values for the camera position
-  ngl::Vec3 from(0.0f, 1.0f, 15.0f);
-  ngl::Vec3 to(0.0f, 0.0f, 0.0f);
-  ngl::Vec3 up(0.0f, 1.0f, 0.0f);
-  m_view = ngl::lookAt(from, to, up);
-  // set the shape using FOV 45 Aspect Ratio based on Width and Height
-  // The final two are near and far clipping planes of 0.5 and 10
-  m_project = ngl::perspective(45.0f, 720.0f / 576.0f, 0.5f, 150.0f);
+  // the camera is set up in the constructor so the headless renderer can use it without a GL context
   // now to load the shader and set the values
 
   ngl::ShaderLib::use("nglDiffuseShader");
@@ -65,19 +162,95 @@ void NGLScene::initializeGL()
   glEnable(GL_DEPTH_TEST); // for removal of hidden surfaces
 
   ngl::VAOPrimitives::createSphere("smallSphere", 0.05f, 10.0f);
+  ngl::VAOFactory::registerVAOCreator("multiBufferIndexVAO", MultiBufferIndexVAO::create);
 
-  for (int i = 0; i < m_numTriangles; ++i)
+  // a Triangle each is fine for a few but a loaded mesh or a large count is drawn from the shared vertices
+  if (drawTriangleObjects())
   {
-    ngl::Vec3 c = ngl::Random::getRandomVec3() * 10.0f;
-    ngl::Vec3 v0(ngl::Random::randomNumber(2) + 0.1f, ngl::Random::randomNumber(2) + 0.1f, -ngl::Random::randomPositiveNumber(2) + 0.1f);
-    ngl::Vec3 v1(ngl::Random::randomNumber(2) + 0.1f, ngl::Random::randomNumber(2) + 0.1f, -ngl::Random::randomPositiveNumber(2) + 0.1f);
-    ngl::Vec3 v2(ngl::Random::randomNumber(2) + 0.1f, ngl::Random::randomNumber(2) + 0.1f, -ngl::Random::randomPositiveNumber(2) + 0.1f);
-    m_triangleArray.emplace_back(new Triangle(c + v0, c + v1, c + v2));
+    for (size_t i = 0; i < m_mesh.numTriangles(); ++i)
+    {
+      m_triangleArray.emplace_back(new Triangle(m_mesh.corner(i, 0), m_mesh.corner(i, 1), m_mesh.corner(i, 2)));
+    }
+  }
+  else
+  {
+    createMeshVAO();
   }
   // as re-size is not explicitly called we need to do this.
   glViewport(0, 0, width(), height());
 }
 
+void NGLScene::createMeshVAO()
+{
+  // the vertex arrays are only needed while they are copied to the GPU
+  std::vector<ngl::Vec3> positions;
+  std::vector<ngl::Vec3> normals;
+  m_mesh.interleavedPositions(positions);
+  m_mesh.vertexNormals(normals);
+  m_meshVAO = ngl::VAOFactory::createVAO("multiBufferIndexVAO", GL_TRIANGLES);
+  m_meshVAO->bind();
+  m_meshVAO->setData(MultiBufferIndexVAO::VertexData(positions.size() * sizeof(ngl::Vec3), positions[0].m_x));
+  m_meshVAO->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(ngl::Vec3), 0);
+  m_meshVAO->setData(MultiBufferIndexVAO::VertexData(normals.size() * sizeof(ngl::Vec3), normals[0].m_x));
+  m_meshVAO->setVertexAttributePointer(1, 3, GL_FLOAT, sizeof(ngl::Vec3), 0);
+  dynamic_cast<MultiBufferIndexVAO *>(m_meshVAO.get())->setIndices(static_cast<unsigned int>(m_mesh.m_indices.size()), m_mesh.m_indices.data(), GL_UNSIGNED_INT);
+  m_meshVAO->setNumIndices(m_mesh.m_indices.size());
+  m_meshVAO->unbind();
+}
+
+void NGLScene::drawMesh()
+{
+  // every triangle the ray passes through is outlined like the wireframe Triangle::draw uses for a hit
+  std::vector<ngl::Vec3> outlines;
+  std::vector<ngl::Vec3> hitPoints;
+  Ray ray(m_rayStart, m_rayEnd - m_rayStart);
+  m_bvh.traverse(ray, FLT_MAX, [&](uint32_t _first, uint32_t _count, float &)
+                 {
+                   for (uint32_t i = _first; i < _first + _count; ++i)
+                   {
+                     TriHit hit;
+                     uint32_t id = m_bvh.primIndex(i);
+                     if (m_mesh.intersect(ray, id, FLT_MAX, hit))
+                     {
+                       hitPoints.push_back(ray.at(hit.m_t));
+                       for (int c = 0; c < 3; ++c)
+                       {
+                         outlines.push_back(m_mesh.corner(id, c));
+                         outlines.push_back(m_mesh.corner(id, (c + 1) % 3));
+                       }
+                     }
+                   }
+                   return false; });
+  m_transform.reset();
+  ngl::ShaderLib::use("nglDiffuseShader");
+  ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 0.0f, 0.0f);
+  loadMatricesToShader();
+  m_meshVAO->bind();
+  m_meshVAO->draw();
+  m_meshVAO->unbind();
+  for (auto &p : hitPoints)
+  {
+    m_transform.setPosition(p);
+    m_transform.setScale(2.0f, 2.0f, 2.0f);
+    loadMatricesToShader();
+    ngl::VAOPrimitives::draw("smallSphere");
+  }
+  if (!outlines.empty())
+  {
+    m_transform.reset();
+    std::unique_ptr<ngl::AbstractVAO> vao(ngl::VAOFactory::createVAO("simpleVAO", GL_LINES));
+    vao->bind();
+    vao->setData(ngl::SimpleVAO::VertexData(outlines.size() * sizeof(ngl::Vec3), outlines[0].m_x));
+    vao->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(ngl::Vec3), 0);
+    vao->setNumIndices(outlines.size());
+    loadMatricesToColourShader();
+    ngl::ShaderLib::setUniform("Colour", 1.0f, 0.0f, 0.0f, 1.0f);
+    vao->draw();
+    vao->removeVAO();
+    ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 1.0f, 1.0f);
+  }
+}
+
 void NGLScene::loadMatricesToShader()
 {
   ngl::ShaderLib::use("nglDiffuseShader");
@@ -144,16 +317,617 @@ void NGLScene::paintGL()
     vao->draw();
     vao->removeVAO();
   }
+  if (m_triangleArray.empty())
+  {
+    drawMesh();
+    return;
+  }
+  // clear the hits then only test the triangles in the leaves the ray reaches, every hit is wanted
+  // so the leaf function never shortens the ray
+  for (auto &t : m_triangleArray)
+  {
+    t->setNotHit();
+  }
+  m_bvh.traverse(Ray(m_rayStart, m_rayEnd - m_rayStart), FLT_MAX, [this](uint32_t _first, uint32_t _count, float &)
+                 {
+                   for (uint32_t i = _first; i < _first + _count; ++i)
+                   {
+                     m_triangleArray[m_bvh.primIndex(i)]->rayTriangleIntersect(m_rayStart, m_rayEnd);
+                   }
+                   return false; });
   // draw all the triangles
   ngl::ShaderLib::use("nglDiffuseShader");
   for (auto &t : m_triangleArray)
   {
     ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 0.0f, 0.0f);
-    t->rayTriangleIntersect(m_rayStart, m_rayEnd);
     t->draw("nglDiffuseShader", m_mouseGlobalTX, m_view, m_project);
   }
 }
 
+void NGLScene::benchmark()
+{
+  // random rays from around the camera into the triangles, the count is scaled so the brute force
+  // loop doesn't take forever with large triangle counts
+  size_t numTriangles = m_mesh.numTriangles();
+  size_t numRays = std::max<size_t>(1000, 20000000 / std::max<size_t>(1, numTriangles));
+  std::vector<Ray> rays(numRays);
+  for (auto &r : rays)
+  {
+    ngl::Vec3 from = toScene(ngl::Vec3(0.0f, 1.0f, 15.0f) + ngl::Random::getRandomVec3());
+    ngl::Vec3 to = toScene(ngl::Random::getRandomVec3() * 12.0f);
+    r = Ray(from, to - from);
+  }
+  auto report = [numRays](const char *_name, std::chrono::high_resolution_clock::duration _time, size_t _hits)
+  {
+    double seconds = std::chrono::duration<double>(_time).count();
+    std::cout << _name << " " << seconds * 1000.0 << " ms " << numRays / seconds * 1e-6 << " Mrays/s " << _hits << " hits\n";
+  };
+  std::cout << "Benchmark " << numRays << " rays against " << numTriangles << " triangles\n";
+  std::cout << "BVH4 " << m_bvh.numNodes() << " nodes " << m_bvh.memoryUsage() / 1024 << " KB\n";
+
+  // the brute force loops test every triangle for every ray so they are skipped for big meshes, the original loop
+  // from paintGL needs the drawable triangles which aren't made for loaded meshes
+  constexpr size_t bruteForceLimit = 1000000;
+  const bool bruteForce = numTriangles <= bruteForceLimit;
+  size_t hits = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  if (!m_triangleArray.empty() && bruteForce)
+  {
+    for (auto &r : rays)
+    {
+      ngl::Vec3 end = r.m_origin + r.m_dir;
+      float closest = FLT_MAX;
+      for (auto &t : m_triangleArray)
+      {
+        t->rayTriangleIntersect(r.m_origin, end);
+        if (t->isHit() && t->getHitDistance() < closest)
+        {
+          closest = t->getHitDistance();
+        }
+      }
+      hits += closest < FLT_MAX;
+    }
+    report("brute force", std::chrono::high_resolution_clock::now() - start, hits);
+  }
+
+  // the same loop using the precomputed records
+  if (hasTriangleRecords() && bruteForce)
+  {
+    hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (auto &r : rays)
+    {
+      hits += closestHit(m_triAccel, r).isHit();
+    }
+    report("brute force TriAccel", std::chrono::high_resolution_clock::now() - start, hits);
+  }
+
+  // the same query through the tree, each hit shortens the ray so further boxes are culled
+  if (hasTriangleRecords())
+  {
+    hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (auto &r : rays)
+    {
+      hits += closestHit(m_bvh, m_triAccel, r).isHit();
+    }
+    report("BVH4", std::chrono::high_resolution_clock::now() - start, hits);
+  }
+
+  // straight from the shared vertices and indices, no record per triangle
+  hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &r : rays)
+  {
+    hits += closestHit(m_bvh, m_mesh, r).isHit();
+  }
+  report("BVH4 indexed mesh", std::chrono::high_resolution_clock::now() - start, hits);
+
+  // SoA blocks of TriangleSoA::s_width triangles, first on their own then as the BVH leaf test
+  if (hasTriangleRecords())
+  {
+    std::cout << "TriangleSoA " << TriangleSoA::s_width << " wide " << m_triSoA.memoryUsage() / 1024 << " KB\n";
+    if (bruteForce)
+    {
+      hits = 0;
+      start = std::chrono::high_resolution_clock::now();
+      for (auto &r : rays)
+      {
+        hits += m_triSoA.closestHit(r).isHit();
+      }
+      report("brute force SoA", std::chrono::high_resolution_clock::now() - start, hits);
+    }
+    hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (auto &r : rays)
+    {
+      hits += closestHit(m_bvh, m_triSoA, r).isHit();
+    }
+    report("BVH4 SoA leaves", std::chrono::high_resolution_clock::now() - start, hits);
+  }
+
+  // occlusion of segments running part way along the same rays, the closest hit against stopping at the first
+  std::vector<Segment> segments(numRays);
+  for (size_t i = 0; i < numRays; ++i)
+  {
+    segments[i] = Segment(rays[i].m_origin, rays[i].at(ngl::Random::randomPositiveNumber(1.0f)));
+  }
+  hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &s : segments)
+  {
+    hits += closestSceneHit(s.ray(), 1.0f).isHit();
+  }
+  report("occlusion BVH4 closest hit", std::chrono::high_resolution_clock::now() - start, hits);
+  if (hasTriangleRecords())
+  {
+    hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (auto &s : segments)
+    {
+      hits += occluded(m_bvh, m_triAccel, s.ray(), 1.0f);
+    }
+    report("occlusion BVH4 any hit", std::chrono::high_resolution_clock::now() - start, hits);
+  }
+  hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &s : segments)
+  {
+    hits += occluded(m_bvh, m_mesh, s.ray(), 1.0f);
+  }
+  report("occlusion BVH4 indexed mesh", std::chrono::high_resolution_clock::now() - start, hits);
+  if (hasTriangleRecords())
+  {
+    std::vector<uint64_t> blocked;
+    start = std::chrono::high_resolution_clock::now();
+    occluded(m_bvh, m_triSoA, segments, blocked);
+    auto time = std::chrono::high_resolution_clock::now() - start;
+    hits = 0;
+    for (auto word : blocked)
+    {
+      hits += std::bitset<64>(word).count();
+    }
+    report("occlusion BVH4 SoA batch", time, hits);
+  }
+
+  // and again with the watertight test to see what the robustness costs
+  std::vector<WatertightTri> watertight(numTriangles);
+  for (size_t i = 0; i < numTriangles; ++i)
+  {
+    watertight[i] = WatertightTri(m_mesh.corner(i, 0), m_mesh.corner(i, 1), m_mesh.corner(i, 2));
+  }
+  hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &r : rays)
+  {
+    hits += closestHit<Watertight>(m_bvh, watertight, r).isHit();
+  }
+  report("BVH4 watertight", std::chrono::high_resolution_clock::now() - start, hits);
+
+  // fire rays at the shared diagonals of a grid of quads and count how many see no triangle or two
+  constexpr int gridSize = 64;
+  std::vector<ngl::Vec3> gridPoints((gridSize + 1) * (gridSize + 1));
+  for (int z = 0; z <= gridSize; ++z)
+  {
+    for (int x = 0; x <= gridSize; ++x)
+    {
+      gridPoints[z * (gridSize + 1) + x].set(x * 0.173f - 5.0f, std::sin(x * 0.31f) * std::cos(z * 0.17f), z * 0.159f - 5.0f);
+    }
+  }
+  std::vector<TriAccel> gridAccel;
+  std::vector<WatertightTri> gridWatertight;
+  std::vector<AABB> gridBounds;
+  for (int z = 0; z < gridSize; ++z)
+  {
+    for (int x = 0; x < gridSize; ++x)
+    {
+      const ngl::Vec3 &p0 = gridPoints[z * (gridSize + 1) + x];
+      const ngl::Vec3 &p1 = gridPoints[z * (gridSize + 1) + x + 1];
+      const ngl::Vec3 &p2 = gridPoints[(z + 1) * (gridSize + 1) + x + 1];
+      const ngl::Vec3 &p3 = gridPoints[(z + 1) * (gridSize + 1) + x];
+      gridAccel.emplace_back(p0, p1, p2);
+      gridAccel.emplace_back(p0, p2, p3);
+      gridWatertight.emplace_back(p0, p1, p2);
+      gridWatertight.emplace_back(p0, p2, p3);
+      for (int i = 0; i < 2; ++i)
+      {
+        AABB b;
+        b.extend(p0);
+        b.extend(i == 0 ? p1 : p3);
+        b.extend(p2);
+        gridBounds.push_back(b);
+      }
+    }
+  }
+  BVH4 gridBVH;
+  gridBVH.build(gridBounds);
+  size_t missed[2] = {0, 0};
+  size_t doubled[2] = {0, 0};
+  constexpr size_t numEdgeRays = 100000;
+  for (size_t i = 0; i < numEdgeRays; ++i)
+  {
+    int x = static_cast<int>(ngl::Random::randomPositiveNumber(gridSize - 1));
+    int z = static_cast<int>(ngl::Random::randomPositiveNumber(gridSize - 1));
+    ngl::Vec3 p0 = gridPoints[z * (gridSize + 1) + x];
+    ngl::Vec3 p2 = gridPoints[(z + 1) * (gridSize + 1) + x + 1];
+    ngl::Vec3 from(ngl::Random::randomNumber(5), 10.0f, ngl::Random::randomNumber(5));
+    Ray r(from, p0 + (p2 - p0) * ngl::Random::randomPositiveNumber(1.0f) - from);
+    const WatertightRay wr(r);
+    int count[2] = {0, 0};
+    gridBVH.traverse(r, FLT_MAX, [&](uint32_t _first, uint32_t _count, float &)
+                     {
+                       for (uint32_t j = _first; j < _first + _count; ++j)
+                       {
+                         TriHit hit;
+                         uint32_t id = gridBVH.primIndex(j);
+                         count[0] += MollerTrumbore::intersect(gridAccel[id], r, id, FLT_MAX, hit);
+                         count[1] += Watertight::intersect(gridWatertight[id], wr, id, FLT_MAX, hit);
+                       }
+                       return false; });
+    for (int m = 0; m < 2; ++m)
+    {
+      missed[m] += count[m] == 0;
+      doubled[m] += count[m] > 1;
+    }
+  }
+  std::cout << numEdgeRays << " rays at shared edges, Moller-Trumbore " << missed[0] << " missed " << doubled[0]
+            << " double hits, watertight " << missed[1] << " missed " << doubled[1] << " double hits\n";
+  benchmarkQuantised(rays);
+  benchmarkRefit(rays);
+  benchmarkPackets();
+  benchmarkInstances();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkRefit(const std::vector<Ray> &_rays)
+{
+  // every vertex of a copy of the mesh takes a small random step each tick, the indices never change
+  IndexedMesh mesh = m_mesh;
+  std::vector<AABB> bounds(mesh.numTriangles());
+  auto triangleBounds = [&]()
+  {
+    for (size_t i = 0; i < bounds.size(); ++i)
+    {
+      bounds[i] = AABB();
+      bounds[i].extend(mesh.corner(i, 0));
+      bounds[i].extend(mesh.corner(i, 1));
+      bounds[i].extend(mesh.corner(i, 2));
+    }
+  };
+  triangleBounds();
+  BVH4 refitted;
+  refitted.build(bounds);
+  BVH4 updated = refitted;
+  constexpr int numTicks = 20;
+  constexpr float maxCostRatio = 1.5f;
+  const float step = 0.1f * m_sceneScale;
+  double refitMs = 0.0;
+  double updateMs = 0.0;
+  int rebuilds = 0;
+  for (int tick = 0; tick < numTicks; ++tick)
+  {
+    for (uint32_t i = 0; i < mesh.numVertices(); ++i)
+    {
+      ngl::Vec3 p = mesh.vertex(i) + ngl::Random::getRandomVec3() * step;
+      mesh.m_x[i] = p.m_x;
+      mesh.m_y[i] = p.m_y;
+      mesh.m_z[i] = p.m_z;
+    }
+    triangleBounds();
+    auto start = std::chrono::high_resolution_clock::now();
+    refitted.refit(bounds);
+    refitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    rebuilds += updated.update(bounds, maxCostRatio);
+    updateMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  }
+  BVH4 rebuilt;
+  auto start = std::chrono::high_resolution_clock::now();
+  rebuilt.build(bounds);
+  double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "Refit " << numTicks << " ticks of jittered triangles, refit " << refitMs / numTicks << " ms a tick, refit with "
+            << rebuilds << " rebuilds " << updateMs / numTicks << " ms a tick, full build " << buildMs << " ms\n";
+  std::cout << "  SAH cost built " << refitted.builtCost() << " refit only " << refitted.sahCost() << " refit and rebuild "
+            << updated.sahCost() << " rebuilt " << rebuilt.sahCost() << "\n";
+  auto trace = [&](const char *_name, const BVH4 &_bvh)
+  {
+    size_t hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &r : _rays)
+    {
+      hits += closestHit(_bvh, mesh, r).isHit();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "  " << _name << " " << seconds * 1000.0 << " ms " << _rays.size() / seconds * 1e-6 << " Mrays/s " << hits << " hits\n";
+  };
+  trace("refit only", refitted);
+  trace("refit and rebuild", updated);
+  trace("rebuilt", rebuilt);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkQuantised(const std::vector<Ray> &_rays)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  QuantisedMesh quantised;
+  quantised.build(m_mesh);
+  double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  // the decoded triangles have moved a little so they get their own tree
+  std::vector<AABB> bounds;
+  quantised.triangleBounds(bounds);
+  BVH4 bvh;
+  bvh.build(bounds);
+  // the measured errors against the bound, normals as the largest angle between the float and decoded normal
+  std::vector<ngl::Vec3> normals;
+  m_mesh.vertexNormals(normals);
+  float positionError = 0.0f;
+  float normalError = 0.0f;
+  for (uint32_t i = 0; i < m_mesh.numVertices(); ++i)
+  {
+    positionError = std::max(positionError, (quantised.vertex(i) - m_mesh.vertex(i)).length());
+    if (normals[i].lengthSquared() > 0.0f)
+    {
+      float cosine = std::min(1.0f, normals[i].dot(quantised.normal(i)));
+      normalError = std::max(normalError, std::acos(cosine));
+    }
+  }
+  // floats for the positions and a normal per vertex as the mesh VAO uploads them, and the same indices
+  const size_t floatBytes = m_mesh.memoryUsage() + m_mesh.numVertices() * sizeof(ngl::Vec3);
+  std::cout << "Quantised mesh built in " << buildMs << " ms, " << quantised.memoryUsage() / 1024 << " KB against "
+            << floatBytes / 1024 << " KB, " << 100.0 * (1.0 - static_cast<double>(quantised.memoryUsage()) / floatBytes)
+            << "% saved\n";
+  std::cout << "  position error " << positionError << " (bound " << quantised.maxError() << ") normal error "
+            << ngl::degrees(normalError) << " degrees\n";
+  auto report = [&](const char *_name, std::chrono::high_resolution_clock::duration _time, size_t _hits)
+  {
+    double seconds = std::chrono::duration<double>(_time).count();
+    std::cout << _name << " " << seconds * 1000.0 << " ms " << _rays.size() / seconds * 1e-6 << " Mrays/s " << _hits << " hits\n";
+  };
+  std::vector<TriHit> reference(_rays.size());
+  size_t hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < _rays.size(); ++i)
+  {
+    reference[i] = closestHit(m_bvh, m_mesh, _rays[i]);
+    hits += reference[i].isHit();
+  }
+  report("BVH4 indexed mesh", std::chrono::high_resolution_clock::now() - start, hits);
+  std::vector<TriHit> decoded(_rays.size());
+  hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < _rays.size(); ++i)
+  {
+    decoded[i] = closestHit(bvh, quantised, _rays[i]);
+    hits += decoded[i].isHit();
+  }
+  report("BVH4 quantised mesh", std::chrono::high_resolution_clock::now() - start, hits);
+  // rays that graze an edge can change triangle, the distance error shows how far the surface moved
+  size_t differ = 0;
+  float distanceError = 0.0f;
+  for (size_t i = 0; i < _rays.size(); ++i)
+  {
+    if (reference[i].m_triIndex != decoded[i].m_triIndex)
+    {
+      ++differ;
+    }
+    else if (reference[i].isHit())
+    {
+      distanceError = std::max(distanceError, std::fabs(reference[i].m_t - decoded[i].m_t) * _rays[i].m_dir.length());
+    }
+  }
+  std::cout << "  " << differ << " rays hit a different triangle, largest hit point shift " << distanceError << "\n";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkInstances()
+{
+  // the scene's triangles become one mesh placed on a 10x10x10 grid with a random turn each
+  constexpr int gridSize = 10;
+  const float spacing = 30.0f * m_sceneScale;
+  TwoLevelBVH scene;
+  uint32_t mesh = scene.addMesh(m_mesh);
+  auto place = [&](int _i)
+  {
+    // each copy is turned about the mesh centre then moved to its grid cell
+    ngl::Mat4 centre = ngl::Mat4::translate(-m_sceneCentre.m_x, -m_sceneCentre.m_y, -m_sceneCentre.m_z);
+    ngl::Mat4 cell = ngl::Mat4::translate((_i % gridSize - gridSize / 2) * spacing, (_i / gridSize % gridSize - gridSize / 2) * spacing,
+                                          (_i / (gridSize * gridSize) - gridSize / 2) * spacing);
+    return cell * ngl::Mat4::rotateY(ngl::Random::randomNumber(180.0f)) * centre;
+  };
+  constexpr int numInstances = gridSize * gridSize * gridSize;
+  for (int i = 0; i < numInstances; ++i)
+  {
+    scene.addInstance(mesh, place(i));
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  scene.build();
+  double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "Two level BVH " << numInstances << " instances of " << m_mesh.numTriangles() << " triangles, "
+            << scene.numInstancedTriangles() << " triangles in the scene\n";
+  std::cout << "  " << scene.memoryUsage() / 1024 << " KB against " << scene.flattenedMemoryUsage() / 1024
+            << " KB with every instance copied into world space\n";
+  // moving every instance only needs the top level rebuilt
+  for (int i = 0; i < numInstances; ++i)
+  {
+    scene.setTransform(i, place(i));
+  }
+  start = std::chrono::high_resolution_clock::now();
+  scene.build();
+  double rebuildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "  top level build " << buildMs << " ms, rebuild after moving every instance " << rebuildMs << " ms\n";
+  // rays from outside the grid through it
+  constexpr size_t numRays = 200000;
+  std::vector<Ray> rays(numRays);
+  for (auto &r : rays)
+  {
+    ngl::Vec3 from = ngl::Random::getRandomVec3() * spacing * gridSize;
+    r = Ray(from, ngl::Random::getRandomVec3() * spacing * gridSize * 0.5f - from);
+  }
+  size_t hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &r : rays)
+  {
+    hits += scene.closestHit(r).isHit();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "  closest hit " << seconds * 1000.0 << " ms " << numRays / seconds * 1e-6 << " Mrays/s " << hits << " hits\n";
+  hits = 0;
+  start = std::chrono::high_resolution_clock::now();
+  for (auto &r : rays)
+  {
+    hits += scene.occluded(r, 1.0f);
+  }
+  seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  std::cout << "  occlusion " << seconds * 1000.0 << " ms " << numRays / seconds * 1e-6 << " Mrays/s " << hits << " hits\n";
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+TriHit NGLScene::closestSceneHit(const Ray &_ray, float _tMax) const
+{
+  return hasTriangleRecords() ? closestHit(m_bvh, m_triSoA, _ray, _tMax) : closestHit(m_bvh, m_mesh, _ray, _tMax);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool NGLScene::intersectLeaf(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const
+{
+  if (hasTriangleRecords())
+  {
+    return m_triSoA.intersect(_ray, _first, _count, _tMax, o_hit);
+  }
+  bool found = false;
+  for (uint32_t i = _first; i < _first + _count; ++i)
+  {
+    if (m_mesh.intersect(_ray, m_bvh.primIndex(i), _tMax, o_hit))
+    {
+      _tMax = o_hit.m_t;
+      found = true;
+    }
+  }
+  return found;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+void NGLScene::benchmarkPackets()
+{
+  // primary rays for a 720x576 image from the camera set up in the constructor, stored tile by tile so each
+  // tile is one packet
+  constexpr int imageWidth = 720;
+  constexpr int imageHeight = 576;
+  const ngl::Vec3 eye = toScene(ngl::Vec3(0.0f, 1.0f, 15.0f));
+  ngl::Vec3 forward = m_sceneCentre - eye;
+  forward.normalize();
+  ngl::Vec3 right = forward.cross(ngl::Vec3(0.0f, 1.0f, 0.0f));
+  right.normalize();
+  ngl::Vec3 up = right.cross(forward);
+  const float halfHeight = std::tan(ngl::radians(45.0f) * 0.5f);
+  const float halfWidth = halfHeight * imageWidth / imageHeight;
+  auto cameraRays = [&](int _tileSize)
+  {
+    std::vector<Ray> rays;
+    rays.reserve(imageWidth * imageHeight);
+    for (int ty = 0; ty < imageHeight; ty += _tileSize)
+    {
+      for (int tx = 0; tx < imageWidth; tx += _tileSize)
+      {
+        for (int y = ty; y < ty + _tileSize; ++y)
+        {
+          for (int x = tx; x < tx + _tileSize; ++x)
+          {
+            float sx = ((x + 0.5f) / imageWidth * 2.0f - 1.0f) * halfWidth;
+            float sy = (1.0f - (y + 0.5f) / imageHeight * 2.0f) * halfHeight;
+            rays.emplace_back(eye, forward + right * sx + up * sy);
+          }
+        }
+      }
+    }
+    return rays;
+  };
+  std::vector<Ray> randomRays(imageWidth * imageHeight);
+  for (auto &r : randomRays)
+  {
+    ngl::Vec3 from = toScene(ngl::Random::getRandomVec3() * 12.0f);
+    r = Ray(from, ngl::Random::getRandomVec3());
+  }
+  std::vector<TriHit> hits;
+  auto report = [&](const char *_name, std::chrono::high_resolution_clock::duration _time)
+  {
+    size_t numHits = std::count_if(std::begin(hits), std::end(hits), [](const TriHit &_h)
+                                   { return _h.isHit(); });
+    double seconds = std::chrono::duration<double>(_time).count();
+    std::cout << _name << " " << seconds * 1000.0 << " ms " << hits.size() / seconds * 1e-6 << " Mrays/s " << numHits << " hits\n";
+  };
+  auto traceSingle = [&](const char *_name, const std::vector<Ray> &_rays)
+  {
+    hits.assign(_rays.size(), TriHit());
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < _rays.size(); ++i)
+    {
+      hits[i] = closestSceneHit(_rays[i]);
+    }
+    report(_name, std::chrono::high_resolution_clock::now() - start);
+  };
+  auto tracePackets = [&](const char *_name, const std::vector<Ray> &_rays, uint32_t _packetSize)
+  {
+    hits.assign(_rays.size(), TriHit());
+    size_t coherent = 0;
+    RayPacket packet;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t first = 0; first < _rays.size(); first += _packetSize)
+    {
+      packet.set(&_rays[first], static_cast<uint32_t>(std::min<size_t>(_packetSize, _rays.size() - first)));
+      coherent += packet.m_coherent;
+      TriHit *packetHits = &hits[first];
+      m_bvh.traverse(packet, [&](uint32_t _first, uint32_t _count, uint64_t _rayMask)
+                     {
+                       RayPacket::forEachRay(_rayMask, [&](uint32_t _r)
+                                             {
+                                               if (intersectLeaf(packet.m_rays[_r], _first, _count, packet.m_tMax[_r], packetHits[_r]))
+                                               {
+                                                 packet.m_tMax[_r] = packetHits[_r].m_t;
+                                               } });
+                       return false; });
+    }
+    report(_name, std::chrono::high_resolution_clock::now() - start);
+    std::cout << "  " << coherent << " of " << (_rays.size() + _packetSize - 1) / _packetSize << " packets coherent\n";
+  };
+  std::cout << "Ray packets " << imageWidth << "x" << imageHeight << " rays\n";
+  std::vector<Ray> rays = cameraRays(8);
+  traceSingle("camera single rays", rays);
+  tracePackets("camera 8x8 packets", rays, 64);
+  rays = cameraRays(4);
+  tracePackets("camera 4x4 packets", rays, 16);
+  traceSingle("random single rays", randomRays);
+  tracePackets("random 8x8 packets", randomRays, 64);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+bool NGLScene::renderImage(int _width, int _height, unsigned int _numThreads, const std::string &_fileName, bool _normals)
+{
+  // same projection resizeGL would set for a window of this size
+  m_project = ngl::perspective(45.0f, static_cast<float>(_width) / _height, 0.05f, 350.0f);
+  TileRenderer renderer(m_view, m_project, _width, _height);
+  double seconds = renderer.render(_numThreads, [this](const Ray &_ray)
+                                   {
+                                     PixelHit pixel;
+                                     TriHit hit = closestSceneHit(_ray);
+                                     if (hit.isHit())
+                                     {
+                                       pixel.m_hit = true;
+                                       pixel.m_depth = hit.m_t;
+                                       pixel.m_normal = hasTriangleRecords() ? m_triAccel[hit.m_triIndex].m_normal : m_mesh.faceNormal(hit.m_triIndex);
+                                     }
+                                     return pixel; });
+  size_t numRays = static_cast<size_t>(renderer.width()) * renderer.height();
+  std::cout << "Rendered " << renderer.width() << "x" << renderer.height() << " " << m_mesh.numTriangles() << " triangles in "
+            << seconds * 1000.0 << " ms " << numRays / seconds * 1e-6 << " Mrays/s " << renderer.numHits() << " hits\n";
+  bool written = _normals ? renderer.writeNormal(_fileName) : renderer.writeDepth(_fileName);
+  if (!written)
+  {
+    std::cerr << "Unable to write " << _fileName << "\n";
+  }
+  return written;
+}
+
 //----------------------------------------------------------------------------------------------------------------------
 void NGLScene::mouseMoveEvent(QMouseEvent *_event)
 {
@@ -281,6 +1055,9 @@ void NGLScene::keyPressEvent(QKeyEvent *_event)
   case Qt::Key_S:
     m_rayStart.m_x += s_increment;
     break;
+  case Qt::Key_B:
+    benchmark();
+    break;
 
   default:
     break;
@@ -0,0 +1,110 @@
+#include "QuantisedMesh.h"
+#include <algorithm>
+#include <cmath>
+
+void QuantisedMesh::build(const IndexedMesh &_mesh)
+{
+  AABB bounds;
+  for (uint32_t i = 0; i < _mesh.numVertices(); ++i)
+  {
+    bounds.extend(_mesh.vertex(i));
+  }
+  m_origin = bounds.isEmpty() ? ngl::Vec3(0.0f, 0.0f, 0.0f) : bounds.m_min;
+  m_step = bounds.isEmpty() ? ngl::Vec3(0.0f, 0.0f, 0.0f) : (bounds.m_max - bounds.m_min) / s_steps;
+  auto quantise = [](float _value, float _origin, float _step)
+  {
+    // a flat axis has no steps so everything sits on the origin
+    if (_step <= 0.0f)
+    {
+      return static_cast<uint16_t>(0);
+    }
+    float steps = std::round((_value - _origin) / _step);
+    return static_cast<uint16_t>(std::min(std::max(steps, 0.0f), s_steps));
+  };
+  m_positions.resize(_mesh.numVertices());
+  for (uint32_t i = 0; i < m_positions.size(); ++i)
+  {
+    m_positions[i].m_x = quantise(_mesh.m_x[i], m_origin.m_x, m_step.m_x);
+    m_positions[i].m_y = quantise(_mesh.m_y[i], m_origin.m_y, m_step.m_y);
+    m_positions[i].m_z = quantise(_mesh.m_z[i], m_origin.m_z, m_step.m_z);
+  }
+  std::vector<ngl::Vec3> normals;
+  _mesh.vertexNormals(normals);
+  m_normals.resize(normals.size());
+  for (size_t i = 0; i < normals.size(); ++i)
+  {
+    m_normals[i] = encodeNormal(normals[i]);
+  }
+  m_indices = _mesh.m_indices;
+}
+
+ngl::Vec3 QuantisedMesh::shadingNormal(const TriHit &_hit) const
+{
+  const uint32_t *index = &m_indices[static_cast<size_t>(_hit.m_triIndex) * 3];
+  ngl::Vec3 n = normal(index[0]) * (1.0f - _hit.m_u - _hit.m_v) + normal(index[1]) * _hit.m_u + normal(index[2]) * _hit.m_v;
+  if (n.lengthSquared() > 0.0f)
+  {
+    n.normalize();
+  }
+  return n;
+}
+
+void QuantisedMesh::triangleBounds(std::vector<AABB> &o_bounds) const
+{
+  o_bounds.assign(numTriangles(), AABB());
+  for (size_t i = 0; i < o_bounds.size(); ++i)
+  {
+    o_bounds[i].extend(corner(i, 0));
+    o_bounds[i].extend(corner(i, 1));
+    o_bounds[i].extend(corner(i, 2));
+  }
+}
+
+size_t QuantisedMesh::memoryUsage() const
+{
+  return m_positions.capacity() * sizeof(Position) + m_normals.capacity() * sizeof(uint32_t) + m_indices.capacity() * sizeof(uint32_t);
+}
+
+uint32_t QuantisedMesh::encodeNormal(const ngl::Vec3 &_n)
+{
+  float sum = std::fabs(_n.m_x) + std::fabs(_n.m_y) + std::fabs(_n.m_z);
+  if (sum == 0.0f)
+  {
+    return 0;
+  }
+  float x = _n.m_x / sum;
+  float y = _n.m_y / sum;
+  if (_n.m_z < 0.0f)
+  {
+    // fold the lower half of the octahedron out onto the corners of the square
+    float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+  auto snorm = [](float _v)
+  {
+    return static_cast<uint16_t>(static_cast<int16_t>(std::round(std::min(std::max(_v, -1.0f), 1.0f) * 32767.0f)));
+  };
+  return static_cast<uint32_t>(snorm(x)) | static_cast<uint32_t>(snorm(y)) << 16;
+}
+
+ngl::Vec3 QuantisedMesh::decodeNormal(uint32_t _code)
+{
+  float x = static_cast<int16_t>(_code & 0xffff) / 32767.0f;
+  float y = static_cast<int16_t>(_code >> 16) / 32767.0f;
+  float z = 1.0f - std::fabs(x) - std::fabs(y);
+  if (z < 0.0f)
+  {
+    float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+  ngl::Vec3 n(x, y, z);
+  if (n.lengthSquared() > 0.0f)
+  {
+    n.normalize();
+  }
+  return n;
+}
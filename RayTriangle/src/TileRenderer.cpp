@@ -0,0 +1,124 @@
+#include "TileRenderer.h"
+#include <cfloat>
+#include <cstdio>
+
+ngl::Vec3 TileRenderer::transformPoint(const ngl::Mat4 &_m, float _x, float _y, float _z)
+{
+  // ngl stores the matrix column major as m_m[column][row]
+  float p[4];
+  for (int r = 0; r < 4; ++r)
+  {
+    p[r] = _m.m_m[0][r] * _x + _m.m_m[1][r] * _y + _m.m_m[2][r] * _z + _m.m_m[3][r];
+  }
+  return ngl::Vec3(p[0] / p[3], p[1] / p[3], p[2] / p[3]);
+}
+
+TileRenderer::TileRenderer(const ngl::Mat4 &_view, const ngl::Mat4 &_project, int _width, int _height)
+{
+  m_width = std::max(1, _width);
+  m_height = std::max(1, _height);
+  ngl::Mat4 inverseView = _view;
+  inverseView = inverseView.inverse();
+  m_eye = transformPoint(inverseView, 0.0f, 0.0f, 0.0f);
+  m_inverseViewProject = _project * _view;
+  m_inverseViewProject = m_inverseViewProject.inverse();
+}
+
+Ray TileRenderer::primaryRay(int _x, int _y) const
+{
+  // pixel centre to normalised device coordinates, y is flipped so row 0 is the top of the image
+  float ndcX = (_x + 0.5f) / m_width * 2.0f - 1.0f;
+  float ndcY = 1.0f - (_y + 0.5f) / m_height * 2.0f;
+  ngl::Vec3 dir = transformPoint(m_inverseViewProject, ndcX, ndcY, 1.0f) - m_eye;
+  dir.normalize();
+  return Ray(m_eye, dir);
+}
+
+size_t TileRenderer::numHits() const
+{
+  return std::count_if(std::begin(m_pixels), std::end(m_pixels), [](const PixelHit &_p)
+                       { return _p.m_hit; });
+}
+
+bool TileRenderer::writeDepth(const std::string &_fileName) const
+{
+  std::vector<float> pixels(m_pixels.size());
+  for (size_t i = 0; i < m_pixels.size(); ++i)
+  {
+    // misses are written as 0 so they show up black
+    pixels[i] = m_pixels[i].m_hit ? m_pixels[i].m_depth : 0.0f;
+  }
+  return write(_fileName, pixels, 1);
+}
+
+bool TileRenderer::writeNormal(const std::string &_fileName) const
+{
+  std::vector<float> pixels(m_pixels.size() * 3, 0.0f);
+  for (size_t i = 0; i < m_pixels.size(); ++i)
+  {
+    if (m_pixels[i].m_hit)
+    {
+      pixels[i * 3] = m_pixels[i].m_normal.m_x;
+      pixels[i * 3 + 1] = m_pixels[i].m_normal.m_y;
+      pixels[i * 3 + 2] = m_pixels[i].m_normal.m_z;
+    }
+  }
+  return write(_fileName, pixels, 3);
+}
+
+bool TileRenderer::write(const std::string &_fileName, const std::vector<float> &_pixels, int _channels) const
+{
+  FILE *file = std::fopen(_fileName.c_str(), "wb");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  bool pfm = _fileName.size() >= 4 && _fileName.compare(_fileName.size() - 4, 4, ".pfm") == 0;
+  if (pfm)
+  {
+    // a negative scale means little endian, PFM rows go from the bottom of the image up
+    std::fprintf(file, "%s\n%d %d\n-1.0\n", _channels == 3 ? "PF" : "Pf", m_width, m_height);
+    for (int y = m_height - 1; y >= 0; --y)
+    {
+      std::fwrite(&_pixels[static_cast<size_t>(y) * m_width * _channels], sizeof(float), static_cast<size_t>(m_width) * _channels, file);
+    }
+  }
+  else
+  {
+    // depth is scaled so the nearest hit is white and the furthest dark grey, normals go from -1..1 to 0..255
+    float minDepth = FLT_MAX;
+    float maxDepth = 0.0f;
+    if (_channels == 1)
+    {
+      for (auto &p : m_pixels)
+      {
+        if (p.m_hit)
+        {
+          minDepth = std::min(minDepth, p.m_depth);
+          maxDepth = std::max(maxDepth, p.m_depth);
+        }
+      }
+    }
+    const float depthScale = maxDepth > minDepth ? 1.0f / (maxDepth - minDepth) : 0.0f;
+    std::fprintf(file, "P6\n%d %d\n255\n", m_width, m_height);
+    std::vector<unsigned char> row(static_cast<size_t>(m_width) * 3);
+    for (int y = 0; y < m_height; ++y)
+    {
+      for (int x = 0; x < m_width; ++x)
+      {
+        const size_t i = static_cast<size_t>(y) * m_width + x;
+        for (int c = 0; c < 3; ++c)
+        {
+          float v = 0.0f;
+          if (m_pixels[i].m_hit)
+          {
+            v = _channels == 1 ? 1.0f - 0.8f * (_pixels[i] - minDepth) * depthScale : _pixels[i * 3 + c] * 0.5f + 0.5f;
+          }
+          row[x * 3 + c] = static_cast<unsigned char>(std::min(std::max(v, 0.0f), 1.0f) * 255.0f);
+        }
+      }
+      std::fwrite(row.data(), 1, row.size(), file);
+    }
+  }
+  return std::fclose(file) == 0;
+}
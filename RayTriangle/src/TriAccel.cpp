@@ -0,0 +1,30 @@
+#include "TriAccel.h"
+#include <ngl/Util.h>
+#include <algorithm>
+#include <cmath>
+
+TriAccel::TriAccel(const ngl::Vec3 &_v0, const ngl::Vec3 &_v1, const ngl::Vec3 &_v2)
+{
+  m_v0 = _v0;
+  m_edge1 = _v1 - _v0;
+  m_edge2 = _v2 - _v0;
+  m_normal = ngl::calcNormal(_v0, _v1, _v2);
+}
+
+WatertightRay::WatertightRay(const Ray &_ray)
+{
+  m_origin = _ray.m_origin;
+  // the dimension where the direction is largest becomes z, the other two follow on
+  ngl::Vec3 absDir(std::fabs(_ray.m_dir.m_x), std::fabs(_ray.m_dir.m_y), std::fabs(_ray.m_dir.m_z));
+  m_kz = absDir.m_x > absDir.m_y ? (absDir.m_x > absDir.m_z ? 0 : 2) : (absDir.m_y > absDir.m_z ? 1 : 2);
+  m_kx = (m_kz + 1) % 3;
+  m_ky = (m_kx + 1) % 3;
+  // swap to keep the winding the same when the ray points down z
+  if (_ray.m_dir[m_kz] < 0.0f)
+  {
+    std::swap(m_kx, m_ky);
+  }
+  m_sx = _ray.m_dir[m_kx] / _ray.m_dir[m_kz];
+  m_sy = _ray.m_dir[m_ky] / _ray.m_dir[m_kz];
+  m_sz = 1.0f / _ray.m_dir[m_kz];
+}
@@ -7,24 +7,23 @@
 Triangle::Triangle(ngl::Vec3 _p0, ngl::Vec3 _p1,  ngl::Vec3 _p2)
 {
   // set the default values
-  m_u=0.0;
-  m_v=0.0;
-  m_w=0.0;
+  m_hitDistance=0.0;
   m_v0=_p0;
   m_v1=_p1;
   m_v2=_p2;
-  // calculate the edge
-  m_edge1 = m_v1 - m_v0;
-  m_edge2 = m_v2 - m_v0;
+  // calculate the edges and normal once
+  m_accel=TriAccel(m_v0,m_v1,m_v2);
   // the center of the tri is the 3 verts average
   m_center=(m_v0+m_v1+m_v2)/3.0;
   m_hit=false;
-  // create the m_points array for drawing the triangel
+  // create the m_points array for drawing the triangel, sized exactly so memoryUsage is right
+  m_points.reserve(3);
+  m_normals.reserve(3);
   m_points.push_back(m_v0);
   m_points.push_back(m_v1);
   m_points.push_back(m_v2);
-  // now calculate the normal and create a normal array
-  ngl::Vec3 normal=ngl::calcNormal(m_v0,m_v1,m_v2);
+  // now create a normal array
+  ngl::Vec3 normal=m_accel.m_normal;
 
   m_normals.push_back(normal);
   m_normals.push_back(normal);
@@ -109,59 +108,13 @@ void Triangle::draw(const std::string &_shaderName, const ngl::Mat4 &_globalMat,
 
 void Triangle::rayTriangleIntersect(ngl::Vec3 _rayStart,ngl::Vec3 _rayEnd )
 {
-  m_hit=false;
-  // Calculate the ray direction
-  ngl::Vec3 dir=_rayEnd-_rayStart;
-
-  ngl::Vec3 tvec, pvec, qvec;
-  float det, inv_det;
-  // get the vector of the first edge
-  pvec = dir.cross(m_edge2);
-  // calculate the determinant
-  det = m_edge1.dot(pvec);
-  // if this is 0 no hit
-  if (det > -0.00001f && det < 0.00001f)
-  {
-    return ;
-  }
-  // get the inverse det
-  inv_det = 1.0f / det;
-  // calculate the 2nd vector
-  tvec = _rayStart - m_v0;
-  // get the dot product of this and inv det
-  m_u = tvec.dot(pvec) * inv_det;
-  // if out of range no hit
-  if (m_u < -0.001f || m_u > 1.001f)
-  {
-    return;
-  }
-  // check the 2nd vector edge
-  qvec = tvec.cross(m_edge1);
-  // get the dot product
-  m_v = dir.dot(qvec) * inv_det;
-  // if out of range no hit
-  if (m_v < -0.001f || m_u + m_v > 1.001f)
-  {
-    return;
-  }
-  // check the final value
-  m_w = m_edge2.dot(qvec) * inv_det;
-  // if less than 0 no hit
-  if (m_w <= 0)
+  // the test itself doesn't touch the triangle, we just keep the result for drawing
+  Ray ray(_rayStart,_rayEnd-_rayStart);
+  TriHit hit;
+  m_hit=m_accel.intersect(ray,0,FLT_MAX,hit);
+  if(m_hit)
   {
-    return;
+    m_hitDistance=hit.m_t;
+    m_hitPoint=ray.at(hit.m_t);
   }
-  // otherwise we are inside the triangle
-  // so get the hit point
-  // see http://softsurfer.com/Archive/algorithm_0105/algorithm_0105.htm#intersect_RayTriangle()
-  // get intersect point of ray with triangle plane
-  // calculate the normal
-  ngl::Vec3 n=ngl::calcNormal(m_v0,m_v1,m_v2);
-  float a = -n.dot(tvec);
-  float b = n.dot(dir);
-  float r=a/b;
-  // intersect point of ray and plane
-  m_hitPoint=_rayStart + r * dir;
-  m_hit=true;
 }
-
@@ -0,0 +1,265 @@
+#include "TriangleSoA.h"
+#include <algorithm>
+
+void TriangleSoA::build(const std::vector<TriAccel> &_tris, const uint32_t *_order)
+{
+  m_size = static_cast<uint32_t>(_tris.size());
+  // the padding is left as degenerate triangles which can never be hit
+  size_t padded = m_size + s_width;
+  for (auto *a : {&m_v0x, &m_v0y, &m_v0z, &m_e1x, &m_e1y, &m_e1z, &m_e2x, &m_e2y, &m_e2z})
+  {
+    a->assign(padded, 0.0f);
+  }
+  m_ids.assign(padded, TriHit::s_noHit);
+  for (uint32_t i = 0; i < m_size; ++i)
+  {
+    uint32_t id = _order != nullptr ? _order[i] : i;
+    const TriAccel &t = _tris[id];
+    m_v0x[i] = t.m_v0.m_x;
+    m_v0y[i] = t.m_v0.m_y;
+    m_v0z[i] = t.m_v0.m_z;
+    m_e1x[i] = t.m_edge1.m_x;
+    m_e1y[i] = t.m_edge1.m_y;
+    m_e1z[i] = t.m_edge1.m_z;
+    m_e2x[i] = t.m_edge2.m_x;
+    m_e2y[i] = t.m_edge2.m_y;
+    m_e2z[i] = t.m_edge2.m_z;
+    m_ids[i] = id;
+  }
+}
+
+size_t TriangleSoA::memoryUsage() const
+{
+  return m_v0x.size() * 9 * sizeof(float) + m_ids.size() * sizeof(uint32_t);
+}
+
+bool TriangleSoA::intersect(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const
+{
+  bool hit = false;
+  for (uint32_t i = 0; i < _count; i += s_width)
+  {
+    // each block hit shortens the ray for the next block
+    if (intersectBlock(_ray, _first + i, std::min(s_width, _count - i), _tMax, o_hit))
+    {
+      _tMax = o_hit.m_t;
+      hit = true;
+    }
+  }
+  return hit;
+}
+
+TriHit TriangleSoA::closestHit(const Ray &_ray, float _tMax) const
+{
+  TriHit hit;
+  intersect(_ray, 0, m_size, _tMax, hit);
+  return hit;
+}
+
+bool TriangleSoA::occluded(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax) const
+{
+  TriHit hit;
+  for (uint32_t i = 0; i < _count; i += s_width)
+  {
+    if (intersectBlock(_ray, _first + i, std::min(s_width, _count - i), _tMax, hit))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void occluded(const BVH4 &_bvh, const TriangleSoA &_tris, const std::vector<Segment> &_segments, std::vector<uint64_t> &o_occluded)
+{
+  o_occluded.assign((_segments.size() + 63) / 64, 0);
+  for (size_t i = 0; i < _segments.size(); ++i)
+  {
+    if (occluded(_bvh, _tris, _segments[i].ray(), 1.0f))
+    {
+      o_occluded[i / 64] |= uint64_t(1) << (i % 64);
+    }
+  }
+}
+
+#if defined(__AVX512F__)
+
+bool TriangleSoA::intersectBlock(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const
+{
+  const __mmask16 valid = static_cast<__mmask16>((1u << _count) - 1u);
+  const __m512 dx = _mm512_set1_ps(_ray.m_dir.m_x);
+  const __m512 dy = _mm512_set1_ps(_ray.m_dir.m_y);
+  const __m512 dz = _mm512_set1_ps(_ray.m_dir.m_z);
+  const __m512 e1x = _mm512_loadu_ps(&m_e1x[_first]);
+  const __m512 e1y = _mm512_loadu_ps(&m_e1y[_first]);
+  const __m512 e1z = _mm512_loadu_ps(&m_e1z[_first]);
+  const __m512 e2x = _mm512_loadu_ps(&m_e2x[_first]);
+  const __m512 e2y = _mm512_loadu_ps(&m_e2y[_first]);
+  const __m512 e2z = _mm512_loadu_ps(&m_e2z[_first]);
+  // pvec = dir x edge2
+  const __m512 px = _mm512_fmsub_ps(dy, e2z, _mm512_mul_ps(dz, e2y));
+  const __m512 py = _mm512_fmsub_ps(dz, e2x, _mm512_mul_ps(dx, e2z));
+  const __m512 pz = _mm512_fmsub_ps(dx, e2y, _mm512_mul_ps(dy, e2x));
+  const __m512 det = _mm512_fmadd_ps(e1x, px, _mm512_fmadd_ps(e1y, py, _mm512_mul_ps(e1z, pz)));
+  __mmask16 mask = valid & _mm512_cmp_ps_mask(_mm512_abs_ps(det), _mm512_set1_ps(0.00001f), _CMP_GE_OQ);
+  const __m512 invDet = _mm512_div_ps(_mm512_set1_ps(1.0f), det);
+  // tvec = origin - v0
+  const __m512 tx = _mm512_sub_ps(_mm512_set1_ps(_ray.m_origin.m_x), _mm512_loadu_ps(&m_v0x[_first]));
+  const __m512 ty = _mm512_sub_ps(_mm512_set1_ps(_ray.m_origin.m_y), _mm512_loadu_ps(&m_v0y[_first]));
+  const __m512 tz = _mm512_sub_ps(_mm512_set1_ps(_ray.m_origin.m_z), _mm512_loadu_ps(&m_v0z[_first]));
+  const __m512 u = _mm512_mul_ps(_mm512_fmadd_ps(tx, px, _mm512_fmadd_ps(ty, py, _mm512_mul_ps(tz, pz))), invDet);
+  mask &= _mm512_cmp_ps_mask(u, _mm512_set1_ps(-0.001f), _CMP_GE_OQ) & _mm512_cmp_ps_mask(u, _mm512_set1_ps(1.001f), _CMP_LE_OQ);
+  // qvec = tvec x edge1
+  const __m512 qx = _mm512_fmsub_ps(ty, e1z, _mm512_mul_ps(tz, e1y));
+  const __m512 qy = _mm512_fmsub_ps(tz, e1x, _mm512_mul_ps(tx, e1z));
+  const __m512 qz = _mm512_fmsub_ps(tx, e1y, _mm512_mul_ps(ty, e1x));
+  const __m512 v = _mm512_mul_ps(_mm512_fmadd_ps(dx, qx, _mm512_fmadd_ps(dy, qy, _mm512_mul_ps(dz, qz))), invDet);
+  mask &= _mm512_cmp_ps_mask(v, _mm512_set1_ps(-0.001f), _CMP_GE_OQ) & _mm512_cmp_ps_mask(_mm512_add_ps(u, v), _mm512_set1_ps(1.001f), _CMP_LE_OQ);
+  const __m512 t = _mm512_mul_ps(_mm512_fmadd_ps(e2x, qx, _mm512_fmadd_ps(e2y, qy, _mm512_mul_ps(e2z, qz))), invDet);
+  mask &= _mm512_cmp_ps_mask(t, _mm512_setzero_ps(), _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, _mm512_set1_ps(_tMax), _CMP_LT_OQ);
+  if (mask == 0)
+  {
+    return false;
+  }
+  // the closest of the lanes that hit
+  const float tMin = _mm512_mask_reduce_min_ps(mask, t);
+  const unsigned int closest = mask & _mm512_cmp_ps_mask(t, _mm512_set1_ps(tMin), _CMP_EQ_OQ);
+  int lane = 0;
+  while (!(closest & (1u << lane)))
+  {
+    ++lane;
+  }
+  alignas(64) float us[16];
+  alignas(64) float vs[16];
+  _mm512_store_ps(us, u);
+  _mm512_store_ps(vs, v);
+  o_hit.m_t = tMin;
+  o_hit.m_u = us[lane];
+  o_hit.m_v = vs[lane];
+  o_hit.m_triIndex = m_ids[_first + lane];
+  return true;
+}
+
+#elif defined(__AVX2__)
+
+bool TriangleSoA::intersectBlock(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const
+{
+#if defined(__FMA__)
+#define TRIANGLESOA_FMADD(a, b, c) _mm256_fmadd_ps(a, b, c)
+#define TRIANGLESOA_FMSUB(a, b, c) _mm256_fmsub_ps(a, b, c)
+#else
+#define TRIANGLESOA_FMADD(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#define TRIANGLESOA_FMSUB(a, b, c) _mm256_sub_ps(_mm256_mul_ps(a, b), c)
+#endif
+  const __m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(_count)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+  const __m256 dx = _mm256_set1_ps(_ray.m_dir.m_x);
+  const __m256 dy = _mm256_set1_ps(_ray.m_dir.m_y);
+  const __m256 dz = _mm256_set1_ps(_ray.m_dir.m_z);
+  const __m256 e1x = _mm256_loadu_ps(&m_e1x[_first]);
+  const __m256 e1y = _mm256_loadu_ps(&m_e1y[_first]);
+  const __m256 e1z = _mm256_loadu_ps(&m_e1z[_first]);
+  const __m256 e2x = _mm256_loadu_ps(&m_e2x[_first]);
+  const __m256 e2y = _mm256_loadu_ps(&m_e2y[_first]);
+  const __m256 e2z = _mm256_loadu_ps(&m_e2z[_first]);
+  // pvec = dir x edge2
+  const __m256 px = TRIANGLESOA_FMSUB(dy, e2z, _mm256_mul_ps(dz, e2y));
+  const __m256 py = TRIANGLESOA_FMSUB(dz, e2x, _mm256_mul_ps(dx, e2z));
+  const __m256 pz = TRIANGLESOA_FMSUB(dx, e2y, _mm256_mul_ps(dy, e2x));
+  const __m256 det = TRIANGLESOA_FMADD(e1x, px, TRIANGLESOA_FMADD(e1y, py, _mm256_mul_ps(e1z, pz)));
+  const __m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+  __m256 mask = _mm256_and_ps(valid, _mm256_cmp_ps(absDet, _mm256_set1_ps(0.00001f), _CMP_GE_OQ));
+  const __m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+  // tvec = origin - v0
+  const __m256 tx = _mm256_sub_ps(_mm256_set1_ps(_ray.m_origin.m_x), _mm256_loadu_ps(&m_v0x[_first]));
+  const __m256 ty = _mm256_sub_ps(_mm256_set1_ps(_ray.m_origin.m_y), _mm256_loadu_ps(&m_v0y[_first]));
+  const __m256 tz = _mm256_sub_ps(_mm256_set1_ps(_ray.m_origin.m_z), _mm256_loadu_ps(&m_v0z[_first]));
+  const __m256 u = _mm256_mul_ps(TRIANGLESOA_FMADD(tx, px, TRIANGLESOA_FMADD(ty, py, _mm256_mul_ps(tz, pz))), invDet);
+  mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, _mm256_set1_ps(-0.001f), _CMP_GE_OQ), _mm256_cmp_ps(u, _mm256_set1_ps(1.001f), _CMP_LE_OQ)));
+  // qvec = tvec x edge1
+  const __m256 qx = TRIANGLESOA_FMSUB(ty, e1z, _mm256_mul_ps(tz, e1y));
+  const __m256 qy = TRIANGLESOA_FMSUB(tz, e1x, _mm256_mul_ps(tx, e1z));
+  const __m256 qz = TRIANGLESOA_FMSUB(tx, e1y, _mm256_mul_ps(ty, e1x));
+  const __m256 v = _mm256_mul_ps(TRIANGLESOA_FMADD(dx, qx, TRIANGLESOA_FMADD(dy, qy, _mm256_mul_ps(dz, qz))), invDet);
+  mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(v, _mm256_set1_ps(-0.001f), _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.001f), _CMP_LE_OQ)));
+  const __m256 t = _mm256_mul_ps(TRIANGLESOA_FMADD(e2x, qx, TRIANGLESOA_FMADD(e2y, qy, _mm256_mul_ps(e2z, qz))), invDet);
+  mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(_tMax), _CMP_LT_OQ)));
+#undef TRIANGLESOA_FMADD
+#undef TRIANGLESOA_FMSUB
+  const int hits = _mm256_movemask_ps(mask);
+  if (hits == 0)
+  {
+    return false;
+  }
+  // horizontal min of the lanes that hit
+  __m256 tHit = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, mask);
+  __m256 tMin = _mm256_min_ps(tHit, _mm256_permute2f128_ps(tHit, tHit, 1));
+  tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+  tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(2, 3, 0, 1)));
+  const int closest = hits & _mm256_movemask_ps(_mm256_cmp_ps(tHit, tMin, _CMP_EQ_OQ));
+  int lane = 0;
+  while (!(closest & (1 << lane)))
+  {
+    ++lane;
+  }
+  alignas(32) float ts[8];
+  alignas(32) float us[8];
+  alignas(32) float vs[8];
+  _mm256_store_ps(ts, t);
+  _mm256_store_ps(us, u);
+  _mm256_store_ps(vs, v);
+  o_hit.m_t = ts[lane];
+  o_hit.m_u = us[lane];
+  o_hit.m_v = vs[lane];
+  o_hit.m_triIndex = m_ids[_first + lane];
+  return true;
+}
+
+#else
+
+bool TriangleSoA::intersectBlock(const Ray &_ray, uint32_t _first, uint32_t _count, float _tMax, TriHit &o_hit) const
+{
+  // the same lane by lane test written so the compiler can vectorise it with whatever it has
+  float ts[s_width];
+  float us[s_width];
+  float vs[s_width];
+  for (uint32_t i = 0; i < s_width; ++i)
+  {
+    const uint32_t j = _first + i;
+    const float px = _ray.m_dir.m_y * m_e2z[j] - _ray.m_dir.m_z * m_e2y[j];
+    const float py = _ray.m_dir.m_z * m_e2x[j] - _ray.m_dir.m_x * m_e2z[j];
+    const float pz = _ray.m_dir.m_x * m_e2y[j] - _ray.m_dir.m_y * m_e2x[j];
+    const float det = m_e1x[j] * px + m_e1y[j] * py + m_e1z[j] * pz;
+    const float invDet = 1.0f / det;
+    const float tx = _ray.m_origin.m_x - m_v0x[j];
+    const float ty = _ray.m_origin.m_y - m_v0y[j];
+    const float tz = _ray.m_origin.m_z - m_v0z[j];
+    const float u = (tx * px + ty * py + tz * pz) * invDet;
+    const float qx = ty * m_e1z[j] - tz * m_e1y[j];
+    const float qy = tz * m_e1x[j] - tx * m_e1z[j];
+    const float qz = tx * m_e1y[j] - ty * m_e1x[j];
+    const float v = (_ray.m_dir.m_x * qx + _ray.m_dir.m_y * qy + _ray.m_dir.m_z * qz) * invDet;
+    const float t = (m_e2x[j] * qx + m_e2y[j] * qy + m_e2z[j] * qz) * invDet;
+    const bool hit = i < _count && (det <= -0.00001f || det >= 0.00001f) && u >= -0.001f && u <= 1.001f &&
+                     v >= -0.001f && u + v <= 1.001f && t > 0.0f && t < _tMax;
+    ts[i] = hit ? t : FLT_MAX;
+    us[i] = u;
+    vs[i] = v;
+  }
+  uint32_t lane = 0;
+  for (uint32_t i = 1; i < s_width; ++i)
+  {
+    if (ts[i] < ts[lane])
+    {
+      lane = i;
+    }
+  }
+  if (ts[lane] == FLT_MAX)
+  {
+    return false;
+  }
+  o_hit.m_t = ts[lane];
+  o_hit.m_u = us[lane];
+  o_hit.m_v = vs[lane];
+  o_hit.m_triIndex = m_ids[_first + lane];
+  return true;
+}
+
+#endif
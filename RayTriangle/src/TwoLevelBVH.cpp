@@ -0,0 +1,157 @@
+#include "TwoLevelBVH.h"
+
+ngl::Vec3 TwoLevelBVH::transformPoint(const ngl::Mat4 &_m, const ngl::Vec3 &_p)
+{
+  // ngl stores the matrix column major as m_m[column][row] with the translation in column 3
+  return ngl::Vec3(_m.m_m[0][0] * _p.m_x + _m.m_m[1][0] * _p.m_y + _m.m_m[2][0] * _p.m_z + _m.m_m[3][0],
+                   _m.m_m[0][1] * _p.m_x + _m.m_m[1][1] * _p.m_y + _m.m_m[2][1] * _p.m_z + _m.m_m[3][1],
+                   _m.m_m[0][2] * _p.m_x + _m.m_m[1][2] * _p.m_y + _m.m_m[2][2] * _p.m_z + _m.m_m[3][2]);
+}
+
+ngl::Vec3 TwoLevelBVH::transformVector(const ngl::Mat4 &_m, const ngl::Vec3 &_v)
+{
+  return ngl::Vec3(_m.m_m[0][0] * _v.m_x + _m.m_m[1][0] * _v.m_y + _m.m_m[2][0] * _v.m_z,
+                   _m.m_m[0][1] * _v.m_x + _m.m_m[1][1] * _v.m_y + _m.m_m[2][1] * _v.m_z,
+                   _m.m_m[0][2] * _v.m_x + _m.m_m[1][2] * _v.m_y + _m.m_m[2][2] * _v.m_z);
+}
+
+uint32_t TwoLevelBVH::addMesh(const IndexedMesh &_mesh)
+{
+  m_meshes.emplace_back();
+  Mesh &mesh = m_meshes.back();
+  size_t numTriangles = _mesh.numTriangles();
+  std::vector<AABB> bounds(numTriangles);
+  mesh.m_tris.resize(numTriangles);
+  for (size_t i = 0; i < numTriangles; ++i)
+  {
+    mesh.m_tris[i] = TriAccel(_mesh.corner(i, 0), _mesh.corner(i, 1), _mesh.corner(i, 2));
+    bounds[i].extend(_mesh.corner(i, 0));
+    bounds[i].extend(_mesh.corner(i, 1));
+    bounds[i].extend(_mesh.corner(i, 2));
+  }
+  mesh.m_bvh.build(bounds);
+  mesh.m_soa.build(mesh.m_tris, mesh.m_bvh.primIndexData());
+  return static_cast<uint32_t>(m_meshes.size() - 1);
+}
+
+uint32_t TwoLevelBVH::addInstance(uint32_t _mesh, const ngl::Mat4 &_transform)
+{
+  m_instances.push_back({_mesh, ngl::Mat4(), ngl::Mat4()});
+  setTransform(static_cast<uint32_t>(m_instances.size() - 1), _transform);
+  return static_cast<uint32_t>(m_instances.size() - 1);
+}
+
+void TwoLevelBVH::setTransform(uint32_t _instance, const ngl::Mat4 &_transform)
+{
+  Instance &instance = m_instances[_instance];
+  instance.m_transform = _transform;
+  instance.m_inverse = _transform;
+  instance.m_inverse = instance.m_inverse.inverse();
+}
+
+void TwoLevelBVH::build()
+{
+  // the world box of each instance is the box around the eight transformed corners of its mesh box
+  std::vector<AABB> bounds(m_instances.size());
+  for (size_t i = 0; i < m_instances.size(); ++i)
+  {
+    const AABB &b = m_meshes[m_instances[i].m_mesh].m_bvh.bounds();
+    if (b.isEmpty())
+    {
+      continue;
+    }
+    for (int c = 0; c < 8; ++c)
+    {
+      ngl::Vec3 corner(c & 1 ? b.m_max.m_x : b.m_min.m_x, c & 2 ? b.m_max.m_y : b.m_min.m_y, c & 4 ? b.m_max.m_z : b.m_min.m_z);
+      bounds[i].extend(transformPoint(m_instances[i].m_transform, corner));
+    }
+  }
+  // one instance per leaf so the nearest instances are traced first
+  m_tlas.build(bounds, 1);
+}
+
+Ray TwoLevelBVH::toObject(const Instance &_instance, const Ray &_ray) const
+{
+  return Ray(transformPoint(_instance.m_inverse, _ray.m_origin), transformVector(_instance.m_inverse, _ray.m_dir));
+}
+
+InstanceHit TwoLevelBVH::closestHit(const Ray &_ray, float _tMax) const
+{
+  InstanceHit result;
+  m_tlas.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                  {
+                    for (uint32_t i = _first; i < _first + _count; ++i)
+                    {
+                      const uint32_t id = m_tlas.primIndex(i);
+                      const Instance &instance = m_instances[id];
+                      const Mesh &mesh = m_meshes[instance.m_mesh];
+                      TriHit hit = ::closestHit(mesh.m_bvh, mesh.m_soa, toObject(instance, _ray), io_tMax);
+                      if (hit.isHit())
+                      {
+                        result.m_hit = hit;
+                        result.m_instance = id;
+                        io_tMax = hit.m_t;
+                      }
+                    }
+                    return false; });
+  return result;
+}
+
+bool TwoLevelBVH::occluded(const Ray &_ray, float _tMax) const
+{
+  bool blocked = false;
+  m_tlas.traverse(_ray, _tMax, [&](uint32_t _first, uint32_t _count, float &io_tMax)
+                  {
+                    for (uint32_t i = _first; i < _first + _count && !blocked; ++i)
+                    {
+                      const Instance &instance = m_instances[m_tlas.primIndex(i)];
+                      const Mesh &mesh = m_meshes[instance.m_mesh];
+                      blocked = ::occluded(mesh.m_bvh, mesh.m_soa, toObject(instance, _ray), io_tMax);
+                    }
+                    return blocked; });
+  return blocked;
+}
+
+ngl::Vec3 TwoLevelBVH::worldNormal(const InstanceHit &_hit) const
+{
+  // normals go through the inverse transpose so they stay at right angles to the surface under non uniform scale
+  const Instance &instance = m_instances[_hit.m_instance];
+  const ngl::Vec3 &n = m_meshes[instance.m_mesh].m_tris[_hit.m_hit.m_triIndex].m_normal;
+  const ngl::Mat4 &inv = instance.m_inverse;
+  ngl::Vec3 world(inv.m_m[0][0] * n.m_x + inv.m_m[0][1] * n.m_y + inv.m_m[0][2] * n.m_z,
+                  inv.m_m[1][0] * n.m_x + inv.m_m[1][1] * n.m_y + inv.m_m[1][2] * n.m_z,
+                  inv.m_m[2][0] * n.m_x + inv.m_m[2][1] * n.m_y + inv.m_m[2][2] * n.m_z);
+  world.normalize();
+  return world;
+}
+
+size_t TwoLevelBVH::numInstancedTriangles() const
+{
+  size_t count = 0;
+  for (auto &i : m_instances)
+  {
+    count += m_meshes[i.m_mesh].m_tris.size();
+  }
+  return count;
+}
+
+size_t TwoLevelBVH::memoryUsage() const
+{
+  size_t bytes = m_instances.size() * sizeof(Instance) + m_tlas.memoryUsage();
+  for (auto &m : m_meshes)
+  {
+    bytes += m.m_tris.size() * sizeof(TriAccel) + m.m_soa.memoryUsage() + m.m_bvh.memoryUsage();
+  }
+  return bytes;
+}
+
+size_t TwoLevelBVH::flattenedMemoryUsage() const
+{
+  size_t bytes = 0;
+  for (auto &i : m_instances)
+  {
+    const Mesh &m = m_meshes[i.m_mesh];
+    bytes += m.m_tris.size() * sizeof(TriAccel) + m.m_soa.memoryUsage() + m.m_bvh.memoryUsage();
+  }
+  return bytes;
+}
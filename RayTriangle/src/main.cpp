@@ -2,13 +2,57 @@
 basic OpenGL demo modified from http://qt-project.org/doc/qt-5.0/qtgui/openglwindow.html
 ****************************************************************************/
 #include <QtGui/QGuiApplication>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include "NGLScene.h"
 
 
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief read a whole argument as an int, false if it isn't a number or doesn't fit
+//----------------------------------------------------------------------------------------------------------------------
+static bool parseInt(const char *_arg, int &o_value)
+{
+  char *end=nullptr;
+  errno=0;
+  long value=std::strtol(_arg,&end,10);
+  if(end==_arg || *end!='\0' || errno==ERANGE || value<INT_MIN || value>INT_MAX)
+  {
+    return false;
+  }
+  o_value=static_cast<int>(value);
+  return true;
+}
 
 int main(int argc, char **argv)
 {
+  // headless mode, RayTriangle [numTriangles|mesh.obj|mesh.ply] --render width height threads file [--normal]
+  // renders the scene with rays on the CPU and exits without opening a window
+  int renderArg=0;
+  for(int i=1; i<argc; ++i)
+  {
+    if(std::strcmp(argv[i],"--render")==0)
+    {
+      renderArg=i;
+    }
+  }
+  // the sizes and thread count are checked here as a negative or zero one would wrap or divide by zero later
+  int width=0;
+  int height=0;
+  int threads=0;
+  if(renderArg !=0)
+  {
+    if(renderArg+4 >= argc || !parseInt(argv[renderArg+1],width) || !parseInt(argv[renderArg+2],height) ||
+       !parseInt(argv[renderArg+3],threads) || width<=0 || height<=0 || threads<0)
+    {
+      std::cerr<<"usage "<<argv[0]<<" [numTriangles|mesh.obj|mesh.ply] --render width height threads file [--normal]\n";
+      return EXIT_FAILURE;
+    }
+    // the window is never shown so no display is needed
+    qputenv("QT_QPA_PLATFORM","offscreen");
+  }
   QGuiApplication app(argc, argv);
   // create an OpenGL format specifier
   QSurfaceFormat format;
@@ -29,15 +73,31 @@ int main(int argc, char **argv)
   format.setProfile(QSurfaceFormat::CoreProfile);
   // now set the depth buffer to 24 bits
   format.setDepthBufferSize(24);
-  int numTriangles;
-  if(argc ==1)
-    numTriangles=50;
-  else
-    numTriangles=atoi(argv[1]);
+  int numTriangles=50;
+  std::string meshFile;
+  if(argc >1 && renderArg!=1)
+  {
+    // anything that isn't a number is taken as a mesh file to load
+    if(!parseInt(argv[1],numTriangles))
+    {
+      meshFile=argv[1];
+    }
+    else if(numTriangles<=0)
+    {
+      std::cerr<<"usage "<<argv[0]<<" [numTriangles|mesh.obj|mesh.ply] [--render width height threads file [--normal]]\n";
+      return EXIT_FAILURE;
+    }
+  }
 
 
   // now we are going to create our scene window
-  NGLScene window(numTriangles);
+  NGLScene window(numTriangles,meshFile);
+  if(renderArg !=0)
+  {
+    bool normals=renderArg+5 < argc && std::strcmp(argv[renderArg+5],"--normal")==0;
+    bool written=window.renderImage(width,height,static_cast<unsigned int>(threads),argv[renderArg+4],normals);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
   // and set the OpenGL format
   window.setFormat(format);
   // we can now query the version to see if it worked
@@ -0,0 +1,86 @@
+#ifndef HEIGHTFIELD_H_
+#define HEIGHTFIELD_H_
+
+#include <ngl/Vec3.h>
+#include <cstdint>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file HeightField.h
+/// @brief terrain as a regular grid of heights over the xz plane, each cell is split into two triangles along the
+/// diagonal from its low x high z corner. A sphere finds the cells under it from its position alone, so there is no
+/// tree to build or search. When the sphere is no wider than a cell it covers at most a 2x2 block of cells, those
+/// eight triangles are tested for four spheres at a time with SSE.
+//----------------------------------------------------------------------------------------------------------------------
+class HeightField
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the deepest contact of a sphere with the terrain
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Contact
+  {
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief unit normal out of the terrain towards the sphere
+    //----------------------------------------------------------------------------------------------------------------------
+    ngl::Vec3 m_normal;
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief how far the sphere has gone into the terrain, 0 when it doesn't touch it
+    //----------------------------------------------------------------------------------------------------------------------
+    float m_depth;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a vertex of the drawing mesh, position and normal together so the mesh is one buffer
+  //----------------------------------------------------------------------------------------------------------------------
+  struct Vertex
+  {
+    ngl::Vec3 m_pos;
+    ngl::Vec3 m_normal;
+  };
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief a flat terrain
+  /// @param _origin the corner at the lowest x and z, its y is added to every height
+  /// @param _cellSize the side of a square cell
+  /// @param _cellsX _cellsZ the number of cells along each side
+  //----------------------------------------------------------------------------------------------------------------------
+  HeightField(const ngl::Vec3 &_origin, float _cellSize, int _cellsX, int _cellsZ);
+  void setHeight(int _x, int _z, float _height) { m_heights[index(_x, _z)] = _height; }
+  float getHeight(int _x, int _z) const { return m_heights[index(_x, _z)]; }
+  int getCellsX() const { return m_cellsX; }
+  int getCellsZ() const { return m_cellsZ; }
+  float getCellSize() const { return m_cellSize; }
+  const ngl::Vec3 &getOrigin() const { return m_origin; }
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the contacts of a batch of spheres given as separate arrays of coordinates and radii
+  /// @param o_contacts one contact for each sphere
+  //----------------------------------------------------------------------------------------------------------------------
+  void collide(const float *_x, const float *_y, const float *_z, const float *_radius, size_t _count, Contact *o_contacts) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the contact of one sphere, testing every cell under it one triangle at a time
+  /// @returns true if the sphere touches the terrain
+  //----------------------------------------------------------------------------------------------------------------------
+  bool collideSphere(const ngl::Vec3 &_centre, float _radius, Contact &o_contact) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the triangles for drawing with a normal at each vertex from the heights around it
+  //----------------------------------------------------------------------------------------------------------------------
+  void mesh(std::vector<Vertex> &o_vertices, std::vector<uint32_t> &o_indices) const;
+
+private:
+  size_t index(int _x, int _z) const { return static_cast<size_t>(_z) * (m_cellsX + 1) + _x; }
+  ngl::Vec3 vertex(int _x, int _z) const;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the contact of a sphere with one triangle, kept if it is deeper than io_contact
+  //----------------------------------------------------------------------------------------------------------------------
+  static void triangleContact(const ngl::Vec3 &_centre, float _radius, const ngl::Vec3 &_a, const ngl::Vec3 &_b,
+                              const ngl::Vec3 &_c, Contact &io_contact);
+  ngl::Vec3 m_origin;
+  float m_cellSize;
+  int m_cellsX;
+  int m_cellsZ;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief (m_cellsX + 1) * (m_cellsZ + 1) heights, a row of x for each z
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_heights;
+};
+
+#endif
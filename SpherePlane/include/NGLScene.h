@@ -3,6 +3,9 @@
 #include "WindowParams.h"
 #include "Sphere.h"
 #include "Plane.h"
+#include "HeightField.h"
+#include "ParticlePool.h"
+#include <ngl/AbstractVAO.h>
 #include <memory>
 #include <QOpenGLWindow>
 
@@ -67,12 +70,26 @@ private:
     int m_sphereUpdateTimer;
     /// @brief flag to indicate if animation is active or not
     bool m_animate;
-    /// @brief our spheres to test against
-    std::vector<Sphere> m_sphereArray;
-    /// @brief number of spheres
+    /// @brief our spheres to test against, each lives for a fixed number of ticks
+    ParticlePool<Sphere> m_spheres;
+    /// @brief number of spheres, the emitter spawns enough each tick to keep about this many alive
     int m_numSpheres;
+    /// @brief the fraction of a sphere left over from the last tick's spawn
+    float m_spawnCarry = 0.0f;
     /// @brief
     Plane *m_plane;
+    /// @brief the terrain the spheres fall on when m_useTerrain is set, the demo starts on the plane and T swaps
+    /// between them
+    std::unique_ptr<HeightField> m_terrain;
+    std::unique_ptr<ngl::AbstractVAO> m_terrainVAO;
+    bool m_useTerrain = false;
+    /// @brief the sphere positions and radii as separate arrays for HeightField::collide()
+    std::vector<float> m_sphereX;
+    std::vector<float> m_sphereY;
+    std::vector<float> m_sphereZ;
+    std::vector<float> m_sphereRadius;
+    std::vector<uint32_t> m_sphereSlots;
+    std::vector<HeightField::Contact> m_contacts;
     //----------------------------------------------------------------------------------------------------------------------
     /// @brief method to load transform matrices to the shader
     //----------------------------------------------------------------------------------------------------------------------
@@ -83,9 +100,34 @@ private:
     //----------------------------------------------------------------------------------------------------------------------
     void updateScene();
     //----------------------------------------------------------------------------------------------------------------------
+    /// @brief expire the spheres that have lived their time and drop new ones from above the plane
+    //----------------------------------------------------------------------------------------------------------------------
+    void emitSpheres();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time a pool spawning and expiring at 10^4 to 10^6 spheres a second against a vector that is
+    /// appended to and compacted
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkEmitter();
+    //----------------------------------------------------------------------------------------------------------------------
     /// @brief check collisions
     //----------------------------------------------------------------------------------------------------------------------
     void spherePlaneCollide();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief collide the spheres with m_terrain
+    //----------------------------------------------------------------------------------------------------------------------
+    void sphereTerrainCollide();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief set the heights of a terrain to rolling hills from its x and z
+    //----------------------------------------------------------------------------------------------------------------------
+    static void makeHills(HeightField &io_terrain);
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief upload m_terrain to m_terrainVAO, positions and normals interleaved in one buffer
+    //----------------------------------------------------------------------------------------------------------------------
+    void createTerrainVAO();
+    //----------------------------------------------------------------------------------------------------------------------
+    /// @brief time 10^6 spheres on a 1024x1024 terrain four at a time against one at a time
+    //----------------------------------------------------------------------------------------------------------------------
+    void benchmarkTerrain();
 
      //----------------------------------------------------------------------------------------------------------------------
     /// @brief Qt Event called when a key is pressed
@@ -0,0 +1,177 @@
+#ifndef PARTICLEPOOL_H_
+#define PARTICLEPOOL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+/// @file ParticlePool.h
+/// @brief a fixed number of particle slots allocated up front. Spawning takes slots off a free list and killing or
+/// expiring a particle puts its slot back, so once the pool is made nothing is allocated however many particles
+/// come and go. The free list is a stack so the slot freed last is reused first while it is still in cache. A
+/// particle keeps its slot for its whole life, so a slot number is a reference to it that stays good until it dies.
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+class ParticlePool
+{
+public:
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief make every slot, all free
+  //----------------------------------------------------------------------------------------------------------------------
+  explicit ParticlePool(size_t _capacity);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief bring up to _count particles to life
+  /// @param _life how long they live, in whatever units are passed to expire()
+  /// @param _init called as _init(T &_particle) to set up each new particle
+  /// @returns how many were spawned, fewer than _count when the pool runs out of free slots
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename InitFunc>
+  size_t spawn(size_t _count, float _life, InitFunc &&_init);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief free a slot, killing a slot that is already free does nothing
+  //----------------------------------------------------------------------------------------------------------------------
+  void kill(uint32_t _slot);
+  void kill(const std::vector<uint32_t> &_slots);
+  void killAll();
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief age every particle by _dt and kill the ones whose life has run out
+  /// @returns how many died
+  //----------------------------------------------------------------------------------------------------------------------
+  size_t expire(float _dt);
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief call _func(T &_particle, uint32_t _slot) for each live particle in slot order
+  //----------------------------------------------------------------------------------------------------------------------
+  template <typename Func>
+  void forEach(Func &&_func);
+  template <typename Func>
+  void forEach(Func &&_func) const;
+  T &operator[](uint32_t _slot) { return m_particles[_slot]; }
+  const T &operator[](uint32_t _slot) const { return m_particles[_slot]; }
+  bool isAlive(uint32_t _slot) const { return m_alive[_slot] != 0; }
+  size_t size() const { return m_particles.size() - m_free.size(); }
+  size_t capacity() const { return m_particles.size(); }
+
+private:
+  std::vector<T> m_particles;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief life left for each slot, only meaningful for live slots
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<float> m_life;
+  std::vector<uint8_t> m_alive;
+  //----------------------------------------------------------------------------------------------------------------------
+  /// @brief the free slots, reserved to the capacity so pushing never reallocates
+  //----------------------------------------------------------------------------------------------------------------------
+  std::vector<uint32_t> m_free;
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+ParticlePool<T>::ParticlePool(size_t _capacity)
+    : m_particles(_capacity), m_life(_capacity, 0.0f), m_alive(_capacity, 0)
+{
+  m_free.reserve(_capacity);
+  killAll();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+template <typename InitFunc>
+size_t ParticlePool<T>::spawn(size_t _count, float _life, InitFunc &&_init)
+{
+  const size_t count = std::min(_count, m_free.size());
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint32_t slot = m_free.back();
+    m_free.pop_back();
+    m_alive[slot] = 1;
+    m_life[slot] = _life;
+    _init(m_particles[slot]);
+  }
+  return count;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+void ParticlePool<T>::kill(uint32_t _slot)
+{
+  if (m_alive[_slot])
+  {
+    m_alive[_slot] = 0;
+    m_free.push_back(_slot);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+void ParticlePool<T>::kill(const std::vector<uint32_t> &_slots)
+{
+  for (uint32_t slot : _slots)
+  {
+    kill(slot);
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+void ParticlePool<T>::killAll()
+{
+  std::fill(m_alive.begin(), m_alive.end(), 0);
+  // pushed highest first so the low slots are handed out first and the live particles start packed together
+  m_free.clear();
+  for (size_t slot = m_particles.size(); slot > 0; --slot)
+  {
+    m_free.push_back(static_cast<uint32_t>(slot - 1));
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+size_t ParticlePool<T>::expire(float _dt)
+{
+  size_t died = 0;
+  for (uint32_t slot = 0; slot < m_particles.size(); ++slot)
+  {
+    if (m_alive[slot])
+    {
+      m_life[slot] -= _dt;
+      if (m_life[slot] <= 0.0f)
+      {
+        m_alive[slot] = 0;
+        m_free.push_back(slot);
+        ++died;
+      }
+    }
+  }
+  return died;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+template <typename Func>
+void ParticlePool<T>::forEach(Func &&_func)
+{
+  for (uint32_t slot = 0; slot < m_particles.size(); ++slot)
+  {
+    if (m_alive[slot])
+    {
+      _func(m_particles[slot], slot);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+template <typename T>
+template <typename Func>
+void ParticlePool<T>::forEach(Func &&_func) const
+{
+  for (uint32_t slot = 0; slot < m_particles.size(); ++slot)
+  {
+    if (m_alive[slot])
+    {
+      _func(m_particles[slot], slot);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,332 @@
+#include "HeightField.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define HEIGHTFIELD_USE_SSE 1
+#endif
+
+HeightField::HeightField(const ngl::Vec3 &_origin, float _cellSize, int _cellsX, int _cellsZ)
+{
+  m_origin = _origin;
+  m_cellSize = _cellSize;
+  m_cellsX = _cellsX;
+  m_cellsZ = _cellsZ;
+  m_heights.assign(static_cast<size_t>(_cellsX + 1) * (_cellsZ + 1), 0.0f);
+}
+
+ngl::Vec3 HeightField::vertex(int _x, int _z) const
+{
+  return ngl::Vec3(m_origin.m_x + _x * m_cellSize, m_origin.m_y + getHeight(_x, _z), m_origin.m_z + _z * m_cellSize);
+}
+
+void HeightField::triangleContact(const ngl::Vec3 &_centre, float _radius, const ngl::Vec3 &_a, const ngl::Vec3 &_b,
+                                  const ngl::Vec3 &_c, Contact &io_contact)
+{
+  const ngl::Vec3 e0 = _b - _a;
+  const ngl::Vec3 e1 = _c - _a;
+  const ngl::Vec3 ap = _centre - _a;
+  ngl::Vec3 normal = e0.cross(e1);
+  normal /= std::sqrt(normal.dot(normal));
+  // barycentric coordinates of the centre projected onto the triangle's plane
+  const float d00 = e0.dot(e0);
+  const float d01 = e0.dot(e1);
+  const float d11 = e1.dot(e1);
+  const float d20 = ap.dot(e0);
+  const float d21 = ap.dot(e1);
+  const float denom = d00 * d11 - d01 * d01;
+  const float v = (d11 * d20 - d01 * d21) / denom;
+  const float w = (d00 * d21 - d01 * d20) / denom;
+  // and of the centre dropped straight down onto the triangle in xz
+  const float denomXZ = e0.m_x * e1.m_z - e0.m_z * e1.m_x;
+  const float vXZ = (ap.m_x * e1.m_z - ap.m_z * e1.m_x) / denomXZ;
+  const float wXZ = (e0.m_x * ap.m_z - e0.m_z * ap.m_x) / denomXZ;
+  const float planeDistance = normal.dot(ap);
+  float depth;
+  // above the plane the closest point is on the face when the projection is, below it the centre is inside the
+  // ground however deep when it is straight under the face
+  if ((planeDistance >= 0.0f && v >= 0.0f && w >= 0.0f && v + w <= 1.0f) ||
+      (planeDistance < 0.0f && vXZ >= 0.0f && wXZ >= 0.0f && vXZ + wXZ <= 1.0f))
+  {
+    depth = _radius - planeDistance;
+  }
+  else
+  {
+    // otherwise the closest point is on one of the edges
+    float best2 = std::numeric_limits<float>::max();
+    ngl::Vec3 closest;
+    auto edge = [&](const ngl::Vec3 &_start, const ngl::Vec3 &_edge)
+    {
+      float t = std::min(std::max((_centre - _start).dot(_edge) / _edge.dot(_edge), 0.0f), 1.0f);
+      ngl::Vec3 q = _start + _edge * t;
+      ngl::Vec3 toCentre = _centre - q;
+      float d2 = toCentre.dot(toCentre);
+      if (d2 < best2)
+      {
+        best2 = d2;
+        closest = q;
+      }
+    };
+    edge(_a, e0);
+    edge(_a, e1);
+    edge(_b, _c - _b);
+    float distance = std::sqrt(best2);
+    depth = _radius - distance;
+    if (distance > 0.0f)
+    {
+      normal = (_centre - closest) / distance;
+    }
+  }
+  if (depth > io_contact.m_depth)
+  {
+    io_contact.m_depth = depth;
+    io_contact.m_normal = normal;
+  }
+}
+
+bool HeightField::collideSphere(const ngl::Vec3 &_centre, float _radius, Contact &o_contact) const
+{
+  o_contact.m_normal.set(0.0f, 0.0f, 0.0f);
+  o_contact.m_depth = 0.0f;
+  // the cells under the sphere's extent in x and z
+  auto cellRange = [this](float _low, float _high, int _cells, int &o_first, int &o_last)
+  {
+    o_first = static_cast<int>(std::floor(std::max(_low / m_cellSize, -1.0f)));
+    o_last = static_cast<int>(std::floor(std::min(_high / m_cellSize, static_cast<float>(_cells))));
+    o_first = std::max(o_first, 0);
+    o_last = std::min(o_last, _cells - 1);
+  };
+  int firstX;
+  int lastX;
+  int firstZ;
+  int lastZ;
+  cellRange(_centre.m_x - _radius - m_origin.m_x, _centre.m_x + _radius - m_origin.m_x, m_cellsX, firstX, lastX);
+  cellRange(_centre.m_z - _radius - m_origin.m_z, _centre.m_z + _radius - m_origin.m_z, m_cellsZ, firstZ, lastZ);
+  for (int z = firstZ; z <= lastZ; ++z)
+  {
+    for (int x = firstX; x <= lastX; ++x)
+    {
+      ngl::Vec3 v00 = vertex(x, z);
+      ngl::Vec3 v10 = vertex(x + 1, z);
+      ngl::Vec3 v01 = vertex(x, z + 1);
+      triangleContact(_centre, _radius, v00, v01, v10, o_contact);
+      triangleContact(_centre, _radius, v10, v01, vertex(x + 1, z + 1), o_contact);
+    }
+  }
+  return o_contact.m_depth > 0.0f;
+}
+
+void HeightField::collide(const float *_x, const float *_y, const float *_z, const float *_radius, size_t _count, Contact *o_contacts) const
+{
+  size_t i = 0;
+#ifdef HEIGHTFIELD_USE_SSE
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 cellSize = _mm_set1_ps(m_cellSize);
+  auto select = [](__m128 _mask, __m128 _a, __m128 _b)
+  { return _mm_or_ps(_mm_and_ps(_mask, _a), _mm_andnot_ps(_mask, _b)); };
+  auto dot = [](__m128 _ax, __m128 _ay, __m128 _az, __m128 _bx, __m128 _by, __m128 _bz)
+  { return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_ax, _bx), _mm_mul_ps(_ay, _by)), _mm_mul_ps(_az, _bz)); };
+  for (; i + 4 <= _count; i += 4)
+  {
+    // each sphere's 2x2 block of cells starts at the cell under its low x and z extent, the 3x3 corner heights
+    // are gathered lane by lane, corners off the grid are clamped and their cells masked out
+    alignas(16) float cornerY[9][4];
+    alignas(16) float baseX[4];
+    alignas(16) float baseZ[4];
+    alignas(16) uint32_t cellMask[4][4];
+    bool wide = false;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+      const size_t s = i + lane;
+      wide |= 2.0f * _radius[s] > m_cellSize;
+      float fx = (_x[s] - _radius[s] - m_origin.m_x) / m_cellSize;
+      float fz = (_z[s] - _radius[s] - m_origin.m_z) / m_cellSize;
+      int cx = static_cast<int>(std::floor(std::min(std::max(fx, -2.0f), static_cast<float>(m_cellsX))));
+      int cz = static_cast<int>(std::floor(std::min(std::max(fz, -2.0f), static_cast<float>(m_cellsZ))));
+      baseX[lane] = m_origin.m_x + cx * m_cellSize;
+      baseZ[lane] = m_origin.m_z + cz * m_cellSize;
+      for (int dz = 0; dz < 3; ++dz)
+      {
+        for (int dx = 0; dx < 3; ++dx)
+        {
+          int x = std::min(std::max(cx + dx, 0), m_cellsX);
+          int z = std::min(std::max(cz + dz, 0), m_cellsZ);
+          cornerY[dz * 3 + dx][lane] = m_origin.m_y + getHeight(x, z);
+        }
+      }
+      for (int dz = 0; dz < 2; ++dz)
+      {
+        for (int dx = 0; dx < 2; ++dx)
+        {
+          bool inside = cx + dx >= 0 && cx + dx < m_cellsX && cz + dz >= 0 && cz + dz < m_cellsZ;
+          cellMask[dz * 2 + dx][lane] = inside ? ~0u : 0u;
+        }
+      }
+    }
+    const __m128 px = _mm_loadu_ps(&_x[i]);
+    const __m128 py = _mm_loadu_ps(&_y[i]);
+    const __m128 pz = _mm_loadu_ps(&_z[i]);
+    const __m128 radius = _mm_loadu_ps(&_radius[i]);
+    __m128 bestDepth = zero;
+    __m128 bestNX = zero;
+    __m128 bestNY = zero;
+    __m128 bestNZ = zero;
+    // the same test as triangleContact() for four spheres each against its own triangle
+    auto triangle = [&](__m128 _ax, __m128 _ay, __m128 _az, __m128 _bx, __m128 _by, __m128 _bz,
+                        __m128 _cx, __m128 _cy, __m128 _cz, __m128 _mask)
+    {
+      const __m128 e0x = _mm_sub_ps(_bx, _ax);
+      const __m128 e0y = _mm_sub_ps(_by, _ay);
+      const __m128 e0z = _mm_sub_ps(_bz, _az);
+      const __m128 e1x = _mm_sub_ps(_cx, _ax);
+      const __m128 e1y = _mm_sub_ps(_cy, _ay);
+      const __m128 e1z = _mm_sub_ps(_cz, _az);
+      const __m128 apx = _mm_sub_ps(px, _ax);
+      const __m128 apy = _mm_sub_ps(py, _ay);
+      const __m128 apz = _mm_sub_ps(pz, _az);
+      __m128 nx = _mm_sub_ps(_mm_mul_ps(e0y, e1z), _mm_mul_ps(e0z, e1y));
+      __m128 ny = _mm_sub_ps(_mm_mul_ps(e0z, e1x), _mm_mul_ps(e0x, e1z));
+      __m128 nz = _mm_sub_ps(_mm_mul_ps(e0x, e1y), _mm_mul_ps(e0y, e1x));
+      const __m128 length = _mm_sqrt_ps(dot(nx, ny, nz, nx, ny, nz));
+      nx = _mm_div_ps(nx, length);
+      ny = _mm_div_ps(ny, length);
+      nz = _mm_div_ps(nz, length);
+      const __m128 d00 = dot(e0x, e0y, e0z, e0x, e0y, e0z);
+      const __m128 d01 = dot(e0x, e0y, e0z, e1x, e1y, e1z);
+      const __m128 d11 = dot(e1x, e1y, e1z, e1x, e1y, e1z);
+      const __m128 d20 = dot(apx, apy, apz, e0x, e0y, e0z);
+      const __m128 d21 = dot(apx, apy, apz, e1x, e1y, e1z);
+      const __m128 denom = _mm_sub_ps(_mm_mul_ps(d00, d11), _mm_mul_ps(d01, d01));
+      const __m128 v = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(d11, d20), _mm_mul_ps(d01, d21)), denom);
+      const __m128 w = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(d00, d21), _mm_mul_ps(d01, d20)), denom);
+      const __m128 denomXZ = _mm_sub_ps(_mm_mul_ps(e0x, e1z), _mm_mul_ps(e0z, e1x));
+      const __m128 vXZ = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(apx, e1z), _mm_mul_ps(apz, e1x)), denomXZ);
+      const __m128 wXZ = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(e0x, apz), _mm_mul_ps(e0z, apx)), denomXZ);
+      const __m128 planeDistance = dot(nx, ny, nz, apx, apy, apz);
+      const __m128 above = _mm_cmpge_ps(planeDistance, zero);
+      const __m128 overFace = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmpge_ps(w, zero)),
+                                         _mm_cmple_ps(_mm_add_ps(v, w), one));
+      const __m128 underFace = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(vXZ, zero), _mm_cmpge_ps(wXZ, zero)),
+                                          _mm_cmple_ps(_mm_add_ps(vXZ, wXZ), one));
+      const __m128 onFace = select(above, overFace, underFace);
+      __m128 best2 = _mm_set1_ps(std::numeric_limits<float>::max());
+      __m128 qx = zero;
+      __m128 qy = zero;
+      __m128 qz = zero;
+      auto edge = [&](__m128 _sx, __m128 _sy, __m128 _sz, __m128 _ex, __m128 _ey, __m128 _ez)
+      {
+        __m128 t = _mm_div_ps(dot(_mm_sub_ps(px, _sx), _mm_sub_ps(py, _sy), _mm_sub_ps(pz, _sz), _ex, _ey, _ez),
+                              dot(_ex, _ey, _ez, _ex, _ey, _ez));
+        t = _mm_min_ps(_mm_max_ps(t, zero), one);
+        const __m128 ex = _mm_add_ps(_sx, _mm_mul_ps(_ex, t));
+        const __m128 ey = _mm_add_ps(_sy, _mm_mul_ps(_ey, t));
+        const __m128 ez = _mm_add_ps(_sz, _mm_mul_ps(_ez, t));
+        const __m128 tx = _mm_sub_ps(px, ex);
+        const __m128 ty = _mm_sub_ps(py, ey);
+        const __m128 tz = _mm_sub_ps(pz, ez);
+        const __m128 d2 = dot(tx, ty, tz, tx, ty, tz);
+        const __m128 closer = _mm_cmplt_ps(d2, best2);
+        best2 = select(closer, d2, best2);
+        qx = select(closer, ex, qx);
+        qy = select(closer, ey, qy);
+        qz = select(closer, ez, qz);
+      };
+      edge(_ax, _ay, _az, e0x, e0y, e0z);
+      edge(_ax, _ay, _az, e1x, e1y, e1z);
+      edge(_bx, _by, _bz, _mm_sub_ps(_cx, _bx), _mm_sub_ps(_cy, _by), _mm_sub_ps(_cz, _bz));
+      const __m128 distance = _mm_sqrt_ps(best2);
+      const __m128 offEdge = _mm_andnot_ps(onFace, _mm_cmpgt_ps(distance, zero));
+      const __m128 depth = select(onFace, _mm_sub_ps(radius, planeDistance), _mm_sub_ps(radius, distance));
+      nx = select(offEdge, _mm_div_ps(_mm_sub_ps(px, qx), distance), nx);
+      ny = select(offEdge, _mm_div_ps(_mm_sub_ps(py, qy), distance), ny);
+      nz = select(offEdge, _mm_div_ps(_mm_sub_ps(pz, qz), distance), nz);
+      const __m128 deeper = _mm_and_ps(_mask, _mm_cmpgt_ps(depth, bestDepth));
+      bestDepth = select(deeper, depth, bestDepth);
+      bestNX = select(deeper, nx, bestNX);
+      bestNY = select(deeper, ny, bestNY);
+      bestNZ = select(deeper, nz, bestNZ);
+    };
+    for (int dz = 0; dz < 2; ++dz)
+    {
+      for (int dx = 0; dx < 2; ++dx)
+      {
+        const __m128 x0 = _mm_add_ps(_mm_load_ps(baseX), _mm_mul_ps(_mm_set1_ps(static_cast<float>(dx)), cellSize));
+        const __m128 z0 = _mm_add_ps(_mm_load_ps(baseZ), _mm_mul_ps(_mm_set1_ps(static_cast<float>(dz)), cellSize));
+        const __m128 x1 = _mm_add_ps(x0, cellSize);
+        const __m128 z1 = _mm_add_ps(z0, cellSize);
+        const __m128 y00 = _mm_load_ps(cornerY[dz * 3 + dx]);
+        const __m128 y10 = _mm_load_ps(cornerY[dz * 3 + dx + 1]);
+        const __m128 y01 = _mm_load_ps(cornerY[(dz + 1) * 3 + dx]);
+        const __m128 y11 = _mm_load_ps(cornerY[(dz + 1) * 3 + dx + 1]);
+        const __m128 mask = _mm_load_ps(reinterpret_cast<const float *>(cellMask[dz * 2 + dx]));
+        triangle(x0, y00, z0, x0, y01, z1, x1, y10, z0, mask);
+        triangle(x1, y10, z0, x0, y01, z1, x1, y11, z1, mask);
+      }
+    }
+    alignas(16) float depths[4];
+    alignas(16) float normalX[4];
+    alignas(16) float normalY[4];
+    alignas(16) float normalZ[4];
+    _mm_store_ps(depths, bestDepth);
+    _mm_store_ps(normalX, bestNX);
+    _mm_store_ps(normalY, bestNY);
+    _mm_store_ps(normalZ, bestNZ);
+    for (int lane = 0; lane < 4; ++lane)
+    {
+      o_contacts[i + lane].m_normal.set(normalX[lane], normalY[lane], normalZ[lane]);
+      o_contacts[i + lane].m_depth = depths[lane];
+    }
+    // a sphere wider than a cell can reach past the 2x2 block
+    if (wide)
+    {
+      for (int lane = 0; lane < 4; ++lane)
+      {
+        const size_t s = i + lane;
+        if (2.0f * _radius[s] > m_cellSize)
+        {
+          collideSphere(ngl::Vec3(_x[s], _y[s], _z[s]), _radius[s], o_contacts[s]);
+        }
+      }
+    }
+  }
+#endif
+  for (; i < _count; ++i)
+  {
+    collideSphere(ngl::Vec3(_x[i], _y[i], _z[i]), _radius[i], o_contacts[i]);
+  }
+}
+
+void HeightField::mesh(std::vector<Vertex> &o_vertices, std::vector<uint32_t> &o_indices) const
+{
+  o_vertices.resize(m_heights.size());
+  for (int z = 0; z <= m_cellsZ; ++z)
+  {
+    for (int x = 0; x <= m_cellsX; ++x)
+    {
+      // central differences of the heights, one sided at the edges of the grid
+      float dx = getHeight(std::min(x + 1, m_cellsX), z) - getHeight(std::max(x - 1, 0), z);
+      float dz = getHeight(x, std::min(z + 1, m_cellsZ)) - getHeight(x, std::max(z - 1, 0));
+      float spanX = (std::min(x + 1, m_cellsX) - std::max(x - 1, 0)) * m_cellSize;
+      float spanZ = (std::min(z + 1, m_cellsZ) - std::max(z - 1, 0)) * m_cellSize;
+      ngl::Vec3 normal(-dx / spanX, 1.0f, -dz / spanZ);
+      normal.normalize();
+      o_vertices[index(x, z)] = {vertex(x, z), normal};
+    }
+  }
+  o_indices.clear();
+  o_indices.reserve(static_cast<size_t>(m_cellsX) * m_cellsZ * 6);
+  for (int z = 0; z < m_cellsZ; ++z)
+  {
+    for (int x = 0; x < m_cellsX; ++x)
+    {
+      uint32_t v00 = static_cast<uint32_t>(index(x, z));
+      uint32_t v10 = static_cast<uint32_t>(index(x + 1, z));
+      uint32_t v01 = static_cast<uint32_t>(index(x, z + 1));
+      uint32_t v11 = static_cast<uint32_t>(index(x + 1, z + 1));
+      o_indices.insert(o_indices.end(), {v00, v01, v10, v10, v01, v11});
+    }
+  }
+}
@@ -9,9 +9,15 @@
 #include <ngl/VAOFactory.h>
 #include "MultiBufferIndexVAO.h"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+//----------------------------------------------------------------------------------------------------------------------
+/// @brief how many ticks a sphere lives for before it is dropped again
+//----------------------------------------------------------------------------------------------------------------------
+const static float s_sphereLife = 20.0f;
 
-NGLScene::NGLScene(int _numSpheres)
+NGLScene::NGLScene(int _numSpheres) : m_spheres(static_cast<size_t>(_numSpheres))
 {
   m_numSpheres = _numSpheres;
 
@@ -21,14 +27,10 @@ NGLScene::NGLScene(int _numSpheres)
   // now create the actual spheres for our program
 
   m_plane = new Plane(ngl::Vec3(0, 0, 0), 5, 5);
-  ngl::Vec3 pos;
-  // now create the actual spheres for our program
-
-  m_sphereArray.resize(_numSpheres);
-  std::generate(std::begin(m_sphereArray), std::end(m_sphereArray), [this]()
-                { return Sphere(ngl::Vec3(ngl::Random::randomNumber(6), 8,
-                                          ngl::Random::randomNumber(6)),
-                                ngl::Vec3(0.0f, -1.0f, 0.0f), 0.2f); });
+  // 12x12 under where the spheres are dropped, cells wider than the spheres so each looks at 2x2 cells at most
+  m_terrain = std::make_unique<HeightField>(ngl::Vec3(-6.0f, -2.0f, -6.0f), 0.5f, 24, 24);
+  makeHills(*m_terrain);
+  // the spheres are spawned by emitSpheres() as the scene runs
 }
 
 NGLScene::~NGLScene()
@@ -78,6 +80,36 @@ void NGLScene::initializeGL()
   ngl::VAOPrimitives::createSphere("sphere", 1.0f, 40.0f);
   ngl::VAOFactory::registerVAOCreator("multiBufferIndexVAO", MultiBufferIndexVAO::create);
   ngl::VAOFactory::listCreators();
+  createTerrainVAO();
+}
+
+void NGLScene::makeHills(HeightField &io_terrain)
+{
+  for (int z = 0; z <= io_terrain.getCellsZ(); ++z)
+  {
+    for (int x = 0; x <= io_terrain.getCellsX(); ++x)
+    {
+      float px = io_terrain.getOrigin().m_x + x * io_terrain.getCellSize();
+      float pz = io_terrain.getOrigin().m_z + z * io_terrain.getCellSize();
+      io_terrain.setHeight(x, z, std::sin(px * 0.8f) * std::cos(pz * 0.6f));
+    }
+  }
+}
+
+void NGLScene::createTerrainVAO()
+{
+  std::vector<HeightField::Vertex> vertices;
+  std::vector<uint32_t> indices;
+  m_terrain->mesh(vertices, indices);
+  m_terrainVAO = ngl::VAOFactory::createVAO("multiBufferIndexVAO", GL_TRIANGLES);
+  m_terrainVAO->bind();
+  m_terrainVAO->setData(MultiBufferIndexVAO::VertexData(vertices.size() * sizeof(HeightField::Vertex), vertices[0].m_pos.m_x));
+  // both attributes come from the one buffer, the normal 3 floats after the position
+  m_terrainVAO->setVertexAttributePointer(0, 3, GL_FLOAT, sizeof(HeightField::Vertex), 0);
+  m_terrainVAO->setVertexAttributePointer(1, 3, GL_FLOAT, sizeof(HeightField::Vertex), 3);
+  dynamic_cast<MultiBufferIndexVAO *>(m_terrainVAO.get())->setIndices(static_cast<unsigned int>(indices.size()), indices.data(), GL_UNSIGNED_INT);
+  m_terrainVAO->setNumIndices(indices.size());
+  m_terrainVAO->unbind();
 }
 
 void NGLScene::loadMatricesToShader()
@@ -123,31 +155,113 @@ void NGLScene::paintGL()
   m_mouseGlobalTX.m_m[3][1] = m_modelPos.m_y;
   m_mouseGlobalTX.m_m[3][2] = m_modelPos.m_z;
 
-  m_plane->draw("nglDiffuseShader", m_view, m_project, m_mouseGlobalTX);
-  for (Sphere s : m_sphereArray)
+  if (m_useTerrain)
   {
-    s.draw("nglDiffuseShader", m_mouseGlobalTX, m_view, m_project);
+    loadMatricesToShader();
+    ngl::ShaderLib::setUniform("Colour", 0.2f, 0.7f, 0.3f, 1.0f);
+    m_terrainVAO->bind();
+    m_terrainVAO->draw();
+    m_terrainVAO->unbind();
+    ngl::ShaderLib::setUniform("Colour", 1.0f, 1.0f, 0.0f, 1.0f);
   }
+  else
+  {
+    m_plane->draw("nglDiffuseShader", m_view, m_project, m_mouseGlobalTX);
+  }
+  m_spheres.forEach([this](const Sphere &_s, uint32_t)
+                    { _s.draw("nglDiffuseShader", m_mouseGlobalTX, m_view, m_project); });
 }
 
 void NGLScene::updateScene()
 {
-  static int updateCount = 0;
-  for (Sphere &s : m_sphereArray)
+  emitSpheres();
+  m_spheres.forEach([](Sphere &_s, uint32_t)
+                    { _s.move(); });
+  if (m_useTerrain)
+  {
+    sphereTerrainCollide();
+  }
+  else
   {
-    s.move();
+    spherePlaneCollide();
   }
-  spherePlaneCollide();
+}
 
-  if (++updateCount == 20)
+void NGLScene::emitSpheres()
+{
+  // a steady stream rather than the whole set at once, m_numSpheres over a lifetime keeps about m_numSpheres alive
+  m_spheres.expire(1.0f);
+  m_spawnCarry += m_numSpheres / s_sphereLife;
+  size_t count = static_cast<size_t>(m_spawnCarry);
+  m_spawnCarry -= count;
+  m_spheres.spawn(count, s_sphereLife, [](Sphere &_s)
+                  { _s.set(ngl::Vec3(ngl::Random::randomNumber(6.0f), 8.0f, ngl::Random::randomNumber(6.0f)),
+                           ngl::Vec3(0.0f, -1.0f, 0.0f), 0.2f); });
+}
+
+void NGLScene::benchmarkEmitter()
+{
+  // a second of sixty ticks with every sphere living for a second, so at a rate of r there are about r alive
+  constexpr int ticksPerSecond = 60;
+  constexpr int numSeconds = 3;
+  const float dt = 1.0f / ticksPerSecond;
+  auto init = [](Sphere &_s)
+  { _s.set(ngl::Random::getRandomPoint(6.0f, 6.0f, 6.0f), ngl::Vec3(0.0f, -0.1f, 0.0f), 0.2f); };
+  for (size_t rate : {10000, 100000, 1000000})
   {
-    updateCount = 0;
-    ngl::Vec3 pos;
-    for (Sphere &s : m_sphereArray)
+    const size_t perTick = rate / ticksPerSecond;
+    // pool, one second to fill it then timed
+    ParticlePool<Sphere> pool(rate + perTick);
+    std::chrono::high_resolution_clock::time_point start;
+    for (int tick = 0; tick < ticksPerSecond * (numSeconds + 1); ++tick)
+    {
+      if (tick == ticksPerSecond)
+      {
+        start = std::chrono::high_resolution_clock::now();
+      }
+      pool.expire(dt);
+      pool.spawn(perTick, 1.0f, init);
+      pool.forEach([](Sphere &_s, uint32_t)
+                   { _s.move(); });
+    }
+    double poolTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    // a vector appended to and compacted each tick with the lives alongside
+    std::vector<Sphere> spheres;
+    std::vector<float> lives;
+    for (int tick = 0; tick < ticksPerSecond * (numSeconds + 1); ++tick)
     {
-      pos.set(ngl::Random::randomNumber(6.0f), 8.0f, ngl::Random::randomNumber(6.0f));
-      s.set(pos, ngl::Vec3(0.0f, -1.0f, 0.0f), 0.2f);
+      if (tick == ticksPerSecond)
+      {
+        start = std::chrono::high_resolution_clock::now();
+      }
+      size_t alive = 0;
+      for (size_t i = 0; i < spheres.size(); ++i)
+      {
+        lives[i] -= dt;
+        if (lives[i] > 0.0f)
+        {
+          spheres[alive] = spheres[i];
+          lives[alive++] = lives[i];
+        }
+      }
+      spheres.resize(alive);
+      lives.resize(alive);
+      for (size_t i = 0; i < perTick; ++i)
+      {
+        spheres.emplace_back();
+        init(spheres.back());
+        lives.push_back(1.0f);
+      }
+      for (Sphere &s : spheres)
+      {
+        s.move();
+      }
     }
+    double vectorTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    const int numTicks = ticksPerSecond * numSeconds;
+    std::cout << rate << " spheres/s, " << pool.size() << " alive, pool " << poolTime / numTicks << " ms a tick, vector "
+              << vectorTime / numTicks << " ms a tick\n";
   }
 }
 void NGLScene::timerEvent(QTimerEvent *_event)
@@ -166,7 +280,7 @@ void NGLScene::spherePlaneCollide()
 {
   ngl::Vec3 p;
   GLfloat D;
-  for (Sphere &s : m_sphereArray)
+  m_spheres.forEach([&](Sphere &s, uint32_t)
   {
     p = s.getPos();
 
@@ -191,7 +305,86 @@ void NGLScene::spherePlaneCollide()
         s.setHit();
       } // end of hit test
     }
-  } // end of each face test
+  }); // end of each face test
+}
+
+void NGLScene::sphereTerrainCollide()
+{
+  // the live spheres packed into arrays, with their slots to write the results back to
+  m_sphereX.clear();
+  m_sphereY.clear();
+  m_sphereZ.clear();
+  m_sphereRadius.clear();
+  m_sphereSlots.clear();
+  m_spheres.forEach([this](const Sphere &_s, uint32_t _slot)
+                    {
+                      ngl::Vec3 p = _s.getPos();
+                      m_sphereX.push_back(p.m_x);
+                      m_sphereY.push_back(p.m_y);
+                      m_sphereZ.push_back(p.m_z);
+                      m_sphereRadius.push_back(_s.getRadius());
+                      m_sphereSlots.push_back(_slot); });
+  const size_t numSpheres = m_sphereSlots.size();
+  m_contacts.resize(numSpheres);
+  m_terrain->collide(m_sphereX.data(), m_sphereY.data(), m_sphereZ.data(), m_sphereRadius.data(), numSpheres, m_contacts.data());
+  for (size_t i = 0; i < numSpheres; ++i)
+  {
+    const HeightField::Contact &contact = m_contacts[i];
+    if (contact.m_depth > 0.0f)
+    {
+      // lift the sphere out of the ground and send it off along the normal as the plane does
+      Sphere &s = m_spheres[m_sphereSlots[i]];
+      s.set(s.getPos() + contact.m_normal * contact.m_depth, contact.m_normal, s.getRadius());
+      s.setHit();
+    }
+  }
+}
+
+void NGLScene::benchmarkTerrain()
+{
+  constexpr size_t numSpheres = 1000000;
+  constexpr int numPasses = 5;
+  HeightField terrain(ngl::Vec3(-512.0f, 0.0f, -512.0f), 1.0f, 1024, 1024);
+  makeHills(terrain);
+  std::vector<float> x(numSpheres);
+  std::vector<float> y(numSpheres);
+  std::vector<float> z(numSpheres);
+  std::vector<float> radius(numSpheres);
+  for (size_t i = 0; i < numSpheres; ++i)
+  {
+    x[i] = ngl::Random::randomNumber(512.0f);
+    y[i] = ngl::Random::randomNumber(2.0f);
+    z[i] = ngl::Random::randomNumber(512.0f);
+    radius[i] = ngl::Random::randomPositiveNumber(0.4f) + 0.1f;
+  }
+  std::vector<HeightField::Contact> batch(numSpheres);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < numPasses; ++pass)
+  {
+    terrain.collide(x.data(), y.data(), z.data(), radius.data(), numSpheres, batch.data());
+  }
+  double batchTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / numPasses;
+  std::vector<HeightField::Contact> single(numSpheres);
+  start = std::chrono::high_resolution_clock::now();
+  for (int pass = 0; pass < numPasses; ++pass)
+  {
+    for (size_t i = 0; i < numSpheres; ++i)
+    {
+      terrain.collideSphere(ngl::Vec3(x[i], y[i], z[i]), radius[i], single[i]);
+    }
+  }
+  double singleTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / numPasses;
+  size_t contacts = 0;
+  size_t differ = 0;
+  for (size_t i = 0; i < numSpheres; ++i)
+  {
+    contacts += batch[i].m_depth > 0.0f;
+    differ += std::abs(batch[i].m_depth - single[i].m_depth) > 1e-4f;
+  }
+  std::cout << numSpheres << " spheres on a " << terrain.getCellsX() << "x" << terrain.getCellsZ() << " terrain, "
+            << contacts << " contacts\n"
+            << "four at a time " << batchTime << " ms (" << numSpheres / batchTime * 1000.0 << " spheres/s)\n"
+            << "one at a time " << singleTime << " ms, " << differ << " differ\n";
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -308,6 +501,15 @@ void NGLScene::keyPressEvent(QKeyEvent *_event)
   case Qt::Key_Right:
     m_plane->tilt(1.0, 0, 1);
     break;
+  case Qt::Key_T:
+    m_useTerrain ^= true;
+    break;
+  case Qt::Key_B:
+    benchmarkTerrain();
+    break;
+  case Qt::Key_E:
+    benchmarkEmitter();
+    break;
   default:
     break;
   }